@@ -34,6 +34,10 @@ static struct instruction_st s_inst_table[] = {
     {"BNN",     BNN,    OP_TYPE_I},
     {"BC",      BC,     OP_TYPE_I},
     {"BNC",     BNC,    OP_TYPE_I},
+    {"TRAP",    TRAP,   OP_TYPE_I},     // TRAP grX, vh, vl: host call {vh, vl}
+    {"RETI",    RETI,   OP_TYPE_NONE},
+    {"CSR",     CSR,    OP_TYPE_I},     // CSR grX, 0|1, n: read|write control register n
+    {"CAS",     CAS,    OP_TYPE_R},     // CAS grX, grY, grZ: if data[grY] == grX then data[grY] = grZ
 };
 
 int get_register_number(const char *reg) {
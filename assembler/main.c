@@ -17,6 +17,11 @@ static int assemble_file(const char *file_in, const char *file_out)
     char line[256];
     while (fgets(line, sizeof(line), input)) {
         char mnemonic[16], op1[16], op2[16], op3[16];
+        // ';' starts a comment; blank and comment-only lines produce no word
+        line[strcspn(line, ";")] = '\0';
+        if (line[strspn(line, " \t\r\n")] == '\0') {
+            continue;
+        }
         int num_operands = sscanf(line, "%s %[^,], %[^,], %s", mnemonic, op1, op2, op3);
         uint16_t binary_instruction = 0;
         if (num_operands == 4) {
@@ -35,7 +40,7 @@ static int assemble_file(const char *file_in, const char *file_out)
     }
     fclose(input);
     fclose(output);
-    printf("Assembly complete: %s.bin\n", file_out);
+    printf("Assembly complete: %s\n", file_out);
     return 0;
 }
 
@@ -64,16 +69,16 @@ static int disassemble_file(const char *file_in, const char *file_out)
 // 主程序
 int main(int argc, char *argv[]) {
     if (argc < 3) {
-        fprintf(stderr, "Usage: %s <assemble|disassemble> <filename>\n", argv[0]);
+        fprintf(stderr, "Usage: %s <assemble|disassemble> <filename> [output_file]\n", argv[0]);
         return 1;
     }
 
     if (strcmp(argv[1], "assemble") == 0) {
         // Assembly mode
-        assemble_file(argv[2], "a.bin");
+        assemble_file(argv[2], argc > 3 ? argv[3] : "a.bin");
     } else if (strcmp(argv[1], "disassemble") == 0) {
         // Disassembly mode
-        disassemble_file(argv[2], "a.asm");
+        disassemble_file(argv[2], argc > 3 ? argv[3] : "a.asm");
     } else {
         fprintf(stderr, "Unknown parameter: %s\n", argv[1]);
         return 1;
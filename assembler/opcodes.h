@@ -30,9 +30,9 @@
     XX(0b11110, BC,               "BC"                ) \
     XX(0b11111, BNC,              "BNC"               ) \
     XX(0b10011, TRAP,             "TRAP"              ) \
-    XX(0b10100, RESEVE1,          "RESEVE1"           ) \
-    XX(0b10101, RESEVE2,          "RESEVE2"           ) \
-    XX(0b10110, RESEVE3,          "RESEVE3"           ) \
+    XX(0b10100, RETI,             "RETI"              ) \
+    XX(0b10101, CSR,              "CSR"               ) \
+    XX(0b10110, CAS,              "CAS"               ) \
     XX(0b10111, RESEVE4,          "RESEVE4"           ) \
 
 
@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "emulator/opcodes.h"
+#include "emulator/emulator.h"
+#include "emulator/lockstep.h"
+#include "emulator/loader.h"
+#include "emulator/profile.h"
+#include "bench.h"
+
+#define BENCH_CLASSES_ARRAY_GEN(n, s) [n] = (s),
+static const char *s_class_str[] = {
+    BENCH_CLASSES(BENCH_CLASSES_ARRAY_GEN)
+};
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_class(uint8_t opcode)
+{
+    switch (opcode) {
+        case LDIH: case ADD: case ADDI: case ADDC: case SUB: case SUBI: case SUBC:
+        case CMP: case AND: case OR: case XOR:
+            return BENCH_ALU;
+        case SLL: case SRL: case SLA: case SRA:
+            return BENCH_SHIFT;
+        case LOAD: case STORE: case CAS:
+            return BENCH_MEMORY;
+        case JUMP: case JMPR:
+        case BZ: case BNZ: case BN: case BNN: case BC: case BNC:
+            return BENCH_BRANCH;
+        default:
+            return BENCH_SYSTEM;
+    }
+}
+
+const char *bench_class_name(int class)
+{
+    if (class < 0 || class >= BENCH_CLASS_COUNT) {
+        return "unknown";
+    }
+    return s_class_str[class];
+}
+
+static void bench_set_name(struct bench_result_st *result, const char *filename)
+{
+    const char *base = strrchr(filename, '/');
+    base = base ? base + 1 : filename;
+    snprintf(result->name, sizeof(result->name), "%s", base);
+    char *dot = strrchr(result->name, '.');
+    if (dot && dot != result->name) {
+        *dot = '\0';
+    }
+}
+
+static int bench_same(const cpu_t *a, const cpu_t *b)
+{
+    if (memcmp(a->regs, b->regs, sizeof(a->regs)) != 0 || a->pc != b->pc || a->steps != b->steps) {
+        return 0;
+    }
+    for (uint32_t addr = 0; addr < a->mem_words; addr++) {
+        if (cpu_data_word(a, addr) != cpu_data_word(b, addr)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Reference run on the switch engine with a profile attached, giving the
+ * instruction mix and the final state every engine has to reach.
+ */
+static int bench_reference(const cpu_t *program, uint64_t max_steps, cpu_t *ref,
+                           struct bench_result_st *result)
+{
+    struct profile_st *profile = profile_create(0);
+    if (!profile) {
+        return -1;
+    }
+    if (cpu_fork(ref, program) != 0) {
+        profile_destroy(profile);
+        return -1;
+    }
+    cpu_set_profile(ref, profile);
+    result->status = cpu_run(ref, CPU_ENGINE_SWITCH, max_steps);
+    result->steps = ref->steps;
+    cpu_set_profile(ref, NULL);
+
+    // Instruction memory never changes while a program runs
+    for (uint32_t pc = 0; pc < ref->mem_words; pc++) {
+        if (profile->counts[pc]) {
+            result->classes[bench_class(ref->mem_inst[pc] >> 11)] += profile->counts[pc];
+        }
+    }
+    profile_destroy(profile);
+    return 0;
+}
+
+/*
+ * One timed run of engine from the loaded program, leaving the final state
+ * in cpu. The simd engine runs CPU_LANES copies in lockstep, which never
+ * branch apart, and leaves lane 0.
+ */
+static int bench_once(const cpu_t *program, int engine, uint64_t max_steps, cpu_t *cpu,
+                      double *seconds, uint64_t *instructions)
+{
+    double start;
+
+    if (cpu_fork(cpu, program) != 0) {
+        return -1;
+    }
+    if (engine != CPU_ENGINE_SIMD) {
+        start = bench_now();
+        cpu_run(cpu, engine, max_steps);
+        *seconds = bench_now() - start;
+        *instructions = cpu->steps;
+        return 0;
+    }
+
+    cpu_batch_t batch;
+    if (cpu_batch_init(&batch, program, CPU_LANES) != 0) {
+        return -1;
+    }
+    start = bench_now();
+    cpu_batch_exec(&batch, CPU_ENGINE_FASTEST, max_steps);
+    *seconds = bench_now() - start;
+    *instructions = 0;
+    for (int lane = 0; lane < CPU_LANES; lane++) {
+        *instructions += batch.steps[lane];
+    }
+    int ret = cpu_batch_get_lane(&batch, 0, cpu);
+    cpu_batch_release(&batch);
+    return ret;
+}
+
+/*
+ * Measure a program file on each engine: the fastest of repeat runs, each
+ * checked against the reference state.
+ */
+int bench_run(const char *filename, const int *engines, int count, int repeat,
+              uint64_t max_steps, struct bench_result_st *result)
+{
+    cpu_t program, ref;
+    int ret = -1;
+
+    memset(result, 0, sizeof(*result));
+    bench_set_name(result, filename);
+    if (cpu_init(&program) != 0) {
+        return -1;
+    }
+    if (cpu_map_program(&program, filename) < 0 || cpu_predecode(&program) != 0) {
+        fprintf(stderr, "Failed to load program: %s\n", filename);
+        cpu_release(&program);
+        return -1;
+    }
+    if (bench_reference(&program, max_steps, &ref, result) != 0) {
+        cpu_release(&program);
+        return -1;
+    }
+
+    for (int i = 0; i < count && i < BENCH_ENGINES_MAX; i++) {
+        struct bench_engine_st *engine = &result->engines[result->count++];
+        engine->engine = engines[i];
+        for (int run = 0; run < repeat; run++) {
+            cpu_t cpu;
+            double seconds;
+            if (bench_once(&program, engine->engine, max_steps, &cpu, &seconds, &engine->instructions) != 0) {
+                cpu_release(&cpu);
+                goto out;
+            }
+            int same = bench_same(&cpu, &ref);
+            cpu_release(&cpu);
+            if (!same) {
+                fprintf(stderr, "%s: %s stops in a different state from switch\n", result->name,
+                        cpu_engine_name(engine->engine));
+                goto out;
+            }
+            if (run == 0 || seconds < engine->seconds) {
+                engine->seconds = seconds;
+            }
+        }
+    }
+    ret = 0;
+
+out:
+    cpu_release(&ref);
+    cpu_release(&program);
+    return ret;
+}
+
+static double bench_mips(const struct bench_engine_st *engine)
+{
+    return engine->seconds > 0 ? engine->instructions / engine->seconds / 1e6 : 0.0;
+}
+
+static double bench_ns(const struct bench_engine_st *engine)
+{
+    return engine->instructions ? engine->seconds * 1e9 / engine->instructions : 0.0;
+}
+
+/*
+ * Text report, or JSON lines: one object with the instruction mix per
+ * workload, then one per engine.
+ */
+void bench_print(const struct bench_result_st *result, FILE *out, int json)
+{
+    if (json) {
+        fprintf(out, "{\"workload\": \"%s\", \"status\": \"%s\", \"instructions\": %llu, \"classes\": {",
+                result->name, cpu_status_name(result->status), (unsigned long long)result->steps);
+        for (int i = 0; i < BENCH_CLASS_COUNT; i++) {
+            fprintf(out, "%s\"%s\": %llu", i ? ", " : "", s_class_str[i],
+                    (unsigned long long)result->classes[i]);
+        }
+        fprintf(out, "}}\n");
+        for (int i = 0; i < result->count; i++) {
+            const struct bench_engine_st *engine = &result->engines[i];
+            fprintf(out, "{\"workload\": \"%s\", \"engine\": \"%s\", \"instructions\": %llu, "
+                    "\"seconds\": %.6f, \"mips\": %.2f, \"ns_per_inst\": %.3f}\n",
+                    result->name, cpu_engine_name(engine->engine),
+                    (unsigned long long)engine->instructions, engine->seconds,
+                    bench_mips(engine), bench_ns(engine));
+        }
+        return;
+    }
+
+    fprintf(out, "%s: %llu instructions, %s\n", result->name, (unsigned long long)result->steps,
+            cpu_status_name(result->status));
+    fprintf(out, "   ");
+    for (int i = 0; i < BENCH_CLASS_COUNT; i++) {
+        fprintf(out, " %s %llu (%.1f%%)", s_class_str[i], (unsigned long long)result->classes[i],
+                result->steps ? 100.0 * result->classes[i] / result->steps : 0.0);
+    }
+    fprintf(out, "\n    engine          seconds       MIPS  ns/inst\n");
+    for (int i = 0; i < result->count; i++) {
+        const struct bench_engine_st *engine = &result->engines[i];
+        fprintf(out, "    %-10s %10.6f %10.2f %8.3f\n", cpu_engine_name(engine->engine),
+                engine->seconds, bench_mips(engine), bench_ns(engine));
+    }
+}
+
+/*
+ * Check results against the JSON lines of an earlier run: a workload that
+ * retires a different number of instructions, or an engine that loses more
+ * than tolerance percent of its MIPS, is a regression. Returns the number
+ * of regressions, or -1 if the baseline cannot be read.
+ */
+int bench_compare(const struct bench_result_st *results, int count, const char *baseline,
+                  double tolerance, FILE *out)
+{
+    FILE *file = fopen(baseline, "r");
+    if (!file) {
+        return -1;
+    }
+
+    char line[512];
+    int compared = 0;
+    int regressions = 0;
+    while (fgets(line, sizeof(line), file)) {
+        char name[64], engine_name[16];
+        unsigned long long instructions;
+        double seconds, mips;
+        if (sscanf(line, "{\"workload\": \"%63[^\"]\", \"engine\": \"%15[^\"]\", \"instructions\": %llu, "
+                   "\"seconds\": %lf, \"mips\": %lf", name, engine_name, &instructions, &seconds, &mips) != 5) {
+            continue;
+        }
+        for (int i = 0; i < count; i++) {
+            if (strcmp(results[i].name, name) != 0) {
+                continue;
+            }
+            for (int e = 0; e < results[i].count; e++) {
+                const struct bench_engine_st *engine = &results[i].engines[e];
+                if (strcmp(cpu_engine_name(engine->engine), engine_name) != 0) {
+                    continue;
+                }
+                compared++;
+                if (engine->instructions != instructions) {
+                    fprintf(out, "%s/%s: %llu instructions, baseline %llu\n", name, engine_name,
+                            (unsigned long long)engine->instructions, instructions);
+                    regressions++;
+                } else if (bench_mips(engine) < mips * (1 - tolerance / 100)) {
+                    fprintf(out, "%s/%s: %.2f MIPS, baseline %.2f (%.1f%%)\n", name, engine_name,
+                            bench_mips(engine), mips, 100 * (bench_mips(engine) / mips - 1));
+                    regressions++;
+                }
+            }
+        }
+    }
+    fclose(file);
+    fprintf(out, "Compared %d results with %s: %d regressions\n", compared, baseline, regressions);
+    return regressions;
+}
@@ -0,0 +1,53 @@
+#ifndef BENCH_H_20251117_
+#define BENCH_H_20251117_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "emulator/emulator.h"
+
+#define BENCH_ENGINES_MAX 8
+#define BENCH_REPEAT_DEFAULT 3      // Runs per engine, the fastest counts
+#define BENCH_TOLERANCE_DEFAULT 10  // Percent of baseline MIPS a run may lose
+
+/*
+ * Opcode classes of the instruction mix. The machine retires one
+ * instruction per cycle, so the counts are also its cycles per class.
+ */
+#define BENCH_CLASSES(XX) \
+    XX(BENCH_ALU,       "alu"       ) \
+    XX(BENCH_SHIFT,     "shift"     ) \
+    XX(BENCH_MEMORY,    "memory"    ) \
+    XX(BENCH_BRANCH,    "branch"    ) \
+    XX(BENCH_SYSTEM,    "system"    ) \
+
+#define BENCH_CLASSES_ENUM_GEN(n, s) n,
+enum bench_class {
+    BENCH_CLASSES(BENCH_CLASSES_ENUM_GEN)
+    BENCH_CLASS_COUNT,
+};
+
+struct bench_engine_st {
+    int engine;                     // enum cpu_engine
+    uint64_t instructions;          // Retired per run, by every lane for simd
+    double seconds;                 // Fastest run
+};
+
+// One workload measured on every engine
+struct bench_result_st {
+    char name[64];                  // Program file name without directory and extension
+    int status;                     // enum cpu_status of the reference run
+    uint64_t steps;
+    uint64_t classes[BENCH_CLASS_COUNT];    // Retired instructions per class
+    struct bench_engine_st engines[BENCH_ENGINES_MAX];
+    int count;
+};
+
+int bench_run(const char *filename, const int *engines, int count, int repeat,
+              uint64_t max_steps, struct bench_result_st *result);
+void bench_print(const struct bench_result_st *result, FILE *out, int json);
+int bench_compare(const struct bench_result_st *results, int count, const char *baseline,
+                  double tolerance, FILE *out);
+const char *bench_class_name(int class);
+
+#endif  // BENCH_H_20251117_
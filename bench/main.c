@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+
+#include "emulator/emulator.h"
+#include "emulator/lockstep.h"
+#include "bench.h"
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-e engine]... [-r repeat] [-n max_steps] [--json] [--baseline=file]\n"
+           "          [--tolerance=percent] <program_file>...\n"
+           "Runs each program on each engine (-e, default every engine built in) and prints\n"
+           "the instruction mix by opcode class (one cycle per instruction) and, per engine,\n"
+           "the fastest of repeat runs (default %d) as seconds, MIPS and ns per instruction.\n"
+           "Every run must stop in the same state as the switch engine. The simd engine runs\n"
+           "%d copies of the program in lockstep and counts the instructions of all of them.\n"
+           "--json prints JSON lines instead; --baseline compares with such output from an\n"
+           "earlier run and exits with status 1 if a workload retires a different number of\n"
+           "instructions or an engine loses more than tolerance percent (default %d) of its\n"
+           "MIPS. The workloads in ../program/bench run with:\n"
+           "    %s --json ../program/bench/*.bin > baseline.json\n"
+           "    %s --baseline=baseline.json ../program/bench/*.bin\n",
+           prog, BENCH_REPEAT_DEFAULT, CPU_LANES, BENCH_TOLERANCE_DEFAULT, prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        { "json", no_argument, NULL, 'J' },
+        { "baseline", required_argument, NULL, 'B' },
+        { "tolerance", required_argument, NULL, 'T' },
+        { NULL, 0, NULL, 0 },
+    };
+    int engines[BENCH_ENGINES_MAX];
+    int engine_count = 0;
+    int repeat = BENCH_REPEAT_DEFAULT;
+    uint64_t max_steps = CPU_STEPS_UNLIMITED;
+    const char *baseline = NULL;
+    double tolerance = BENCH_TOLERANCE_DEFAULT;
+    int json = 0;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "e:r:n:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'e':
+                if (engine_count == BENCH_ENGINES_MAX) {
+                    fprintf(stderr, "Too many engines\n");
+                    return 1;
+                }
+                engines[engine_count] = cpu_engine_parse(optarg);
+                if (engines[engine_count++] < 0) {
+                    fprintf(stderr, "Unknown engine: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'r':
+                repeat = atoi(optarg);
+                break;
+            case 'n':
+                max_steps = strtoull(optarg, NULL, 0);
+                break;
+            case 'J':
+                json = 1;
+                break;
+            case 'B':
+                baseline = optarg;
+                break;
+            case 'T':
+                tolerance = strtod(optarg, NULL);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc || repeat < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (engine_count == 0) {
+        engines[engine_count++] = CPU_ENGINE_SWITCH;
+#ifdef HAVE_THREADED_DISPATCH
+        engines[engine_count++] = CPU_ENGINE_THREADED;
+#endif
+#ifdef HAVE_JIT
+        engines[engine_count++] = CPU_ENGINE_JIT;
+#endif
+        engines[engine_count++] = CPU_ENGINE_BLOCK;
+        engines[engine_count++] = CPU_ENGINE_SIMD;
+    }
+
+    int count = argc - optind;
+    struct bench_result_st *results = calloc(count, sizeof(*results));
+    if (!results) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (int i = 0; i < count; i++) {
+        if (bench_run(argv[optind + i], engines, engine_count, repeat, max_steps, &results[i]) != 0) {
+            free(results);
+            return 1;
+        }
+        bench_print(&results[i], stdout, json);
+        fflush(stdout);
+    }
+
+    int ret = 0;
+    if (baseline) {
+        int regressions = bench_compare(results, count, baseline, tolerance, stderr);
+        if (regressions < 0) {
+            fprintf(stderr, "Unable to read baseline: %s\n", baseline);
+        }
+        ret = regressions != 0;
+    }
+    free(results);
+    return ret;
+}
@@ -0,0 +1,447 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "emulator/opcodes.h"
+#include "emulator/emulator.h"
+#include "emulator/lockstep.h"
+#include "emulator/loader.h"
+#include "assembler/assembler.h"
+#include "difftest.h"
+
+#define DIFF_OPCODE_GEN(v, n, s) n,
+static const uint8_t s_opcodes[] = {
+    OPCODES(DIFF_OPCODE_GEN)
+};
+
+/*
+ * Engine runs of one case: a CPU per engine, keeping its predecoded code,
+ * JIT translations or blocks across the starting states, and the final
+ * states of each engine plus two sets for bisecting.
+ */
+struct diff_runner_st {
+    const struct diff_case_st *c;
+    cpu_t cpus[DIFF_ENGINES_MAX];
+    cpu_batch_t batch;              // Lanes of the simd engine
+    int batched;                    // batch is initialized
+    struct diff_state_st *states;   // [DIFF_ENGINES_MAX + 2][CPU_LANES]
+    uint16_t *data;
+};
+
+#define DIFF_PROBE DIFF_ENGINES_MAX     // First bisecting set in states[]
+
+static double diff_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// xorshift64*
+static uint64_t diff_random(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+// Relative frequency in generated programs: instructions that end a run are rare
+static uint32_t diff_weight(uint8_t opcode)
+{
+    switch (opcode) {
+        case HALT: case TRAP:
+            return 1;
+        case RETI: case CSR:
+            return 2;
+        case RESEVE4:
+            return 0;
+        default:
+            return 8;
+    }
+}
+
+void diff_init(struct diff_st *diff, const int *engines, int count, FILE *out)
+{
+    memset(diff, 0, sizeof(*diff));
+    diff->out = out;
+    diff->engines[diff->count++].engine = CPU_ENGINE_SWITCH;
+    for (int i = 0; i < count && diff->count < DIFF_ENGINES_MAX; i++) {
+        if (engines[i] != CPU_ENGINE_SWITCH) {
+            diff->engines[diff->count++].engine = engines[i];
+        }
+    }
+}
+
+// Data memory for lanes starting states of the loaded program
+static int diff_case_lanes(struct diff_case_st *c, int lanes)
+{
+    c->lanes = lanes;
+    c->data = calloc((size_t)lanes * c->cpu.mem_words, sizeof(uint16_t));
+    if (!c->data) {
+        return -1;
+    }
+    for (int i = 0; i < lanes; i++) {
+        c->start[i].data = c->data + (size_t)i * c->cpu.mem_words;
+    }
+    return 0;
+}
+
+static void diff_save(const cpu_t *cpu, int status, struct diff_state_st *state)
+{
+    memcpy(state->regs, cpu->regs, sizeof(state->regs));
+    state->pc = cpu->pc;
+    state->nf = cpu->nf;
+    state->zf = cpu->zf;
+    state->cf = cpu->cf;
+    state->status = status;
+    state->steps = cpu->steps;
+    state->irq = cpu->irq;
+    cpu_data_read(cpu, state->data);
+}
+
+static int diff_restore(cpu_t *cpu, const struct diff_state_st *state)
+{
+    if (cpu_data_write(cpu, state->data, cpu->mem_words) != 0) {
+        return -1;
+    }
+    memcpy(cpu->regs, state->regs, sizeof(cpu->regs));
+    cpu->pc = state->pc;
+    cpu->nf = state->nf;
+    cpu->zf = state->zf;
+    cpu->cf = state->cf;
+    cpu->steps = state->steps;
+    cpu->irq = state->irq;
+    return 0;
+}
+
+// irq.stop only passes between an engine and cpu_run()
+static int diff_irq_equal(const struct cpu_irq_st *a, const struct cpu_irq_st *b)
+{
+    return a->next == b->next && a->period == b->period && a->vectors == b->vectors
+        && a->epc == b->epc && a->eflags == b->eflags && a->ie == b->ie
+        && a->mask == b->mask && a->pending == b->pending;
+}
+
+static int diff_equal(const struct diff_state_st *a, const struct diff_state_st *b, uint32_t words)
+{
+    return memcmp(a->regs, b->regs, sizeof(a->regs)) == 0
+        && a->pc == b->pc && a->nf == b->nf && a->zf == b->zf && a->cf == b->cf
+        && a->status == b->status && a->steps == b->steps
+        && diff_irq_equal(&a->irq, &b->irq)
+        && memcmp(a->data, b->data, words * sizeof(uint16_t)) == 0;
+}
+
+/*
+ * Random program filling instruction memory, so every PC a jump can reach
+ * holds code. The lanes share random registers and differ in data memory,
+ * so they branch apart after data-dependent compares.
+ */
+int diff_generate(struct diff_case_st *c, const struct cpu_config_st *config, uint64_t seed)
+{
+    uint64_t rng = seed * 0x9E3779B97F4A7C15ULL + 1;
+    uint32_t total = 0;
+
+    memset(c, 0, sizeof(*c));
+    for (int i = 0; i < ARRAY_SIZE(s_opcodes); i++) {
+        total += diff_weight(s_opcodes[i]);
+    }
+    if (cpu_init_config(&c->cpu, config) != 0) {
+        return -1;
+    }
+    if (cpu_own_text(&c->cpu) != 0 || diff_case_lanes(c, CPU_LANES) != 0) {
+        diff_case_release(c);
+        return -1;
+    }
+
+    for (uint32_t pc = 0; pc < c->cpu.mem_words; pc++) {
+        uint32_t pick = diff_random(&rng) % total;
+        int i = 0;
+        while (pick >= diff_weight(s_opcodes[i])) {
+            pick -= diff_weight(s_opcodes[i++]);
+        }
+        c->cpu.mem_inst[pc] = s_opcodes[i] << 11 | (diff_random(&rng) & 0x7FF);
+    }
+    cpu_invalidate(&c->cpu);
+
+    for (int r = 0; r < NUM_REGISTERS; r++) {
+        c->cpu.regs[r] = diff_random(&rng);
+    }
+    for (int lane = 0; lane < c->lanes; lane++) {
+        diff_save(&c->cpu, -1, &c->start[lane]);
+        for (uint32_t i = 0; i < c->cpu.mem_words; i++) {
+            c->start[lane].data[i] = diff_random(&rng);
+        }
+    }
+    return 0;
+}
+
+// A program file as one starting state, with the data memory it loads
+int diff_load(struct diff_case_st *c, const struct cpu_config_st *config, const char *filename)
+{
+    memset(c, 0, sizeof(*c));
+    if (cpu_init_config(&c->cpu, config) != 0) {
+        return -1;
+    }
+    if (cpu_map_program(&c->cpu, filename) < 0 || diff_case_lanes(c, 1) != 0) {
+        diff_case_release(c);
+        return -1;
+    }
+    diff_save(&c->cpu, -1, &c->start[0]);
+    return 0;
+}
+
+void diff_case_release(struct diff_case_st *c)
+{
+    free(c->data);
+    c->data = NULL;
+    cpu_release(&c->cpu);
+}
+
+/*
+ * Run every starting state with the engine in slot, adding the time spent
+ * to *seconds. The simd engine runs them as one batch and finishes split
+ * lanes on the switch engine, so a mismatch there is the lockstep code's.
+ */
+static int diff_exec(struct diff_runner_st *run, int slot, int engine, uint64_t budget,
+                     struct diff_state_st *states, double *seconds)
+{
+    const struct diff_case_st *c = run->c;
+    cpu_t *cpu = &run->cpus[slot];
+    double start;
+
+    if (engine == CPU_ENGINE_SIMD) {
+        for (int lane = 0; lane < c->lanes; lane++) {
+            if (diff_restore(cpu, &c->start[lane]) != 0) {
+                return -1;
+            }
+            cpu_batch_set_lane(&run->batch, lane, cpu);
+        }
+        start = diff_now();
+        cpu_batch_exec(&run->batch, CPU_ENGINE_SWITCH, budget);
+        *seconds += diff_now() - start;
+        for (int lane = 0; lane < c->lanes; lane++) {
+            if (cpu_batch_get_lane(&run->batch, lane, cpu) != 0) {
+                return -1;
+            }
+            diff_save(cpu, cpu_batch_status(&run->batch, lane), &states[lane]);
+        }
+        return 0;
+    }
+
+    for (int lane = 0; lane < c->lanes; lane++) {
+        if (diff_restore(cpu, &c->start[lane]) != 0) {
+            return -1;
+        }
+        start = diff_now();
+        int status = cpu_run(cpu, engine, budget);
+        *seconds += diff_now() - start;
+        diff_save(cpu, status, &states[lane]);
+    }
+    return 0;
+}
+
+static void diff_print_state(FILE *out, int engine, const struct diff_state_st *state)
+{
+    fprintf(out, "    %-8s %-7s PC 0x%04X steps %llu NZC %u%u%u regs", cpu_engine_name(engine),
+            cpu_status_name(state->status), state->pc, (unsigned long long)state->steps,
+            state->nf, state->zf, state->cf);
+    for (int r = 0; r < NUM_REGISTERS; r++) {
+        fprintf(out, " %04X", state->regs[r]);
+    }
+    fprintf(out, "\n");
+}
+
+static void diff_print_irq(FILE *out, int engine, const struct cpu_irq_st *irq)
+{
+    fprintf(out, "    %-8s irq ie %u mask 0x%02X pending 0x%02X epc 0x%04X period %u next %llu\n",
+            cpu_engine_name(engine), irq->ie, irq->mask, irq->pending, irq->epc, irq->period,
+            (unsigned long long)irq->next);
+}
+
+/*
+ * Narrow a mismatch in lane down to the shortest budget after which the
+ * states differ, and report the instructions run up to there and the
+ * differences.
+ */
+static int diff_bisect(struct diff_st *diff, struct diff_runner_st *run, int slot, int lane, uint64_t budget,
+                       const char *name)
+{
+    const struct diff_case_st *c = run->c;
+    const struct diff_state_st *first = &run->states[lane];
+    const struct diff_state_st *other = &run->states[slot * CPU_LANES + lane];
+    struct diff_state_st *ref = &run->states[DIFF_PROBE * CPU_LANES];
+    struct diff_state_st *probe = ref + CPU_LANES;
+    int engine = diff->engines[slot].engine;
+    uint32_t words = c->cpu.mem_words;
+    double seconds = 0;
+    char text[256];
+
+    // Both runs end within hi steps, so their states there are the final ones
+    uint64_t lo = 0;
+    uint64_t hi = (first->steps > other->steps ? first->steps : other->steps) + 1;
+    hi = hi < budget ? hi : budget;
+    while (hi - lo > 1) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (diff_exec(run, 0, CPU_ENGINE_SWITCH, mid, ref, &seconds) != 0
+            || diff_exec(run, slot, engine, mid, probe, &seconds) != 0) {
+            return -1;
+        }
+        if (diff_equal(&ref[lane], &probe[lane], words)) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    fprintf(diff->out, "%s: %s differs from switch in lane %d after %llu steps\n",
+            name, cpu_engine_name(engine), lane, (unsigned long long)hi);
+
+    // Engines that hand the tail of a budget to cpu_exec_n() may diverge a block earlier
+    for (uint64_t step = hi > DIFF_TRACE_REPORT ? hi - DIFF_TRACE_REPORT : 0; step < hi; step++) {
+        if (diff_exec(run, 0, CPU_ENGINE_SWITCH, step, ref, &seconds) != 0) {
+            return -1;
+        }
+        uint16_t pc = ref[lane].pc & c->cpu.mem_mask;
+        if (pc < words) {
+            disassemble(c->cpu.mem_inst[pc], text);
+        } else {
+            snprintf(text, sizeof(text), "outside instruction memory");
+        }
+        fprintf(diff->out, "    %10llu  0x%04X  %s\n", (unsigned long long)step + 1, pc, text);
+    }
+
+    if (diff_exec(run, 0, CPU_ENGINE_SWITCH, hi, ref, &seconds) != 0
+        || diff_exec(run, slot, engine, hi, probe, &seconds) != 0) {
+        return -1;
+    }
+    diff_print_state(diff->out, CPU_ENGINE_SWITCH, &ref[lane]);
+    diff_print_state(diff->out, engine, &probe[lane]);
+    if (!diff_irq_equal(&ref[lane].irq, &probe[lane].irq)) {
+        diff_print_irq(diff->out, CPU_ENGINE_SWITCH, &ref[lane].irq);
+        diff_print_irq(diff->out, engine, &probe[lane].irq);
+    }
+    int listed = 0;
+    for (uint32_t i = 0; i < words && listed < DIFF_DATA_REPORT; i++) {
+        if (ref[lane].data[i] != probe[lane].data[i]) {
+            fprintf(diff->out, "    data[0x%04X] switch 0x%04X %s 0x%04X\n", i, ref[lane].data[i],
+                    cpu_engine_name(engine), probe[lane].data[i]);
+            listed++;
+        }
+    }
+    return 0;
+}
+
+static void diff_runner_release(struct diff_runner_st *run, int count)
+{
+    for (int i = 0; i < count; i++) {
+        cpu_release(&run->cpus[i]);
+    }
+    if (run->batched) {
+        cpu_batch_release(&run->batch);
+    }
+    free(run->states);
+    free(run->data);
+}
+
+/*
+ * Run a case on every engine with the same step budget and compare each
+ * with the reference. Returns the number of engines that differ, or -1.
+ */
+int diff_run(struct diff_st *diff, struct diff_case_st *c, uint64_t max_steps, const char *name)
+{
+    struct diff_runner_st run;
+    size_t words = c->cpu.mem_words;
+    int sets = DIFF_ENGINES_MAX + 2;
+    int forked = 0;
+    int mismatches = 0;
+
+    memset(&run, 0, sizeof(run));
+    run.c = c;
+    run.states = calloc((size_t)sets * CPU_LANES, sizeof(struct diff_state_st));
+    run.data = calloc((size_t)sets * CPU_LANES * words, sizeof(uint16_t));
+    if (!run.states || !run.data) {
+        goto fail;
+    }
+    for (int i = 0; i < sets * CPU_LANES; i++) {
+        run.states[i].data = run.data + i * words;
+    }
+    for (; forked < diff->count; forked++) {
+        if (cpu_fork(&run.cpus[forked], &c->cpu) != 0) {
+            goto fail;
+        }
+        if (diff->engines[forked].engine == CPU_ENGINE_SIMD && !run.batched) {
+            if (cpu_batch_init(&run.batch, &c->cpu, c->lanes) != 0) {
+                goto fail;
+            }
+            run.batched = 1;
+        }
+    }
+
+    for (int slot = 0; slot < diff->count; slot++) {
+        struct diff_engine_st *engine = &diff->engines[slot];
+        struct diff_state_st *states = &run.states[slot * CPU_LANES];
+
+        if (diff_exec(&run, slot, engine->engine, max_steps, states, &engine->seconds) != 0) {
+            goto fail;
+        }
+        for (int lane = 0; lane < c->lanes; lane++) {
+            engine->instructions += states[lane].steps;
+        }
+        for (int lane = 0; slot > 0 && lane < c->lanes; lane++) {
+            if (!diff_equal(&run.states[lane], &states[lane], words)) {
+                engine->mismatches++;
+                mismatches++;
+                if (diff_bisect(diff, &run, slot, lane, max_steps, name) != 0) {
+                    goto fail;
+                }
+                break;
+            }
+        }
+    }
+
+    diff->cases++;
+    diff_runner_release(&run, forked);
+    return mismatches;
+
+fail:
+    diff_runner_release(&run, forked);
+    return -1;
+}
+
+void diff_report(const struct diff_st *diff, FILE *out, int json)
+{
+    uint64_t mismatches = 0;
+    for (int i = 0; i < diff->count; i++) {
+        mismatches += diff->engines[i].mismatches;
+    }
+
+    if (json) {
+        fprintf(out, "{\"cases\": %llu, \"mismatches\": %llu, \"engines\": {",
+                (unsigned long long)diff->cases, (unsigned long long)mismatches);
+        for (int i = 0; i < diff->count; i++) {
+            const struct diff_engine_st *engine = &diff->engines[i];
+            fprintf(out, "%s\"%s\": {\"instructions\": %llu, \"seconds\": %.6f, \"mips\": %.2f, \"mismatches\": %llu}",
+                    i ? ", " : "", cpu_engine_name(engine->engine),
+                    (unsigned long long)engine->instructions, engine->seconds,
+                    engine->seconds > 0 ? engine->instructions / engine->seconds / 1e6 : 0.0,
+                    (unsigned long long)engine->mismatches);
+        }
+        fprintf(out, "}}\n");
+        return;
+    }
+
+    fprintf(out, "Cases: %llu, mismatches: %llu\n", (unsigned long long)diff->cases,
+            (unsigned long long)mismatches);
+    fprintf(out, "Engine       instructions      seconds       MIPS  mismatches\n");
+    for (int i = 0; i < diff->count; i++) {
+        const struct diff_engine_st *engine = &diff->engines[i];
+        fprintf(out, "%-10s %14llu %12.6f %10.2f %11llu\n", cpu_engine_name(engine->engine),
+                (unsigned long long)engine->instructions, engine->seconds,
+                engine->seconds > 0 ? engine->instructions / engine->seconds / 1e6 : 0.0,
+                (unsigned long long)engine->mismatches);
+    }
+}
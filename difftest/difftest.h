@@ -0,0 +1,65 @@
+#ifndef DIFFTEST_H_20251117_
+#define DIFFTEST_H_20251117_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "emulator/emulator.h"
+#include "emulator/lockstep.h"
+
+#define DIFF_ENGINES_MAX 8          // Engines compared, the reference included
+#define DIFF_DATA_REPORT 4          // Differing data words listed per mismatch
+#define DIFF_TRACE_REPORT 8         // Instructions listed before a mismatch
+
+/*
+ * Differential testing of the execution engines. A case is a program with
+ * up to CPU_LANES starting states; every engine runs each of them with the
+ * same step budget, and the final registers, PC, flags, status, step count,
+ * interrupt state and data memory are compared with the switch engine's.
+ * The simd engine runs the states as lanes of one lockstep batch. Since
+ * every engine stops on exactly the requested step, a mismatch is narrowed
+ * down by bisecting the budget to the first step count at which the states
+ * differ.
+ */
+struct diff_state_st {
+    uint16_t regs[NUM_REGISTERS];
+    uint16_t pc;
+    uint8_t nf;
+    uint8_t zf;
+    uint8_t cf;
+    int status;                     // enum cpu_status, -1 for a starting state
+    uint64_t steps;
+    struct cpu_irq_st irq;
+    uint16_t *data;                 // mem_words words
+};
+
+struct diff_case_st {
+    cpu_t cpu;                      // Program and memory layout
+    int lanes;                      // Starting states in start[]
+    struct diff_state_st start[CPU_LANES];
+    uint16_t *data;                 // Data memory of every starting state
+};
+
+// Totals of one engine over all cases
+struct diff_engine_st {
+    int engine;                     // enum cpu_engine
+    uint64_t instructions;          // Retired by the compared runs
+    double seconds;                 // Spent in those runs
+    uint64_t mismatches;            // Cases with a state differing from the reference
+};
+
+struct diff_st {
+    struct diff_engine_st engines[DIFF_ENGINES_MAX];    // engines[0] is the reference
+    int count;
+    uint64_t cases;
+    FILE *out;                      // Mismatch reports
+};
+
+void diff_init(struct diff_st *diff, const int *engines, int count, FILE *out);
+int diff_generate(struct diff_case_st *c, const struct cpu_config_st *config, uint64_t seed);
+int diff_load(struct diff_case_st *c, const struct cpu_config_st *config, const char *filename);
+void diff_case_release(struct diff_case_st *c);
+int diff_run(struct diff_st *diff, struct diff_case_st *c, uint64_t max_steps, const char *name);
+void diff_report(const struct diff_st *diff, FILE *out, int json);
+
+#endif  // DIFFTEST_H_20251117_
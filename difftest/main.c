@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+
+#include "emulator/emulator.h"
+#include "difftest.h"
+
+#define DIFF_CASES_DEFAULT 1000     // Random programs without -c
+#define DIFF_STEPS_DEFAULT 10000    // Budget limit for random programs without -n
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-e engine]... [-c cases] [-s seed] [-n max_steps] [--memory=words] [--checked]\n"
+           "          [--json] [program_file...]\n"
+           "Runs programs on each engine (-e, default every engine built in) and on the switch\n"
+           "engine, compares the final registers, PC, flags, status, step count, interrupt\n"
+           "state and data memory, and reports the first instruction after which a state\n"
+           "differs. Without program files it generates cases random programs (default %u)\n"
+           "from seed, each with %d starting states differing in data memory and a random\n"
+           "step budget up to max_steps (default %u); case i is reproduced by -s seed+i -c 1.\n"
+           "Program files run once each, to the end or max_steps.\n"
+           "The instructions retired, time and MIPS of every engine are printed at the end,\n"
+           "as one JSON object with --json. The exit status is 1 if any state differs.\n",
+           prog, DIFF_CASES_DEFAULT, CPU_LANES, DIFF_STEPS_DEFAULT);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        { "memory", required_argument, NULL, 'M' },
+        { "checked", no_argument, NULL, 'C' },
+        { "json", no_argument, NULL, 'J' },
+        { NULL, 0, NULL, 0 },
+    };
+    struct cpu_config_st config = CPU_CONFIG_DEFAULT;
+    int engines[DIFF_ENGINES_MAX];
+    int engine_count = 0;
+    uint64_t cases = DIFF_CASES_DEFAULT;
+    uint64_t seed = 1;
+    uint64_t max_steps = 0;
+    int json = 0;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "e:c:s:n:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'e':
+                if (engine_count == DIFF_ENGINES_MAX - 1) {
+                    fprintf(stderr, "Too many engines\n");
+                    return 1;
+                }
+                engines[engine_count] = cpu_engine_parse(optarg);
+                if (engines[engine_count++] < 0) {
+                    fprintf(stderr, "Unknown engine: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'c':
+                cases = strtoull(optarg, NULL, 0);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'n':
+                max_steps = strtoull(optarg, NULL, 0);
+                break;
+            case 'M':
+                config.mem_words = strtoul(optarg, NULL, 0);
+                break;
+            case 'C':
+                config.checked = 1;
+                break;
+            case 'J':
+                json = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (engine_count == 0) {
+#ifdef HAVE_THREADED_DISPATCH
+        engines[engine_count++] = CPU_ENGINE_THREADED;
+#endif
+#ifdef HAVE_JIT
+        engines[engine_count++] = CPU_ENGINE_JIT;
+#endif
+        engines[engine_count++] = CPU_ENGINE_BLOCK;
+        engines[engine_count++] = CPU_ENGINE_SIMD;
+    }
+
+    struct diff_st diff;
+    struct diff_case_st c;
+    char name[64];
+    int failed = 0;
+
+    diff_init(&diff, engines, engine_count, stdout);
+
+    for (int i = optind; i < argc; i++) {
+        if (diff_load(&c, &config, argv[i]) != 0) {
+            fprintf(stderr, "Failed to load program: %s\n", argv[i]);
+            return 1;
+        }
+        int ret = diff_run(&diff, &c, max_steps ? max_steps : CPU_STEPS_UNLIMITED, argv[i]);
+        diff_case_release(&c);
+        if (ret < 0) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+        failed |= ret > 0;
+    }
+
+    if (optind == argc) {
+        uint64_t limit = max_steps ? max_steps : DIFF_STEPS_DEFAULT;
+        for (uint64_t i = 0; i < cases; i++) {
+            if (diff_generate(&c, &config, seed + i) != 0) {
+                fprintf(stderr, "Failed to initialize CPU with %u words of memory\n", config.mem_words);
+                return 1;
+            }
+            // Budgets of any length, to check that every engine stops on exactly the last step
+            uint64_t budget = 1 + (seed + i) * 0x9E3779B97F4A7C15ULL % limit;
+            snprintf(name, sizeof(name), "seed %llu", (unsigned long long)(seed + i));
+            int ret = diff_run(&diff, &c, budget, name);
+            diff_case_release(&c);
+            if (ret < 0) {
+                fprintf(stderr, "Out of memory\n");
+                return 1;
+            }
+            failed |= ret > 0;
+        }
+    }
+
+    diff_report(&diff, stdout, json);
+    return failed;
+}
@@ -0,0 +1,13 @@
+#include <stdlib.h>
+
+#include "emulator.h"
+
+/*
+ * The aot engine. make AOT=file.c links a program translated to C by
+ * ../translator in place of this file; without one this is the switch
+ * engine.
+ */
+int cpu_exec_aot(cpu_t *cpu, uint64_t max_steps)
+{
+    return cpu_exec_n(cpu, max_steps);
+}
@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "opcodes.h"
+#include "emulator.h"
+#include "batch.h"
+#include "lockstep.h"
+
+/*
+ * Work-stealing batch runner.
+ * Job indices [0, count) are split evenly between the workers. Each worker
+ * owns a range packed as (lo << 32 | hi) in one atomic word: the owner pops
+ * from lo, an idle worker steals the upper half of a victim's range with a
+ * CAS and publishes it as its own range. Jobs are never added after start,
+ * so a worker exits once it has found every range empty.
+ * With CPU_ENGINE_SIMD an image job is a group of CPU_LANES images run in
+ * lockstep.
+ */
+
+#define RANGE(lo, hi) ((uint64_t)(lo) << 32 | (uint32_t)(hi))
+#define RANGE_LO(r) ((uint32_t)((r) >> 32))
+#define RANGE_HI(r) ((uint32_t)(r))
+
+struct batch_st;
+
+struct worker_st {
+    struct batch_st *batch;
+    int id;
+    _Atomic uint64_t range;         // Jobs owned by this worker
+    cpu_t *cpu;                     // Scratch instance for image jobs
+    cpu_batch_t *lockstep;          // Scratch lanes for SIMD image jobs
+};
+
+struct batch_st {
+    cpu_t **cpus;                   // Instances to run in place, or
+    const cpu_t *program;           // program to run over images
+    uint16_t *images;               // count images of program->mem_words words
+    int count;
+    int engine;
+    uint64_t max_steps;             // Step budget of every job
+    int nworkers;
+    struct worker_st *workers;
+    struct cpu_result_st *results;
+};
+
+int cpu_batch_threads(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+static int worker_pop(struct worker_st *w)
+{
+    uint64_t r = atomic_load(&w->range);
+    while (RANGE_LO(r) < RANGE_HI(r)) {
+        if (atomic_compare_exchange_weak(&w->range, &r, RANGE(RANGE_LO(r) + 1, RANGE_HI(r)))) {
+            return RANGE_LO(r);
+        }
+    }
+    return -1;
+}
+
+static int worker_steal(struct worker_st *w)
+{
+    struct batch_st *batch = w->batch;
+
+    for (int i = 1; i < batch->nworkers; i++) {
+        struct worker_st *victim = &batch->workers[(w->id + i) % batch->nworkers];
+        uint64_t r = atomic_load(&victim->range);
+        while (RANGE_LO(r) < RANGE_HI(r)) {
+            uint32_t lo = RANGE_LO(r), hi = RANGE_HI(r);
+            uint32_t mid = hi - (hi - lo + 1) / 2;
+            if (atomic_compare_exchange_weak(&victim->range, &r, RANGE(lo, mid))) {
+                atomic_store(&w->range, RANGE(mid, hi));
+                return 0;
+            }
+        }
+    }
+    return -1;
+}
+
+static void batch_run_lanes(struct worker_st *w, int job)
+{
+    struct batch_st *batch = w->batch;
+    cpu_batch_t *lockstep = w->lockstep;
+    int first = job * CPU_LANES;
+    int lanes = batch->count - first < CPU_LANES ? batch->count - first : CPU_LANES;
+
+    size_t words = batch->program->mem_words;
+
+    lockstep->lanes = lanes;
+    for (int i = 0; i < lanes; i++) {
+        cpu_batch_set_lane(lockstep, i, batch->program);
+        memcpy(cpu_batch_data(lockstep, i), batch->images + (first + i) * words, words * sizeof(uint16_t));
+        lockstep->steps[i] = 0;
+    }
+
+    cpu_batch_exec(lockstep, CPU_ENGINE_FASTEST, batch->max_steps);
+
+    for (int i = 0; i < lanes; i++) {
+        struct cpu_result_st *result = &batch->results[first + i];
+        for (int r = 0; r < NUM_REGISTERS; r++) {
+            result->regs[r] = lockstep->regs[r][i];
+        }
+        result->pc = lockstep->pc[i];
+        result->steps = lockstep->steps[i];
+        result->status = cpu_batch_status(lockstep, i);
+        memcpy(batch->images + (first + i) * words, cpu_batch_data(lockstep, i), words * sizeof(uint16_t));
+    }
+}
+
+static void batch_run_job(struct worker_st *w, int job)
+{
+    struct batch_st *batch = w->batch;
+    struct cpu_result_st *result = &batch->results[job];
+    uint16_t *image = NULL;
+    cpu_t *cpu;
+
+    if (w->lockstep) {
+        batch_run_lanes(w, job);
+        return;
+    }
+
+    if (batch->cpus) {
+        cpu = batch->cpus[job];
+    } else {
+        // Reuse the worker's instance: code[] and its JIT cache stay valid
+        cpu = w->cpu;
+        image = batch->images + (size_t)job * cpu->mem_words;
+        if (cpu_data_write(cpu, image, cpu->mem_words) != 0) {
+            result->status = CPU_FAULT;     // No memory for the job's pages
+            return;
+        }
+        memcpy(cpu->regs, batch->program->regs, sizeof(cpu->regs));
+        cpu->pc = batch->program->pc;
+        cpu->nf = batch->program->nf;
+        cpu->zf = batch->program->zf;
+        cpu->cf = batch->program->cf;
+        cpu->irq = batch->program->irq;
+        if (cpu->irq.next >= batch->program->steps) {
+            cpu->irq.next -= batch->program->steps;     // Timer deadline for steps = 0
+        }
+        cpu->steps = 0;
+    }
+
+    uint64_t steps = cpu->steps;
+    result->status = cpu_run(cpu, batch->engine, batch->max_steps);
+
+    memcpy(result->regs, cpu->regs, sizeof(result->regs));
+    result->pc = cpu->pc;
+    result->steps = cpu->steps - steps;
+
+    if (image) {
+        cpu_data_read(cpu, image);
+    }
+}
+
+static void *batch_worker(void *arg)
+{
+    struct worker_st *w = (struct worker_st *)arg;
+    int job;
+
+    do {
+        while ((job = worker_pop(w)) >= 0) {
+            batch_run_job(w, job);
+        }
+    } while (worker_steal(w) == 0);
+
+    return NULL;
+}
+
+static int batch_start(struct batch_st *batch, int count, int threads)
+{
+    batch->count = count;
+    if (count <= 0) {
+        return 0;
+    }
+    if (batch->program && batch->engine == CPU_ENGINE_SIMD) {
+        count = (count + CPU_LANES - 1) / CPU_LANES;
+    }
+    if (threads <= 0) {
+        threads = cpu_batch_threads();
+    }
+    if (threads > count) {
+        threads = count;
+    }
+
+    batch->nworkers = threads;
+    batch->workers = (struct worker_st *)calloc(threads, sizeof(struct worker_st));
+    pthread_t *tids = (pthread_t *)calloc(threads, sizeof(pthread_t));
+    if (!batch->workers || !tids) {
+        free(batch->workers);
+        free(tids);
+        return -1;
+    }
+
+    int ret = 0;
+    for (int i = 0; i < threads; i++) {
+        struct worker_st *w = &batch->workers[i];
+        w->batch = batch;
+        w->id = i;
+        atomic_init(&w->range, RANGE((int64_t)count * i / threads, (int64_t)count * (i + 1) / threads));
+        if (batch->program && batch->engine == CPU_ENGINE_SIMD) {
+            // Lane vectors may need 32-byte alignment (AVX2)
+            w->lockstep = (cpu_batch_t *)aligned_alloc(_Alignof(cpu_batch_t), sizeof(cpu_batch_t));
+            if (!w->lockstep
+                || cpu_batch_init(w->lockstep, batch->program, CPU_LANES) != 0) {
+                free(w->lockstep);
+                w->lockstep = NULL;
+                ret = -1;
+                break;
+            }
+        } else if (batch->program) {
+            if (!(w->cpu = (cpu_t *)malloc(sizeof(cpu_t)))) {
+                ret = -1;
+                break;
+            }
+            // Shares the program's code; every job overwrites data memory
+            if (cpu_fork(w->cpu, batch->program) != 0) {
+                free(w->cpu);
+                w->cpu = NULL;
+                ret = -1;
+                break;
+            }
+        }
+    }
+
+    int started = 0;
+    if (ret == 0) {
+        // The calling thread acts as worker 0
+        for (started = 1; started < threads; started++) {
+            if (pthread_create(&tids[started], NULL, batch_worker, &batch->workers[started]) != 0) {
+                break;
+            }
+        }
+        batch_worker(&batch->workers[0]);
+        for (int i = 1; i < started; i++) {
+            pthread_join(tids[i], NULL);
+        }
+    }
+
+    for (int i = 0; i < threads; i++) {
+        if (batch->workers[i].cpu) {
+            cpu_release(batch->workers[i].cpu);
+            free(batch->workers[i].cpu);
+        }
+        if (batch->workers[i].lockstep) {
+            cpu_batch_release(batch->workers[i].lockstep);
+            free(batch->workers[i].lockstep);
+        }
+    }
+    free(batch->workers);
+    free(tids);
+    return ret;
+}
+
+// Run every cpus[i] in place until it stops or has run max_steps
+int cpu_exec_batch(cpu_t **cpus, int count, int engine, int threads,
+                   uint64_t max_steps, struct cpu_result_st *results)
+{
+    struct batch_st batch = {
+        .cpus = cpus,
+        .engine = engine,
+        .max_steps = max_steps,
+        .results = results,
+    };
+
+    return batch_start(&batch, count, threads);
+}
+
+/*
+ * Run program once per data memory image; images holds count images of
+ * program->mem_words words each and is updated in place
+ */
+int cpu_exec_images(const cpu_t *program, uint16_t *images, int count,
+                    int engine, int threads, uint64_t max_steps,
+                    struct cpu_result_st *results)
+{
+    struct batch_st batch = {
+        .program = program,
+        .images = images,
+        .engine = engine,
+        .max_steps = max_steps,
+        .results = results,
+    };
+
+    return batch_start(&batch, count, threads);
+}
+
+/*
+ * Time-slice every cpus[i] on the calling thread: each runs slice steps in
+ * turn until it stops on its own or has run max_steps in total.
+ */
+int cpu_exec_round_robin(cpu_t **cpus, int count, int engine, uint64_t slice,
+                         uint64_t max_steps, struct cpu_result_st *results)
+{
+    int running = 0;
+
+    if (slice == 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        memcpy(results[i].regs, cpus[i]->regs, sizeof(results[i].regs));
+        results[i].pc = cpus[i]->pc;
+        results[i].status = cpu_status(cpus[i]);
+        results[i].steps = 0;
+        if (results[i].status == CPU_BUDGET && max_steps > 0) {
+            running++;
+        }
+    }
+
+    while (running > 0) {
+        for (int i = 0; i < count; i++) {
+            struct cpu_result_st *result = &results[i];
+            if (result->status != CPU_BUDGET || result->steps >= max_steps) {
+                continue;
+            }
+
+            uint64_t n = max_steps - result->steps < slice ? max_steps - result->steps : slice;
+            uint64_t steps = cpus[i]->steps;
+            result->status = cpu_run(cpus[i], engine, n);
+            result->steps += cpus[i]->steps - steps;
+            memcpy(result->regs, cpus[i]->regs, sizeof(result->regs));
+            result->pc = cpus[i]->pc;
+
+            if (result->status != CPU_BUDGET || result->steps >= max_steps) {
+                running--;
+            }
+        }
+    }
+    return 0;
+}
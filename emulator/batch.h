@@ -0,0 +1,25 @@
+#ifndef BATCH_H_20251117_
+#define BATCH_H_20251117_
+
+#include <stdint.h>
+
+#include "emulator.h"
+
+// Final state of one instance of a batch run
+struct cpu_result_st {
+    uint16_t regs[NUM_REGISTERS];   // Registers when the instance stopped
+    uint16_t pc;                    // PC of the HALT/faulting/next instruction
+    int status;                     // enum cpu_status
+    uint64_t steps;                 // Retired instructions
+};
+
+int cpu_batch_threads(void);
+int cpu_exec_batch(cpu_t **cpus, int count, int engine, int threads,
+                   uint64_t max_steps, struct cpu_result_st *results);
+int cpu_exec_images(const cpu_t *program, uint16_t *images, int count,
+                    int engine, int threads, uint64_t max_steps,
+                    struct cpu_result_st *results);
+int cpu_exec_round_robin(cpu_t **cpus, int count, int engine, uint64_t slice,
+                         uint64_t max_steps, struct cpu_result_st *results);
+
+#endif  // BATCH_H_20251117_
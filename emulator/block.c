@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "opcodes.h"
+#include "emulator.h"
+#include "bus.h"
+#include "block.h"
+
+struct block_cache_st *block_cache_create(uint32_t words)
+{
+    struct block_cache_st *cache = (struct block_cache_st *)calloc(
+        1, sizeof(struct block_cache_st) + words * sizeof(struct block_st));
+    if (cache) {
+        cache->words = words;
+    }
+    return cache;
+}
+
+// Forget every block, and with them every link
+void block_cache_flush(struct block_cache_st *cache)
+{
+    memset(cache->blocks, 0, cache->words * sizeof(struct block_st));
+}
+
+void block_cache_destroy(struct block_cache_st *cache)
+{
+    free(cache);
+}
+
+// Condition of a branch opcode, -1 for anything else
+static int block_cond(uint8_t opcode)
+{
+    switch (opcode) {
+        case JUMP: case JMPR: return BLOCK_ALWAYS;
+        case BZ: return 0;
+        case BNZ: return 0 | BLOCK_INVERT;
+        case BN: return 1;
+        case BNN: return 1 | BLOCK_INVERT;
+        case BC: return 2;
+        case BNC: return 2 | BLOCK_INVERT;
+        default: return -1;
+    }
+}
+
+// Instructions that never stop the run or change the PC
+static int block_plain(uint8_t opcode)
+{
+    switch (opcode) {
+        case NOP: case LOAD: case STORE: case LDIH:
+        case ADD: case ADDI: case ADDC: case SUB: case SUBI: case SUBC:
+        case CMP: case AND: case OR: case XOR:
+        case SLL: case SRL: case SLA: case SRA:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static void block_build(struct block_st *block, const cpu_t *cpu, uint16_t pc)
+{
+    const uop_t *code = &cpu->code[pc];
+    uint32_t left = cpu->mem_words - pc;    // Blocks stop at the last word
+    uint32_t len = 0;
+
+    memset(block, 0, sizeof(*block));
+    block->pc = pc;
+    block->exit = BLOCK_FALL;
+    while (len < BLOCK_MAX && len < left) {
+        const uop_t *uop = &code[len];
+        int cond = block_cond(uop->opcode);
+        if (uop->dispatch == UOP_BREAK || (cond < 0 && !block_plain(uop->opcode))) {
+            block->exit = BLOCK_SLOW;
+            break;
+        }
+        len++;
+        if (cond >= 0) {
+            block->cond = cond;
+            block->exit = uop->opcode == JUMP ? BLOCK_JUMP : BLOCK_BRANCH;
+            block->target = uop->imm & cpu->mem_mask;
+            break;
+        }
+    }
+    block->len = len;
+    block->body = len;
+    if (block->exit == BLOCK_JUMP || block->exit == BLOCK_BRANCH) {
+        block->body--;
+        if (block->cond != BLOCK_ALWAYS && block->body > 0 && code[len - 2].opcode == CMP) {
+            block->exit = BLOCK_COMPARE;
+            block->body--;
+            if (block->body > 0 && (code[len - 3].opcode == ADDI || code[len - 3].opcode == SUBI)) {
+                block->exit = BLOCK_COUNT;
+                block->body--;
+            }
+        }
+    }
+}
+
+// The block starting at pc, built on first use; NULL past the end of memory
+static struct block_st *block_at(struct block_cache_st *cache, const cpu_t *cpu, uint16_t pc)
+{
+    if (pc >= cpu->mem_words) {
+        return NULL;
+    }
+    struct block_st *block = &cache->blocks[pc];
+    if (block->exit == BLOCK_NONE) {
+        block_build(block, cpu, pc);
+    }
+    return block;
+}
+
+/*
+ * Block engine: a portable interpreter over the basic-block cache. The
+ * step budget, the PC bounds and hooks are checked once per block instead
+ * of once per instruction, the flags live in locals, and a block's exit
+ * goes straight to its linked successor instead of back through a lookup.
+ * Instructions that may stop the run run alone in cpu_exec_n(), which also
+ * finishes the budget once less than the next block is left. With a trace
+ * or profile attached this is the switch engine.
+ */
+int cpu_exec_blocks(cpu_t *cpu, uint64_t max_steps)
+{
+    uint16_t *regs = cpu->regs;
+    uint16_t mask = cpu->mem_mask;
+    uint32_t data_limit = cpu->data_limit;
+    uint64_t start = cpu->steps;
+    uint64_t steps = 0;
+    uint16_t pc = cpu->pc & mask;
+    uint16_t addr;
+    uint8_t zf = cpu->zf, nf = cpu->nf, cf = cpu->cf;
+    const uop_t *text;
+    struct block_cache_st *cache;
+    struct block_st *block;
+
+    if (cpu_hooked(cpu)) {
+        return cpu_exec_n(cpu, max_steps);
+    }
+    if (!cpu->text->valid && cpu_predecode(cpu) != 0) {
+        return cpu_status(cpu);
+    }
+    if (!cpu->blocks) {
+        cpu->blocks = block_cache_create(cpu->mem_words);
+        if (!cpu->blocks) {
+            return cpu_exec_n(cpu, max_steps);
+        }
+        cpu->code_blocked = 1;
+    }
+    if (!cpu->code_blocked) {
+        block_cache_flush(cpu->blocks);
+        cpu->code_blocked = 1;
+    }
+    cache = cpu->blocks;
+    text = cpu->code;
+
+// One body instruction; a LOAD/STORE the bus refuses stops before it
+#define BLOCK_EXEC(at) do {                                                 \
+        const uop_t *u = (at);                                              \
+        CPU_STATS(cpu->stats.opcodes[u->opcode]++);                         \
+        switch (u->opcode) {                                                \
+            case NOP:                                                       \
+                break;                                                      \
+            case LOAD:                                                      \
+                addr = (regs[u->r2] + u->imm) & mask;                       \
+                if (__builtin_expect(addr < data_limit, 1)) {               \
+                    regs[u->r1] = cpu_data_word(cpu, addr);                 \
+                } else if (cpu_bus_load(cpu, addr, &regs[u->r1]) != 0) {   \
+                    pc = block->pc + (uint16_t)(u - code);                  \
+                    steps += (uint64_t)(u - code);                          \
+                    goto out;                                               \
+                }                                                           \
+                break;                                                      \
+            case STORE:                                                     \
+                addr = (regs[u->r2] + u->imm) & mask;                       \
+                if (addr < data_limit                                       \
+                    ? __builtin_expect(cpu_page_shared(cpu, addr), 0)       \
+                      && cpu_own_page(cpu, addr) != 0                       \
+                    : cpu_bus_store(cpu, addr, regs[u->r1]) != 0) {         \
+                    pc = block->pc + (uint16_t)(u - code);                  \
+                    steps += (uint64_t)(u - code);                          \
+                    goto out;                                               \
+                }                                                           \
+                if (__builtin_expect(addr < data_limit, 1)) {               \
+                    cpu_data_word(cpu, addr) = regs[u->r1];                 \
+                }                                                           \
+                break;                                                      \
+            case LDIH:                                                      \
+            case ADDI:                                                      \
+                regs[u->r1] = regs[u->r1] + u->imm;                         \
+                break;                                                      \
+            case ADD:                                                       \
+                regs[u->r1] = regs[u->r2] + regs[u->r3];                    \
+                break;                                                      \
+            case ADDC: {                                                    \
+                uint32_t result = regs[u->r2] + regs[u->r3] + cf;           \
+                regs[u->r1] = (uint16_t)result;                             \
+                cf = result > 0xFFFF;                                       \
+                break;                                                      \
+            }                                                               \
+            case SUB:                                                       \
+                regs[u->r1] = regs[u->r2] - regs[u->r3];                    \
+                break;                                                      \
+            case SUBI:                                                      \
+                regs[u->r1] = regs[u->r1] - u->imm;                         \
+                break;                                                      \
+            case SUBC: {                                                    \
+                uint32_t result = regs[u->r2] - regs[u->r3] - cf;           \
+                regs[u->r1] = (uint16_t)result;                             \
+                cf = result > 0xFFFF;                                       \
+                break;                                                      \
+            }                                                               \
+            case CMP: {                                                     \
+                uint16_t result = regs[u->r2] - regs[u->r3];                \
+                zf = result == 0;                                           \
+                nf = result >> 15;                                          \
+                break;                                                      \
+            }                                                               \
+            case AND:                                                       \
+                regs[u->r1] = regs[u->r2] & regs[u->r3];                    \
+                break;                                                      \
+            case OR:                                                        \
+                regs[u->r1] = regs[u->r2] | regs[u->r3];                    \
+                break;                                                      \
+            case XOR:                                                       \
+                regs[u->r1] = regs[u->r2] ^ regs[u->r3];                    \
+                break;                                                      \
+            case SLL:                                                       \
+            case SLA:                                                       \
+                regs[u->r1] = regs[u->r2] << u->imm;                        \
+                break;                                                      \
+            case SRL:                                                       \
+                regs[u->r1] = regs[u->r2] >> u->imm;                        \
+                break;                                                      \
+            case SRA:                                                       \
+                regs[u->r1] = (regs[u->r2] >> u->imm)                       \
+                    | (regs[u->r2] & 0x8000 ? 0xFFFF << (16 - u->imm) : 0); \
+                break;                                                      \
+        }                                                                   \
+    } while (0)
+
+    block = block_at(cache, cpu, pc);
+    while (block && max_steps - steps >= block->len) {
+        const uop_t *code = &text[block->pc];
+        const uop_t *end = code + block->body;
+
+        // A copy of the dispatch for each of the last few body positions
+        // predicts better than one shared switch
+        switch (block->body) {
+            default:
+                for (const uop_t *uop = code; uop < end - 4; uop++) {
+                    BLOCK_EXEC(uop);
+                }
+                // Fall through
+            case 4: BLOCK_EXEC(end - 4);    // Fall through
+            case 3: BLOCK_EXEC(end - 3);    // Fall through
+            case 2: BLOCK_EXEC(end - 2);    // Fall through
+            case 1: BLOCK_EXEC(end - 1);    // Fall through
+            case 0: break;
+        }
+        steps += block->len;
+
+        switch (block->exit) {
+            case BLOCK_JUMP: {
+                CPU_STATS(cpu->stats.opcodes[JUMP]++);
+                CPU_STATS(cpu->stats.taken[JUMP]++);
+                pc = block->target;
+                if (!block->taken) {
+                    block->taken = block_at(cache, cpu, pc);
+                }
+                block = block->taken;
+                continue;
+            }
+            case BLOCK_COUNT: {
+                CPU_STATS(cpu->stats.opcodes[end->opcode]++);
+                regs[end->r1] += end->opcode == ADDI ? end->imm : -end->imm;
+            }
+                // Fall through
+            case BLOCK_COMPARE: {
+                const uop_t *uop = &code[block->len - 2];
+                uint16_t result = regs[uop->r2] - regs[uop->r3];
+                CPU_STATS(cpu->stats.opcodes[CMP]++);
+                zf = result == 0;
+                nf = result >> 15;
+            }
+                // Fall through
+            case BLOCK_BRANCH: {
+                const uop_t *uop = &code[block->len - 1];
+                uint8_t flags = zf | nf << 1 | cf << 2 | 1 << BLOCK_ALWAYS;
+                CPU_STATS(cpu->stats.opcodes[uop->opcode]++);
+                if ((flags >> (block->cond & 7) ^ block->cond >> 3) & 1) {
+                    CPU_STATS(cpu->stats.taken[uop->opcode]++);
+                    pc = (regs[uop->r1] + uop->imm) & mask;
+                    if (block->target != pc || !block->taken) {
+                        block->taken = block_at(cache, cpu, pc);
+                        block->target = pc;
+                    }
+                    block = block->taken;
+                    continue;
+                }
+                break;
+            }
+            case BLOCK_SLOW: {
+                // HALT, TRAP, RETI, CSR, CAS, a reserved opcode or a breakpoint
+                pc = (block->pc + block->len) & mask;
+                if (steps == max_steps) {
+                    goto finish;
+                }
+                cpu->pc = pc;
+                cpu->steps = start + steps;
+                cpu->zf = zf, cpu->nf = nf, cpu->cf = cf;
+                cpu->irq.stop = 0;
+                cpu_exec_n(cpu, 1);
+                if (cpu->steps == start + steps || cpu->irq.stop) {
+                    return cpu_status(cpu);
+                }
+                steps = cpu->steps - start;
+                pc = cpu->pc;
+                zf = cpu->zf, nf = cpu->nf, cf = cpu->cf;
+                block = block_at(cache, cpu, pc);
+                continue;
+            }
+        }
+
+        pc = (block->pc + block->len) & mask;
+        if (!block->next) {
+            block->next = block_at(cache, cpu, pc);
+        }
+        block = block->next;
+    }
+
+finish:
+    // Less than the next block of budget left, or a bounds-checked PC past the end
+    cpu->pc = pc;
+    cpu->steps = start + steps;
+    cpu->zf = zf, cpu->nf = nf, cpu->cf = cf;
+    return cpu_exec_n(cpu, max_steps - steps);
+
+out:
+    cpu->pc = pc;
+    cpu->steps = start + steps;
+    cpu->zf = zf, cpu->nf = nf, cpu->cf = cf;
+    return cpu_status(cpu);
+
+#undef BLOCK_EXEC
+}
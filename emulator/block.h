@@ -0,0 +1,57 @@
+#ifndef BLOCK_H_20251117_
+#define BLOCK_H_20251117_
+
+#include <stdint.h>
+
+#include "emulator.h"
+
+#define BLOCK_MAX 64                // Max instructions per block
+
+enum block_exit {
+    BLOCK_NONE,                     // Not built yet
+    BLOCK_FALL,                     // Runs on into the block at pc + len
+    BLOCK_JUMP,                     // Ends with JUMP
+    BLOCK_BRANCH,                   // Ends with JMPR or Bxx
+    BLOCK_COMPARE,                  // Ends with CMP and Bxx
+    BLOCK_COUNT,                    // Ends with ADDI or SUBI, CMP and Bxx
+    BLOCK_SLOW,                     // The instruction at pc + len runs in cpu_exec_n()
+};
+
+// Flag bit a branch tests in ZF | NF << 1 | CF << 2 | 1 << 3, ORed with BLOCK_INVERT
+#define BLOCK_ALWAYS 3
+#define BLOCK_INVERT 8
+
+/*
+ * A basic block of predecoded code: len straight-line instructions from pc
+ * ending at a branch, BLOCK_MAX or the last word, or stopping before an
+ * instruction that may end the run (HALT, TRAP, RETI, CSR, CAS, a
+ * reserved opcode or a breakpoint). The first body instructions run one by one; a
+ * branch runs as the exit, together with a CMP right before a Bxx and an
+ * ADDI/SUBI right before that, like the superinstructions. Successors are
+ * linked once resolved: next for falling through or a branch not taken,
+ * taken for the last taken target. A JUMP always takes the same link;
+ * JMPR and Bxx targets depend on a register, so a different target
+ * replaces the link through the lookup.
+ */
+struct block_st {
+    uint16_t pc;                    // First instruction
+    uint16_t target;                // PC taken links to
+    uint8_t len;                    // Instructions, the exit included
+    uint8_t body;                   // Instructions before the exit
+    uint8_t exit;                   // enum block_exit
+    uint8_t cond;                   // Branch condition, BLOCK_ALWAYS for JMPR
+    struct block_st *next;          // Successor at pc + len, NULL until resolved
+    struct block_st *taken;         // Successor at target, NULL until resolved
+};
+
+// Blocks indexed by start PC; a PC past mem_words has none
+struct block_cache_st {
+    uint32_t words;
+    struct block_st blocks[];
+};
+
+struct block_cache_st *block_cache_create(uint32_t words);
+void block_cache_flush(struct block_cache_st *cache);
+void block_cache_destroy(struct block_cache_st *cache);
+
+#endif  // BLOCK_H_20251117_
@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "emulator.h"
+#include "bus.h"
+#include "debug.h"
+#include "replay.h"
+
+struct bus_st *bus_create(void)
+{
+    struct bus_st *bus = (struct bus_st *)calloc(1, sizeof(struct bus_st));
+    if (bus) {
+        bus->low = MEMORY_MAX;
+    }
+    return bus;
+}
+
+void bus_destroy(struct bus_st *bus)
+{
+    if (bus) {
+        for (int i = 0; i < bus->count; i++) {
+            if (bus->devices[i].ops->close) {
+                bus->devices[i].ops->close(bus->devices[i].ctx);
+            }
+        }
+        free(bus);
+    }
+}
+
+/*
+ * Claim [base, base + size) for a device. Windows may not overlap. CPUs
+ * already using the bus must call cpu_set_bus() again afterwards.
+ */
+int bus_map(struct bus_st *bus, uint16_t base, uint32_t size, const struct bus_ops_st *ops, void *ctx)
+{
+    if (bus->count == BUS_DEVICES_MAX || size == 0 || base + size > MEMORY_MAX) {
+        return -1;
+    }
+    for (int i = 0; i < bus->count; i++) {
+        const struct bus_device_st *dev = &bus->devices[i];
+        if (base < dev->base + dev->size && dev->base < base + size) {
+            return -1;
+        }
+    }
+
+    struct bus_device_st *dev = &bus->devices[bus->count++];
+    dev->base = base;
+    dev->size = size;
+    dev->ops = ops;
+    dev->ctx = ctx;
+    if (base < bus->low) {
+        bus->low = base;
+    }
+    return 0;
+}
+
+const struct bus_device_st *bus_find(const struct bus_st *bus, uint16_t addr)
+{
+    if (!bus || addr < bus->low) {
+        return NULL;
+    }
+    for (int i = 0; i < bus->count; i++) {
+        const struct bus_device_st *dev = &bus->devices[i];
+        if (addr >= dev->base && addr - dev->base < dev->size) {
+            return dev;
+        }
+    }
+    return NULL;
+}
+
+// A watchpoint stops the engine before the access; cpu_status() reports it
+#define bus_watched(cpu, addr, type) \
+    ((cpu)->debug && !(cpu)->debug->stepping && debug_watch_at((cpu)->debug, addr, type))
+
+/*
+ * Slow path of a LOAD at or above cpu->data_limit: a device, data memory
+ * between device windows or above a watchpoint, or -1 for an address
+ * outside both or a watched one.
+ */
+int cpu_bus_load(cpu_t *cpu, uint16_t addr, uint16_t *value)
+{
+    const struct bus_device_st *dev = bus_find(cpu->bus, addr);
+
+    if (bus_watched(cpu, addr, WATCH_READ)) {
+        return -1;
+    }
+    if (dev) {
+        if (!cpu->replay || !replay_input(cpu->replay, REPLAY_READ, addr, value)) {
+            *value = dev->ops->read ? dev->ops->read(dev->ctx, addr - dev->base) : 0;
+            if (cpu->replay) {
+                replay_record(cpu->replay, REPLAY_READ, addr, *value);
+            }
+        }
+    } else if (addr < cpu->mem_words) {
+        *value = cpu_data_word(cpu, addr);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Slow path of a STORE at or above cpu->data_limit
+int cpu_bus_store(cpu_t *cpu, uint16_t addr, uint16_t value)
+{
+    const struct bus_device_st *dev = bus_find(cpu->bus, addr);
+
+    if (bus_watched(cpu, addr, WATCH_WRITE)) {
+        return -1;
+    }
+    if (dev) {
+        if (dev->ops->write && !cpu_replay_muted(cpu)) {
+            dev->ops->write(dev->ctx, addr - dev->base, value);
+        }
+    } else if (addr < cpu->mem_words) {
+        if (cpu_own_page(cpu, addr) != 0) {
+            return -1;
+        }
+        cpu_data_word(cpu, addr) = value;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+struct console_st {
+    FILE *out;
+    FILE *in;
+};
+
+static uint16_t console_read(void *ctx, uint16_t offset)
+{
+    struct console_st *console = (struct console_st *)ctx;
+    int c;
+
+    if (offset != 1 || !console->in || (c = getc(console->in)) == EOF) {
+        return 0xFFFF;
+    }
+    return (uint16_t)c;
+}
+
+static void console_write(void *ctx, uint16_t offset, uint16_t value)
+{
+    struct console_st *console = (struct console_st *)ctx;
+
+    if (offset == 0 && console->out) {
+        putc(value & 0xFF, console->out);
+    }
+}
+
+static void console_close(void *ctx)
+{
+    struct console_st *console = (struct console_st *)ctx;
+
+    if (console->out) {
+        fflush(console->out);
+    }
+    free(console);
+}
+
+static const struct bus_ops_st s_console_ops = { console_read, console_write, console_close };
+
+// Byte console on stdio streams; output stays in the stream's buffer
+int bus_map_console(struct bus_st *bus, uint16_t base, FILE *out, FILE *in)
+{
+    struct console_st *console = (struct console_st *)malloc(sizeof(struct console_st));
+    if (!console) {
+        return -1;
+    }
+    console->out = out;
+    console->in = in;
+    if (bus_map(bus, base, 2, &s_console_ops, console) != 0) {
+        free(console);
+        return -1;
+    }
+    return 0;
+}
+
+struct timer_st {
+    uint32_t latched;           // Microseconds at the last low word read
+};
+
+static uint16_t timer_read(void *ctx, uint16_t offset)
+{
+    struct timer_st *timer = (struct timer_st *)ctx;
+
+    if (offset == 0) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        timer->latched = (uint32_t)(ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+        return (uint16_t)timer->latched;
+    }
+    return (uint16_t)(timer->latched >> 16);
+}
+
+static const struct bus_ops_st s_timer_ops = { timer_read, NULL, free };
+
+int bus_map_timer(struct bus_st *bus, uint16_t base)
+{
+    struct timer_st *timer = (struct timer_st *)calloc(1, sizeof(struct timer_st));
+    if (!timer) {
+        return -1;
+    }
+    if (bus_map(bus, base, 2, &s_timer_ops, timer) != 0) {
+        free(timer);
+        return -1;
+    }
+    return 0;
+}
+
+struct block_st {
+    FILE *file;
+    uint16_t regs[BLOCK_REGS];
+    uint16_t buffer[BLOCK_WORDS];
+};
+
+static void block_command(struct block_st *block, uint16_t cmd)
+{
+    long offset = (long)block->regs[BLOCK_SECTOR] * sizeof(block->buffer);
+    int ok = 0;
+
+    if (fseek(block->file, offset, SEEK_SET) == 0) {
+        if (cmd == BLOCK_READ) {
+            // Past the end of the file reads as zeros
+            size_t n = fread(block->buffer, sizeof(uint16_t), BLOCK_WORDS, block->file);
+            memset(block->buffer + n, 0, (BLOCK_WORDS - n) * sizeof(uint16_t));
+            ok = !ferror(block->file);
+        } else if (cmd == BLOCK_WRITE) {
+            ok = fwrite(block->buffer, sizeof(uint16_t), BLOCK_WORDS, block->file) == BLOCK_WORDS
+                 && fflush(block->file) == 0;
+        }
+    }
+    clearerr(block->file);
+    block->regs[BLOCK_STATUS] = ok ? 0 : 1;
+}
+
+static uint16_t block_read(void *ctx, uint16_t offset)
+{
+    struct block_st *block = (struct block_st *)ctx;
+
+    if (offset == BLOCK_DATA) {
+        return block->buffer[block->regs[BLOCK_INDEX]++ % BLOCK_WORDS];
+    }
+    return block->regs[offset];
+}
+
+static void block_write(void *ctx, uint16_t offset, uint16_t value)
+{
+    struct block_st *block = (struct block_st *)ctx;
+
+    if (offset == BLOCK_DATA) {
+        block->buffer[block->regs[BLOCK_INDEX]++ % BLOCK_WORDS] = value;
+    } else if (offset == BLOCK_CMD) {
+        block_command(block, value);
+    } else if (offset != BLOCK_STATUS) {
+        block->regs[offset] = value;
+    }
+}
+
+static void block_close(void *ctx)
+{
+    struct block_st *block = (struct block_st *)ctx;
+
+    fclose(block->file);
+    free(block);
+}
+
+static const struct bus_ops_st s_block_ops = { block_read, block_write, block_close };
+
+// Sector device on a host file, created if missing
+int bus_map_block(struct bus_st *bus, uint16_t base, const char *filename)
+{
+    struct block_st *block = (struct block_st *)calloc(1, sizeof(struct block_st));
+    if (!block) {
+        return -1;
+    }
+    block->file = fopen(filename, "r+b");
+    if (!block->file) {
+        block->file = fopen(filename, "w+b");
+    }
+    if (!block->file || bus_map(bus, base, BLOCK_REGS, &s_block_ops, block) != 0) {
+        if (block->file) {
+            fclose(block->file);
+        }
+        free(block);
+        return -1;
+    }
+    return 0;
+}
+
+// Console on stdout/stdin and timer at base, block device when disk is given
+int bus_map_standard(struct bus_st *bus, uint16_t base, const char *disk)
+{
+    if (bus_map_console(bus, base + IO_CONSOLE, stdout, stdin) != 0
+        || bus_map_timer(bus, base + IO_TIMER) != 0) {
+        return -1;
+    }
+    if (disk && bus_map_block(bus, base + IO_BLOCK, disk) != 0) {
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,83 @@
+#ifndef BUS_H_20251117_
+#define BUS_H_20251117_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "emulator.h"
+
+#define BUS_DEVICES_MAX 16      // Devices per bus
+
+/*
+ * Memory-mapped device bus. A device claims a window of data memory
+ * addresses; LOAD/STORE inside it call the device instead of touching
+ * mem_data. Engines only compare each address against cpu->data_limit
+ * (the lower of mem_words and the lowest device window), so ordinary
+ * accesses below every window pay nothing extra. Devices may sit above
+ * mem_words when memory is bounds-checked. A bus is not owned by the CPUs
+ * using it and is not thread-safe; forks share their parent's bus.
+ */
+struct bus_ops_st {
+    uint16_t (*read)(void *ctx, uint16_t offset);              // NULL reads 0
+    void (*write)(void *ctx, uint16_t offset, uint16_t value);  // NULL ignores
+    void (*close)(void *ctx);                                   // bus_destroy(), may be NULL
+};
+
+struct bus_device_st {
+    uint16_t base;                      // First address of the window
+    uint32_t size;                      // Words in the window
+    const struct bus_ops_st *ops;
+    void *ctx;
+};
+
+struct bus_st {
+    int count;
+    uint32_t low;                       // Lowest device address, MEMORY_MAX when none
+    struct bus_device_st devices[BUS_DEVICES_MAX];
+};
+
+/*
+ * Standard device block mapped by bus_map_standard(), as offsets from its
+ * base address:
+ *   console  +0  write: put the low byte on the output
+ *            +1  read:  next input byte, 0xFFFF at end of input
+ *   timer    +2  read:  host monotonic microseconds, low word (latches)
+ *            +3  read:  high word of the latched value
+ *   block    +8  block device, see BLOCK_* (only with a disk file)
+ */
+#define IO_BASE_DEFAULT 0xFFE0
+#define IO_CONSOLE 0x00
+#define IO_TIMER 0x02
+#define IO_BLOCK 0x08
+
+/*
+ * Block device registers: write BLOCK_SECTOR and BLOCK_CMD to move one
+ * sector between the host file and the device buffer, then move buffer
+ * words through BLOCK_DATA, which steps BLOCK_INDEX after each access.
+ */
+#define BLOCK_WORDS 256         // Words per sector
+enum block_reg {
+    BLOCK_SECTOR,               // Sector number
+    BLOCK_CMD,                  // Write BLOCK_READ or BLOCK_WRITE
+    BLOCK_STATUS,               // 0 after a successful command, 1 on error
+    BLOCK_INDEX,                // Buffer word for BLOCK_DATA
+    BLOCK_DATA,                 // Buffer[BLOCK_INDEX++]
+    BLOCK_REGS = 8,
+};
+enum block_cmd {
+    BLOCK_READ = 1,             // File sector -> buffer
+    BLOCK_WRITE = 2,            // Buffer -> file sector
+};
+
+struct bus_st *bus_create(void);
+void bus_destroy(struct bus_st *bus);
+int bus_map(struct bus_st *bus, uint16_t base, uint32_t size, const struct bus_ops_st *ops, void *ctx);
+const struct bus_device_st *bus_find(const struct bus_st *bus, uint16_t addr);
+int bus_map_console(struct bus_st *bus, uint16_t base, FILE *out, FILE *in);
+int bus_map_timer(struct bus_st *bus, uint16_t base);
+int bus_map_block(struct bus_st *bus, uint16_t base, const char *filename);
+int bus_map_standard(struct bus_st *bus, uint16_t base, const char *disk);
+int cpu_bus_load(cpu_t *cpu, uint16_t addr, uint16_t *value);
+int cpu_bus_store(cpu_t *cpu, uint16_t addr, uint16_t value);
+
+#endif  // BUS_H_20251117_
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "opcodes.h"
+#include "emulator.h"
+#include "debug.h"
+
+struct debug_st *debug_create(void)
+{
+    struct debug_st *debug = (struct debug_st *)calloc(1, sizeof(struct debug_st));
+    if (debug) {
+        debug->watch_low = MEMORY_MAX;
+    }
+    return debug;
+}
+
+void debug_destroy(struct debug_st *debug)
+{
+    free(debug);
+}
+
+// Set a breakpoint at an instruction address; -1 without cpu_set_debug()
+int cpu_break_insert(cpu_t *cpu, uint16_t addr)
+{
+    struct debug_st *debug = cpu->debug;
+
+    if (!debug) {
+        return -1;
+    }
+    if (!debug_break_at(debug, addr)) {
+        debug->break_map[addr >> 3] |= 1 << (addr & 7);
+        debug->breaks++;
+        cpu_invalidate(cpu);
+    }
+    return 0;
+}
+
+// Remove a breakpoint; -1 when there is none at addr
+int cpu_break_remove(cpu_t *cpu, uint16_t addr)
+{
+    struct debug_st *debug = cpu->debug;
+
+    if (!debug || !debug_break_at(debug, addr)) {
+        return -1;
+    }
+    debug->break_map[addr >> 3] &= ~(1 << (addr & 7));
+    debug->breaks--;
+    cpu_invalidate(cpu);
+    return 0;
+}
+
+void cpu_break_clear(cpu_t *cpu)
+{
+    struct debug_st *debug = cpu->debug;
+
+    if (debug && debug->breaks) {
+        memset(debug->break_map, 0, sizeof(debug->break_map));
+        debug->breaks = 0;
+        cpu_invalidate(cpu);
+    }
+}
+
+// Rebuild watch_map and watch_low from watch[], then data_limit
+static void debug_watch_update(cpu_t *cpu)
+{
+    struct debug_st *debug = cpu->debug;
+
+    memset(debug->watch_map, 0, sizeof(debug->watch_map));
+    debug->watch_low = MEMORY_MAX;
+    for (uint32_t i = 0; i < debug->watches; i++) {
+        const struct debug_watch_st *watch = &debug->watch[i];
+        for (uint32_t j = 0; j < watch->words; j++) {
+            debug->watch_map[watch->addr + j] |= watch->type;
+        }
+        if (watch->addr < debug->watch_low) {
+            debug->watch_low = watch->addr;
+        }
+    }
+    cpu_set_bus(cpu, cpu->bus);
+}
+
+/*
+ * Watch words data addresses from addr for the enum debug_watch access
+ * types. Returns -1 without cpu_set_debug(), for an empty or wrapping
+ * range or when DEBUG_WATCH_MAX are set.
+ */
+int cpu_watch_insert(cpu_t *cpu, uint16_t addr, uint32_t words, int type)
+{
+    struct debug_st *debug = cpu->debug;
+
+    type &= WATCH_ACCESS;
+    if (!debug || !type || !words || words > MEMORY_MAX - addr
+        || debug->watches == DEBUG_WATCH_MAX) {
+        return -1;
+    }
+    debug->watch[debug->watches++] = (struct debug_watch_st){ addr, words, (uint8_t)type };
+    debug_watch_update(cpu);
+    return 0;
+}
+
+// Remove a watchpoint inserted with the same arguments; -1 when there is none
+int cpu_watch_remove(cpu_t *cpu, uint16_t addr, uint32_t words, int type)
+{
+    struct debug_st *debug = cpu->debug;
+
+    if (!debug) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < debug->watches; i++) {
+        const struct debug_watch_st *watch = &debug->watch[i];
+        if (watch->addr == addr && watch->words == words && watch->type == (type & WATCH_ACCESS)) {
+            debug->watch[i] = debug->watch[--debug->watches];
+            debug_watch_update(cpu);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void cpu_watch_clear(cpu_t *cpu)
+{
+    struct debug_st *debug = cpu->debug;
+
+    if (debug && debug->watches) {
+        debug->watches = 0;
+        debug_watch_update(cpu);
+    }
+}
+
+/*
+ * The enum debug_watch types hit by the LOAD/STORE/CAS at pc, with its address
+ * in *addr; 0 when the instruction there is not a watched access.
+ */
+int cpu_watch_hit(const cpu_t *cpu, uint16_t *addr)
+{
+    const struct debug_st *debug = cpu->debug;
+    uint16_t pc = cpu->pc & cpu->mem_mask;
+    uop_t uop;
+
+    if (!debug || !debug->watches || pc >= cpu->mem_words) {
+        return 0;
+    }
+    cpu_decode(&uop, cpu->mem_inst[pc]);
+    if (uop.opcode == CAS) {
+        // Reads the word and may write it
+        *addr = cpu->regs[uop.r2] & cpu->mem_mask;
+        return debug_watch_at(debug, *addr, WATCH_ACCESS);
+    }
+    if (uop.opcode != LOAD && uop.opcode != STORE) {
+        return 0;
+    }
+    *addr = (cpu->regs[uop.r2] + uop.imm) & cpu->mem_mask;
+    return debug_watch_at(debug, *addr, uop.opcode == LOAD ? WATCH_READ : WATCH_WRITE);
+}
@@ -0,0 +1,66 @@
+#ifndef DEBUG_H_20251117_
+#define DEBUG_H_20251117_
+
+#include <stdint.h>
+
+#include "emulator.h"
+
+#define DEBUG_WATCH_MAX 32              // Watchpoints per set
+
+enum debug_watch {
+    WATCH_READ = 1,                     // LOAD
+    WATCH_WRITE = 2,                    // STORE
+    WATCH_ACCESS = WATCH_READ | WATCH_WRITE,
+};
+
+struct debug_watch_st {
+    uint16_t addr;                      // First data address
+    uint32_t words;                     // Words watched from addr
+    uint8_t type;                       // enum debug_watch
+};
+
+/*
+ * Breakpoints and watchpoints. Predecode patches the uop at each breakpoint address to the
+ * UOP_BREAK dispatch, so engines stop there (CPU_BREAK, before running it)
+ * through their normal dispatch without testing anything per instruction;
+ * superinstructions are not fused across a breakpoint and JIT blocks end
+ * before one. Watchpoints flag data addresses in watch_map and lower
+ * cpu->data_limit to the lowest of them, so a LOAD/STORE at or above it
+ * takes the same slow path as a device access; that path refuses a
+ * watched access and the engine stops before it, as it does before a
+ * fault (CPU_WATCH); a CAS counts as both a read and a write. Without
+ * watchpoints data_limit is unchanged and LOAD/STORE pay nothing.
+ * cpu_run() starting at a breakpoint or a watched access runs that
+ * instruction first, ignoring both, so calling it again resumes. Changing
+ * breakpoints invalidates the predecoded code. The lockstep engine ignores
+ * breakpoints and runs scalar under watchpoints.
+ * Like the bus, the set is not owned by the CPUs using it and forks share
+ * it; after changing it through one CPU, call cpu_set_debug() on the
+ * others.
+ */
+struct debug_st {
+    uint32_t breaks;                    // Breakpoints set
+    uint32_t watches;                   // Entries in watch[]
+    uint32_t watch_low;                 // Lowest watched address, MEMORY_MAX when none
+    uint8_t stepping;                   // cpu_run() is stepping over a stop; ignore both maps
+    struct debug_watch_st watch[DEBUG_WATCH_MAX];
+    uint8_t break_map[MEMORY_MAX / 8];  // Bit per instruction address
+    uint8_t watch_map[MEMORY_MAX];      // enum debug_watch flags per data address
+};
+
+#define debug_break_at(debug, addr) ((debug)->break_map[(uint16_t)(addr) >> 3] >> ((addr) & 7) & 1)
+
+// enum debug_watch flags of the watchpoints that an access of this type hits
+#define debug_watch_at(debug, addr, type) ((debug)->watch_map[(uint16_t)(addr)] & (type))
+
+struct debug_st *debug_create(void);
+void debug_destroy(struct debug_st *debug);
+int cpu_break_insert(cpu_t *cpu, uint16_t addr);
+int cpu_break_remove(cpu_t *cpu, uint16_t addr);
+void cpu_break_clear(cpu_t *cpu);
+int cpu_watch_insert(cpu_t *cpu, uint16_t addr, uint32_t words, int type);
+int cpu_watch_remove(cpu_t *cpu, uint16_t addr, uint32_t words, int type);
+void cpu_watch_clear(cpu_t *cpu);
+int cpu_watch_hit(const cpu_t *cpu, uint16_t *addr);
+
+#endif  // DEBUG_H_20251117_
@@ -1,211 +1,1244 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "opcodes.h"
 #include "emulator.h"
+#include "trace.h"
+#include "profile.h"
+#include "jit.h"
+#include "block.h"
+#include "bus.h"
+#include "host.h"
+#include "replay.h"
+#include "debug.h"
 
 static const char* s_op_code_str[] = {
     OPCODES(OPCODES_ARRAY_GEN)
 };
 
+#define FUSED_UOPS_LENGTH_GEN(n, len, s) [n - UOP_FUSED_FIRST] = (len),
+#define FUSED_UOPS_NAME_GEN(n, len, s) [n - UOP_FUSED_FIRST] = (s),
+
+static const int s_fused_length[] = {
+    FUSED_UOPS(FUSED_UOPS_LENGTH_GEN)
+};
+
+static const char* s_fused_str[] = {
+    FUSED_UOPS(FUSED_UOPS_NAME_GEN)
+};
+
+#define TRAP_VECTORS_NAME_GEN(v, n, s) [n] = (s),
+
+static const char* s_trap_str[] = {
+    TRAP_VECTORS(TRAP_VECTORS_NAME_GEN)
+};
+
+_Static_assert((CPU_GUARD_WORD >> 11) == TRAP, "guard word decodes as TRAP");
+_Static_assert((CPU_GUARD_WORD & 0xFF) < TRAP_PUTC, "guard word is not a host call");
+
+static size_t cpu_text_bytes(uint32_t size)
+{
+    return sizeof(struct cpu_text_st) + (size + 1) * (sizeof(uop_t) + sizeof(uint16_t));
+}
+
+// Bytes before the inline words[]
+static size_t cpu_text_code_bytes(uint32_t size)
+{
+    return sizeof(struct cpu_text_st) + (size + 1) * sizeof(uop_t);
+}
+
+// Stands in for every data page not yet written; never freed
+static uint16_t s_zero_words[CPU_PAGE_WORDS];
+static struct cpu_page_st s_zero_page = { .refs = 1, .words = s_zero_words };
+
+// Zero-filled memory from the given backing, NULL on failure
+static void *cpu_mem_alloc(size_t bytes, int backing)
+{
+    if (backing == CPU_BACKING_MMAP) {
+        void *mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return mem == MAP_FAILED ? NULL : mem;
+    }
+    return calloc(1, bytes);
+}
+
+static void cpu_mem_free(void *mem, size_t bytes, int backing)
+{
+    if (backing == CPU_BACKING_MMAP) {
+        munmap(mem, bytes);
+    } else {
+        free(mem);
+    }
+}
+
+/*
+ * New instruction memory of size words, a copy of from when given. The copy
+ * keeps its words inline even when from's are in a file mapping.
+ */
+static struct cpu_text_st *cpu_text_new(uint32_t size, int backing, const struct cpu_text_st *from)
+{
+    struct cpu_text_st *text = (struct cpu_text_st *)cpu_mem_alloc(cpu_text_bytes(size), backing);
+    if (!text) {
+        return NULL;
+    }
+    if (from) {
+        memcpy(text, from, cpu_text_code_bytes(size));
+    }
+    atomic_init(&text->refs, 1);
+    text->backing = backing;
+    text->size = size;
+    text->words = (uint16_t *)&text->code[size + 1];
+    text->map = NULL;
+    text->map_bytes = 0;
+    if (from) {
+        memcpy(text->words, from->words, size * sizeof(uint16_t));
+    }
+    text->words[size] = CPU_GUARD_WORD;
+    return text;
+}
+
+// A private page holding a copy of words
+static struct cpu_page_st *cpu_page_new(const uint16_t *words)
+{
+    struct cpu_page_st *page = (struct cpu_page_st *)malloc(
+        sizeof(struct cpu_page_st) + CPU_PAGE_WORDS * sizeof(uint16_t));
+    if (page) {
+        atomic_init(&page->refs, 1);
+        page->map = NULL;
+        page->words = (uint16_t *)(page + 1);
+        memcpy(page->words, words, CPU_PAGE_WORDS * sizeof(uint16_t));
+    }
+    return page;
+}
+
+static void cpu_map_put(struct cpu_map_st *map)
+{
+    if (atomic_fetch_sub(&map->refs, 1) == 1) {
+        munmap(map->addr, map->bytes);
+        free(map);
+    }
+}
+
+static void cpu_page_put(struct cpu_page_st *page)
+{
+    if (atomic_fetch_sub(&page->refs, 1) == 1) {
+        if (page->map) {
+            cpu_map_put(page->map);
+        } else {
+            free(page);
+        }
+    }
+}
+
+/*
+ * New page table for size words of data memory, holding the pages of from
+ * when given and the zero page otherwise. Copying a table copies no page.
+ */
+static struct cpu_data_st *cpu_data_new(uint32_t size, const struct cpu_data_st *from)
+{
+    uint32_t count = (size + CPU_PAGE_MASK) >> CPU_PAGE_SHIFT;
+    struct cpu_data_st *data = (struct cpu_data_st *)malloc(
+        sizeof(struct cpu_data_st) + count * (sizeof(uint16_t *) + sizeof(struct cpu_page_st *)));
+    if (!data) {
+        return NULL;
+    }
+    atomic_init(&data->refs, 1);
+    data->shared = 0;
+    data->size = size;
+    data->count = count;
+    data->pages = (struct cpu_page_st **)&data->words[count];
+    for (uint32_t i = 0; i < count; i++) {
+        data->pages[i] = from ? from->pages[i] : &s_zero_page;
+        data->words[i] = data->pages[i]->words;
+        atomic_fetch_add(&data->pages[i]->refs, 1);
+    }
+    return data;
+}
+
+static void cpu_text_put(struct cpu_text_st *text)
+{
+    if (text && atomic_fetch_sub(&text->refs, 1) == 1) {
+        if (text->map) {
+            munmap(text->map, text->map_bytes);
+        }
+        cpu_mem_free(text, cpu_text_bytes(text->size), text->backing);
+    }
+}
+
+static void cpu_data_put(struct cpu_data_st *data)
+{
+    if (data && atomic_fetch_sub(&data->refs, 1) == 1) {
+        for (uint32_t i = 0; i < data->count; i++) {
+            cpu_page_put(data->pages[i]);
+        }
+        free(data);
+    }
+}
+
 int cpu_init(cpu_t *cpu)
 {
+    static const struct cpu_config_st config = CPU_CONFIG_DEFAULT;
+
+    return cpu_init_config(cpu, &config);
+}
+
+int cpu_init_config(cpu_t *cpu, const struct cpu_config_st *config)
+{
+    cpu->text = NULL;
+    cpu->data = NULL;
+    cpu->jit = NULL;
+    cpu->blocks = NULL;
+    cpu->bus = NULL;
+    cpu->host = NULL;
+    cpu->replay = NULL;
+    cpu->debug = NULL;
+    memset(&cpu->irq, 0, sizeof(cpu->irq));
+    if (cpu_configure(cpu, config) != 0) {
+        return -1;
+    }
+
     cpu->pc = 0;
+    cpu->steps = 0;
+    cpu->core = 0;
+    cpu->cores = 1;
+    memset(&cpu->stats, 0, sizeof(cpu->stats));
     cpu->nf = 0;
     cpu->zf = 0;
     cpu->cf = 0;
     memset(cpu->regs, 0, sizeof(cpu->regs));
-    memset(cpu->mem_inst, 0, sizeof(cpu->mem_inst));
-    memset(cpu->mem_data, 0, sizeof(cpu->mem_data));
+    cpu->trace = NULL;
+    cpu->profile = NULL;
+    cpu->code_jitted = 0;
+    cpu->code_blocked = 0;
+    cpu->code_translated = 0;
+    return 0;
+}
+
+/*
+ * Replace both memories with zeroed ones laid out as config says. Registers,
+ * counters and hooks are kept; the JIT and block caches are dropped since
+ * they are sized for the old memory.
+ */
+int cpu_configure(cpu_t *cpu, const struct cpu_config_st *config)
+{
+    uint32_t words = config->mem_words;
+
+    if (words == 0 || words > MEMORY_MAX
+        || (!config->checked && (words & (words - 1)) != 0)
+        || (config->backing != CPU_BACKING_HEAP && config->backing != CPU_BACKING_MMAP)) {
+        return -1;
+    }
+
+    struct cpu_text_st *text = cpu_text_new(words, config->backing, NULL);
+    struct cpu_data_st *data = cpu_data_new(words, NULL);
+    if (!text || !data) {
+        cpu_text_put(text);
+        cpu_data_put(data);
+        return -1;
+    }
+
+    jit_destroy(cpu->jit);
+    cpu->jit = NULL;
+    cpu->code_jitted = 0;
+    block_cache_destroy(cpu->blocks);
+    cpu->blocks = NULL;
+    cpu->code_blocked = 0;
+    cpu->code_translated = 0;
+    cpu_text_put(cpu->text);
+    cpu_data_put(cpu->data);
+    cpu->text = text;
+    cpu->data = data;
+    cpu->mem_inst = text->words;
+    cpu->code = text->code;
+    cpu->mem_data = data->words;
+    cpu->mem_words = words;
+    cpu->mem_mask = config->checked ? 0xFFFF : words - 1;
+    cpu_set_bus(cpu, cpu->bus);
+    return 0;
+}
+
+void cpu_get_config(const cpu_t *cpu, struct cpu_config_st *config)
+{
+    config->mem_words = cpu->mem_words;
+    config->checked = cpu_checked(cpu);
+    config->backing = cpu->text->backing;
+}
+
+// Free resources created by the execution engines and drop both memories
+void cpu_release(cpu_t *cpu)
+{
+    jit_destroy(cpu->jit);
+    cpu->jit = NULL;
+    block_cache_destroy(cpu->blocks);
+    cpu->blocks = NULL;
+    cpu_text_put(cpu->text);
+    cpu_data_put(cpu->data);
+    cpu->text = NULL;
+    cpu->data = NULL;
+}
+
+/*
+ * Clone parent into child without copying either memory: both share them
+ * copy-on-write until one of them writes. The child gets a page table of
+ * its own, unless the parent's is shared, and no trace, profile or JIT
+ * cache yet. parent must not be running meanwhile. On failure child holds
+ * nothing, so cpu_release() on it is still safe.
+ */
+int cpu_fork(cpu_t *child, const cpu_t *parent)
+{
+    struct cpu_data_st *data = parent->data;
+    if (data->shared) {
+        atomic_fetch_add(&data->refs, 1);
+    } else if (!(data = cpu_data_new(parent->data->size, parent->data))) {
+        child->text = NULL;
+        child->data = NULL;
+        child->jit = NULL;
+        child->blocks = NULL;
+        return -1;
+    }
+
+    memcpy(child, parent, sizeof(cpu_t));
+    atomic_fetch_add(&child->text->refs, 1);
+    child->data = data;
+    child->mem_data = data->words;
+    child->trace = NULL;
+    child->profile = NULL;
+    child->replay = NULL;
+    child->jit = NULL;
+    child->code_jitted = 0;
+    child->blocks = NULL;
+    child->code_blocked = 0;
+    return 0;
+}
+
+// Give cpu a private copy of its instruction memory if it is shared
+int cpu_own_text(cpu_t *cpu)
+{
+    struct cpu_text_st *text = cpu->text;
+
+    if (atomic_load(&text->refs) == 1) {
+        return 0;
+    }
+
+    struct cpu_text_st *copy = cpu_text_new(text->size, text->backing, text);
+    if (!copy) {
+        return -1;
+    }
+    cpu->text = copy;
+    cpu->mem_inst = copy->words;
+    cpu->code = copy->code;
+    cpu_text_put(text);
+    return 0;
+}
+
+// Give cpu a private copy of the data page holding addr if it is shared
+int cpu_own_page(cpu_t *cpu, uint16_t addr)
+{
+    struct cpu_data_st *data = cpu->data;
+    uint32_t i = addr >> CPU_PAGE_SHIFT;
+    struct cpu_page_st *page = data->pages[i];
+
+    if (atomic_load(&page->refs) == 1) {
+        return 0;
+    }
+
+    struct cpu_page_st *copy = cpu_page_new(page->words);
+    if (!copy) {
+        return -1;
+    }
+    data->pages[i] = copy;
+    data->words[i] = copy->words;
+    cpu_page_put(page);
+    return 0;
+}
+
+// Give cpu a private copy of every data page it shares
+int cpu_own_data(cpu_t *cpu)
+{
+    for (uint32_t addr = 0; addr < cpu->mem_words; addr += CPU_PAGE_WORDS) {
+        if (cpu_own_page(cpu, addr) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Copy all mem_words words of data memory out to words
+void cpu_data_read(const cpu_t *cpu, uint16_t *words)
+{
+    for (uint32_t addr = 0; addr < cpu->mem_words; addr += CPU_PAGE_WORDS) {
+        uint32_t n = cpu->mem_words - addr < CPU_PAGE_WORDS ? cpu->mem_words - addr : CPU_PAGE_WORDS;
+        memcpy(words + addr, cpu->mem_data[addr >> CPU_PAGE_SHIFT], n * sizeof(uint16_t));
+    }
+}
+
+// Overwrite the first count words of data memory, at most mem_words
+int cpu_data_write(cpu_t *cpu, const uint16_t *words, uint32_t count)
+{
+    if (count > cpu->mem_words) {
+        count = cpu->mem_words;
+    }
+    for (uint32_t addr = 0; addr < count; addr += CPU_PAGE_WORDS) {
+        uint32_t n = count - addr < CPU_PAGE_WORDS ? count - addr : CPU_PAGE_WORDS;
+        if (cpu_own_page(cpu, addr) != 0) {
+            return -1;
+        }
+        memcpy(cpu->mem_data[addr >> CPU_PAGE_SHIFT], words + addr, n * sizeof(uint16_t));
+    }
     return 0;
 }
 
 int cpu_load_program(cpu_t *cpu, const char* filename)
 {
+    if (cpu_own_text(cpu) != 0) {
+        return -1;
+    }
+
     FILE *file = fopen(filename, "rb");
     if (!file) {
         return -1;
     }
 
-    size_t read_count = fread(cpu->mem_inst, sizeof(uint16_t), MEMORY_SIZE, file);
+    size_t read_count = fread(cpu->mem_inst, sizeof(uint16_t), cpu->mem_words, file);
     fclose(file);
 
+    cpu_invalidate(cpu);
     return read_count;
 }
 
-void cpu_exec(cpu_t *cpu)
+/*
+ * Map data memory from mem_words words of fd at offset instead of reading
+ * them: each page points straight into a private mapping of the file, so
+ * nothing is copied until a page is written, and then only that page
+ * (by the kernel, or by cpu_own_page() once the page is shared). The file
+ * must hold all of them. cpu gets a page table of its own; forks keep the
+ * one they share.
+ */
+int cpu_map_data(cpu_t *cpu, int fd, off_t offset)
 {
-    while (1) {
-        uint16_t instruction = cpu->mem_inst[cpu->pc];
-        uint8_t opcode = (instruction >> 11) & 0x1F;
-        uint8_t op1 = (instruction >> 8) & 0x07;
-        uint8_t op2 = (instruction >> 4) & 0x0F;
-        uint8_t op3 = instruction & 0x0F;
+    struct cpu_data_st *data = cpu_data_new(cpu->mem_words, NULL);
+    struct cpu_map_st *map = data ? (struct cpu_map_st *)malloc(
+        sizeof(struct cpu_map_st) + data->count * sizeof(struct cpu_page_st)) : NULL;
+    if (!map) {
+        cpu_data_put(data);
+        return -1;
+    }
 
-        cpu_dump(cpu);  // Dump CPU state before executing instruction
+    // Anonymous zero pages for whole data pages, the file mapped over the start
+    size_t page = sysconf(_SC_PAGESIZE);
+    off_t start = offset & ~(off_t)(page - 1);
+    size_t skip = offset - start;
+    size_t file_bytes = skip + cpu->mem_words * sizeof(uint16_t);
+    map->bytes = (skip + data->count * CPU_PAGE_WORDS * sizeof(uint16_t) + page - 1) & ~(page - 1);
+    map->addr = mmap(NULL, map->bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map->addr == MAP_FAILED) {
+        free(map);
+        cpu_data_put(data);
+        return -1;
+    }
+    if (mmap(map->addr, file_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, start) == MAP_FAILED) {
+        munmap(map->addr, map->bytes);
+        free(map);
+        cpu_data_put(data);
+        return -1;
+    }
+
+    atomic_init(&map->refs, data->count);
+    uint16_t *words = (uint16_t *)((uint8_t *)map->addr + skip);
+    for (uint32_t i = 0; i < data->count; i++) {
+        struct cpu_page_st *mapped = &map->pages[i];
+        atomic_init(&mapped->refs, 1);
+        mapped->map = map;
+        mapped->words = words + i * CPU_PAGE_WORDS;
+        cpu_page_put(data->pages[i]);
+        data->pages[i] = mapped;
+        data->words[i] = mapped->words;
+    }
+    cpu_data_put(cpu->data);
+    cpu->data = data;
+    cpu->mem_data = data->words;
+    return 0;
+}
+
+int cpu_load_data(cpu_t *cpu, const char* filename)
+{
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        return -1;
+    }
 
-        switch (opcode) {
-            case NOP: { cpu->pc++; break; }
-            case HALT: { return; }
+    // Page by page; words past the end of the file keep their contents
+    size_t read_count = 0;
+    for (uint32_t addr = 0; addr < cpu->mem_words; addr += CPU_PAGE_WORDS) {
+        uint32_t n = cpu->mem_words - addr < CPU_PAGE_WORDS ? cpu->mem_words - addr : CPU_PAGE_WORDS;
+        if (cpu_own_page(cpu, addr) != 0) {
+            fclose(file);
+            return -1;
+        }
+        size_t got = fread(cpu->mem_data[addr >> CPU_PAGE_SHIFT], sizeof(uint16_t), n, file);
+        read_count += got;
+        if (got < n) {
+            break;
+        }
+    }
+    fclose(file);
+
+    return read_count;
+}
+
+void cpu_decode(uop_t *uop, uint16_t instruction)
+{
+    uint8_t opcode = (instruction >> 11) & 0x1F;
+    uint8_t op1 = (instruction >> 8) & 0x07;
+    uint8_t op2 = (instruction >> 4) & 0x0F;
+    uint8_t op3 = instruction & 0x0F;
+
+    uop->opcode = opcode;
+    uop->dispatch = opcode;
+    uop->r1 = op1;
+    uop->r2 = op2 & REGISTER_MASK;
+    uop->r3 = op3 & REGISTER_MASK;
+
+    switch (opcode) {
+        case LOAD:
+        case STORE:
+        case SLL:
+        case SRL:
+        case SLA:
+        case SRA:
+            uop->imm = op3;
+            break;
+        case LDIH:
+            uop->imm = (op2 << 12 | op3 << 8) & 0xFF00;
+            break;
+        default:
+            uop->imm = op2 << 4 | op3;
+            break;
+    }
+}
+
+// Instructions executed by a dispatch: 1, or the superinstruction length
+int cpu_fused_length(int dispatch)
+{
+    if (dispatch < UOP_FUSED_FIRST || dispatch >= UOP_FUSED_END) {
+        return 1;
+    }
+    return s_fused_length[dispatch - UOP_FUSED_FIRST];
+}
+
+const char *cpu_fused_name(int dispatch)
+{
+    if (dispatch < UOP_FUSED_FIRST || dispatch >= UOP_FUSED_END) {
+        return "unknown";
+    }
+    return s_fused_str[dispatch - UOP_FUSED_FIRST];
+}
+
+// Peephole: pick the superinstruction, if any, starting at code[addr]
+static void cpu_fuse(cpu_t *cpu, int addr)
+{
+    uop_t *code = cpu->code;
+    const uop_t *uop = &code[addr];
+    int left = cpu->mem_words - addr;   // Sequences stop at the last word
+
+    code[addr].dispatch = uop->opcode;
+    if (left >= 2 && uop->opcode == CMP && uop[1].opcode == BZ) {
+        code[addr].dispatch = UOP_CMP_BZ;
+    } else if (left >= 2 && uop->opcode == CMP && uop[1].opcode == BNZ) {
+        code[addr].dispatch = UOP_CMP_BNZ;
+    } else if (left >= 2 && uop->opcode == LOAD && uop[1].opcode == ADD) {
+        code[addr].dispatch = UOP_LOAD_ADD;
+    } else if (left >= 3 && uop[1].opcode == CMP && uop[2].opcode == BNZ) {
+        if (uop->opcode == ADDI) {
+            code[addr].dispatch = UOP_ADDI_CMP_BNZ;
+        } else if (uop->opcode == SUBI) {
+            code[addr].dispatch = UOP_SUBI_CMP_BNZ;
+        }
+    }
+
+    const struct debug_st *debug = cpu->debug;
+    if (debug && debug->breaks) {
+        // Stop at a breakpoint, even inside a would-be superinstruction
+        for (int i = 1; i < cpu_fused_length(code[addr].dispatch); i++) {
+            if (debug_break_at(debug, addr + i)) {
+                code[addr].dispatch = uop->opcode;
+            }
+        }
+        if (debug_break_at(debug, addr)) {
+            code[addr].dispatch = UOP_BREAK;
+        }
+    }
+}
+
+int cpu_predecode(cpu_t *cpu)
+{
+    if (cpu_own_text(cpu) != 0) {
+        return -1;
+    }
+    // The guard word decodes too, so engines stop at code[mem_words]
+    for (uint32_t i = 0; i <= cpu->mem_words; i++) {
+        cpu_decode(&cpu->code[i], cpu->mem_inst[i]);
+    }
+    for (uint32_t i = 0; i < cpu->mem_words; i++) {
+        cpu_fuse(cpu, i);
+    }
+    cpu->text->valid = 1;
+    return 0;
+}
+
+/*
+ * Must be called after mem_inst is modified other than through
+ * cpu_write_inst; call cpu_own_text() before modifying it.
+ */
+void cpu_invalidate(cpu_t *cpu)
+{
+    if (cpu_own_text(cpu) == 0) {
+        cpu->text->valid = 0;
+        cpu->text->bound = 0;
+    }
+    cpu->code_jitted = 0;
+    cpu->code_blocked = 0;
+    cpu->code_translated = 0;
+}
+
+int cpu_write_inst(cpu_t *cpu, uint16_t addr, uint16_t instruction)
+{
+    if (cpu_own_text(cpu) != 0) {
+        return -1;
+    }
+    addr &= cpu->mem_mask;
+    if (addr >= cpu->mem_words) {
+        return -1;
+    }
+    cpu->mem_inst[addr] = instruction;
+    if (cpu->text->valid) {
+        cpu_decode(&cpu->code[addr], instruction);
+        // Superinstructions that start up to UOP_FUSED_MAX - 1 earlier
+        for (int i = addr - (UOP_FUSED_MAX - 1); i <= addr; i++) {
+            if (i >= 0) {
+                cpu_fuse(cpu, i);
+            }
+        }
+        cpu->text->bound = 0;
+        cpu->code_jitted = 0;
+        cpu->code_blocked = 0;
+        cpu->code_translated = 0;
+    }
+    return 0;
+}
+
+void cpu_set_trace(cpu_t *cpu, struct trace_st *trace)
+{
+    cpu->trace = trace;
+}
+
+void cpu_set_profile(cpu_t *cpu, struct profile_st *profile)
+{
+    cpu->profile = profile;
+}
+
+/*
+ * Attach a device bus, or detach with NULL; call again after mapping
+ * devices. Watchpoints also lower data_limit, so the debug set's changes
+ * call this too.
+ */
+void cpu_set_bus(cpu_t *cpu, struct bus_st *bus)
+{
+    cpu->bus = bus;
+    cpu->data_limit = cpu->mem_words;
+    if (bus && bus->low < cpu->data_limit) {
+        cpu->data_limit = bus->low;
+    }
+    if (cpu->debug && cpu->debug->watch_low < cpu->data_limit) {
+        cpu->data_limit = cpu->debug->watch_low;
+    }
+    // Translated LOAD/STORE embed data_limit
+    cpu->code_jitted = 0;
+}
+
+// Attach the TRAP host calls, or detach with NULL
+void cpu_set_host(cpu_t *cpu, struct host_st *host)
+{
+    cpu->host = host;
+}
+
+// Attach an input log, or detach with NULL; the next cpu_run() takes a checkpoint
+void cpu_set_replay(cpu_t *cpu, struct replay_st *replay)
+{
+    cpu->replay = replay;
+    if (replay) {
+        replay->next_checkpoint = cpu->steps;
+    }
+}
+
+// Attach breakpoints and watchpoints, or detach with NULL; predecode applies breakpoints
+void cpu_set_debug(cpu_t *cpu, struct debug_st *debug)
+{
+    cpu->debug = debug;
+    cpu_set_bus(cpu, cpu->bus);
+    cpu_invalidate(cpu);
+}
+
+// Called before each instruction while cpu_hooked(), cpu->pc is current
+void cpu_hook_step(cpu_t *cpu)
+{
+    if (cpu->trace) {
+        trace_step(cpu->trace, cpu);
+    }
+    if (cpu->profile) {
+        profile_step(cpu->profile, cpu);
+    }
+}
+
+/*
+ * CAS grX, grY, grZ: if data word grY holds grX, store grZ there, as one
+ * atomic step against the other cores of a machine. grX receives the old
+ * word and the flags are set as by CMP of the old word with grX, so ZF is
+ * set when the store happened. Returns -1 without executing it for an
+ * address outside data memory, in a device window or watched.
+ */
+int cpu_cas(cpu_t *cpu, const uop_t *uop)
+{
+    uint16_t addr = cpu->regs[uop->r2] & cpu->mem_mask;
+    uint16_t expected = cpu->regs[uop->r1];
+    uint16_t old = expected;
+
+    if (addr >= cpu->data_limit
+        && (addr >= cpu->mem_words || bus_find(cpu->bus, addr)
+            || (cpu->debug && !cpu->debug->stepping && debug_watch_at(cpu->debug, addr, WATCH_ACCESS)))) {
+        return -1;
+    }
+    if (cpu_page_shared(cpu, addr) && cpu_own_page(cpu, addr) != 0) {
+        return -1;
+    }
+    __atomic_compare_exchange_n(&cpu_data_word(cpu, addr), &old, cpu->regs[uop->r3], 0,
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    uint16_t result = old - expected;
+    cpu->zf = result == 0;
+    cpu->nf = result >> 15;
+    cpu->regs[uop->r1] = old;
+    return 0;
+}
+
+/*
+ * Run at most max_steps instructions and return the enum cpu_status.
+ * CPU_BUDGET leaves pc at the next instruction, so calling again resumes.
+ */
+int cpu_exec_n(cpu_t *cpu, uint64_t max_steps)
+{
+    int hooked = cpu_hooked(cpu);
+    uint16_t *regs = cpu->regs;
+    uint16_t mask = cpu->mem_mask;
+    uint32_t words = cpu->mem_words;
+    uint32_t data_limit = cpu->data_limit;
+    uint16_t pc = cpu->pc & mask;
+    uint16_t addr;
+    uint64_t steps = 0;
+    // Superinstructions run only while they fit in the budget, never with hooks
+    uint64_t fuse_end = hooked || max_steps < UOP_FUSED_MAX ? 0 : max_steps - (UOP_FUSED_MAX - 1);
+
+    if (!cpu->text->valid && cpu_predecode(cpu) != 0) {
+        return cpu_status(cpu);
+    }
+
+    // Retire one instruction of a superinstruction and move to the next
+#define FUSED_STEP() do {                                   \
+        steps++;                                            \
+        CPU_STATS(cpu->stats.opcodes[uop->opcode]++);       \
+        uop++;                                              \
+    } while (0)
+
+    // LOAD/STORE past data_limit go through the device bus; stop before a fault
+    // or when there is no memory for a private copy of a shared page
+#define LOAD_DATA() do {                                                    \
+        addr = (regs[uop->r2] + uop->imm) & mask;                           \
+        if (__builtin_expect(addr < data_limit, 1)) {                       \
+            regs[uop->r1] = cpu_data_word(cpu, addr);                       \
+        } else if (cpu_bus_load(cpu, addr, &regs[uop->r1]) != 0) {          \
+            goto out;                                                       \
+        }                                                                   \
+    } while (0)
+#define STORE_DATA() do {                                                   \
+        addr = (regs[uop->r2] + uop->imm) & mask;                           \
+        if (__builtin_expect(addr < data_limit, 1)) {                       \
+            if (__builtin_expect(cpu_page_shared(cpu, addr), 0)             \
+                && cpu_own_page(cpu, addr) != 0) {                          \
+                goto out;                                                   \
+            }                                                               \
+            cpu_data_word(cpu, addr) = regs[uop->r1];                       \
+        } else if (cpu_bus_store(cpu, addr, regs[uop->r1]) != 0) {          \
+            goto out;                                                       \
+        }                                                                   \
+    } while (0)
+
+    // A bounds-checked PC past the end faults before executing anything
+    while (steps < max_steps && pc < words) {
+        const uop_t *uop = &cpu->code[pc];
+        uint8_t op = uop->dispatch;
+
+        if (__builtin_expect(steps >= fuse_end, 0)) {
+            // cpu_run() stepping over a breakpoint runs the instruction under it
+            op = op == UOP_BREAK && !(cpu->debug && cpu->debug->stepping) ? UOP_BREAK : uop->opcode;
+            if (hooked && op != UOP_BREAK) {
+                cpu->pc = pc;
+                cpu_hook_step(cpu);
+            }
+        }
+
+        switch (op) {
+            case NOP: { pc++; break; }
+            case HALT: { goto out; }
             case LOAD: {
-                cpu->regs[op1] = cpu->mem_data[cpu->regs[op2] + op3];
-                cpu->pc++;
+                LOAD_DATA();
+                pc++;
                 break;
             }
             case STORE: {
-                cpu->mem_data[cpu->regs[op2] + op3] = cpu->regs[op1];
-                cpu->pc++;
+                STORE_DATA();
+                pc++;
                 break;
             }
             case LDIH: {
-                cpu->regs[op1] = cpu->regs[op1] + ((op2 << 12 | op3 << 8) & 0xFF00);
-                cpu->pc++;
+                regs[uop->r1] = regs[uop->r1] + uop->imm;
+                pc++;
                 break;
             }
             case ADD: {
-                cpu->regs[op1] = cpu->regs[op2] + cpu->regs[op3];
-                cpu->pc++;
+                regs[uop->r1] = regs[uop->r2] + regs[uop->r3];
+                pc++;
                 break;
             }
             case ADDI: {
-                cpu->regs[op1] = cpu->regs[op1] + (op2 << 4 | op3);
-                cpu->pc++;
+                regs[uop->r1] = regs[uop->r1] + uop->imm;
+                pc++;
                 break;
             }
             case ADDC: {
-                uint32_t result = cpu->regs[op2] + cpu->regs[op3] + cpu->cf;
-                cpu->regs[op1] = (uint16_t)result;
+                uint32_t result = regs[uop->r2] + regs[uop->r3] + cpu->cf;
+                regs[uop->r1] = (uint16_t)result;
                 cpu->cf = (result > 0xFFFF) ? 1 : 0;
-                cpu->pc++;
+                pc++;
                 break;
             }
             case SUB: {
-                cpu->regs[op1] = cpu->regs[op2] - cpu->regs[op3];
-                cpu->pc++;
+                regs[uop->r1] = regs[uop->r2] - regs[uop->r3];
+                pc++;
                 break;
             }
             case SUBI: {
-                cpu->regs[op1] = cpu->regs[op2] - (op2 << 4 | op3);
-                cpu->pc++;
+                regs[uop->r1] = regs[uop->r1] - uop->imm;
+                pc++;
                 break;
             }
             case SUBC: {
-                uint32_t result = cpu->regs[op2] - cpu->regs[op3] - cpu->cf;
-                cpu->regs[op1] = (uint16_t)result;
+                uint32_t result = regs[uop->r2] - regs[uop->r3] - cpu->cf;
+                regs[uop->r1] = (uint16_t)result;
                 cpu->cf = (result > 0xFFFF) ? 1 : 0;
-                cpu->pc++;
+                pc++;
                 break;
             }
             case CMP: {
-                uint16_t result = cpu->regs[op2] - cpu->regs[op3];
+                uint16_t result = regs[uop->r2] - regs[uop->r3];
                 cpu->zf = (result == 0) ? 1 : 0;
                 cpu->nf = (result & 0x8000) ? 1 : 0;
-                cpu->pc++;
+                pc++;
                 break;
             }
             case AND: {
-                cpu->regs[op1] = cpu->regs[op2] & cpu->regs[op3];
-                cpu->pc++;
+                regs[uop->r1] = regs[uop->r2] & regs[uop->r3];
+                pc++;
                 break;
             }
             case OR: {
-                cpu->regs[op1] = cpu->regs[op2] | cpu->regs[op3];
-                cpu->pc++;
+                regs[uop->r1] = regs[uop->r2] | regs[uop->r3];
+                pc++;
                 break;
             }
             case XOR: {
-                cpu->regs[op1] = cpu->regs[op2] ^ cpu->regs[op3];
-                cpu->pc++;
+                regs[uop->r1] = regs[uop->r2] ^ regs[uop->r3];
+                pc++;
                 break;
             }
             case SLL: {
-                cpu->regs[op1] = cpu->regs[op2] << op3;
-                cpu->pc++;
+                regs[uop->r1] = regs[uop->r2] << uop->imm;
+                pc++;
                 break;
             }
             case SRL: {
-                cpu->regs[op1] = cpu->regs[op2] >> op3;
-                cpu->pc++;
+                regs[uop->r1] = regs[uop->r2] >> uop->imm;
+                pc++;
                 break;
             }
             case SLA: {
-                cpu->regs[op1] = cpu->regs[op2] << op3;
-                cpu->pc++;
+                regs[uop->r1] = regs[uop->r2] << uop->imm;
+                pc++;
                 break;
             }
             case SRA: {
-                cpu->regs[op1] = (cpu->regs[op2] >> op3) | (cpu->regs[op2] & 0x8000 ? ((0xFFFF) << (16 - op3)) : 0);
-                cpu->pc++;
+                regs[uop->r1] = (regs[uop->r2] >> uop->imm) | (regs[uop->r2] & 0x8000 ? ((0xFFFF) << (16 - uop->imm)) : 0);
+                pc++;
                 break;
             }
             case JUMP: {
-                cpu->pc = op2 << 4 | op3;
+                pc = uop->imm;
+                CPU_STATS(cpu->stats.taken[JUMP]++);
                 break;
             }
             case JMPR: {
-                cpu->pc = cpu->regs[op1] + (op2 << 4 | op3);
+                pc = regs[uop->r1] + uop->imm;
+                CPU_STATS(cpu->stats.taken[JMPR]++);
                 break;
             }
             case BZ: {
                 if (cpu->zf) {
-                    cpu->pc = cpu->regs[op1] + (op2 << 4 | op3);
+                    pc = regs[uop->r1] + uop->imm;
+                    CPU_STATS(cpu->stats.taken[BZ]++);
                 } else {
-                    cpu->pc++;
+                    pc++;
                 }
                 break;
             }
             case BNZ: {
                 if (!cpu->zf) {
-                    cpu->pc = cpu->regs[op1] + (op2 << 4 | op3);
+                    pc = regs[uop->r1] + uop->imm;
+                    CPU_STATS(cpu->stats.taken[BNZ]++);
                 } else {
-                    cpu->pc++;
+                    pc++;
                 }
                 break;
             }
             case BN: {
                 if (cpu->nf) {
-                    cpu->pc = cpu->regs[op1] + (op2 << 4 | op3);
+                    pc = regs[uop->r1] + uop->imm;
+                    CPU_STATS(cpu->stats.taken[BN]++);
                 } else {
-                    cpu->pc++;
+                    pc++;
                 }
                 break;
             }
             case BNN: {
                 if (!cpu->nf) {
-                    cpu->pc = cpu->regs[op1] + (op2 << 4 | op3);
+                    pc = regs[uop->r1] + uop->imm;
+                    CPU_STATS(cpu->stats.taken[BNN]++);
                 } else {
-                    cpu->pc++;
+                    pc++;
                 }
                 break;
             }
             case BC: {
                 if (cpu->cf) {
-                    cpu->pc = cpu->regs[op1] + (op2 << 4 | op3);
+                    pc = regs[uop->r1] + uop->imm;
+                    CPU_STATS(cpu->stats.taken[BC]++);
                 } else {
-                    cpu->pc++;
+                    pc++;
                 }
                 break;
             }
             case BNC: {
                 if (!cpu->cf) {
-                    cpu->pc = cpu->regs[op1] + (op2 << 4 | op3);
+                    pc = regs[uop->r1] + uop->imm;
+                    CPU_STATS(cpu->stats.taken[BNC]++);
                 } else {
-                    cpu->pc++;
+                    pc++;
                 }
                 break;
             }
+            case TRAP: {
+                if (cpu_trap(cpu, uop) != 0) {
+                    goto out;   // TRAP_EXIT or a failed call
+                }
+                pc++;
+                break;
+            }
+            case RETI: {
+                pc = cpu_reti(cpu);
+                max_steps = steps + 1;      // Stop after it for cpu_run()
+                break;
+            }
+            case CSR: {
+                if (cpu_csr(cpu, uop, cpu->steps + steps + 1) != 0) {
+                    max_steps = steps + 1;  // Stop after it for cpu_run()
+                }
+                pc++;
+                break;
+            }
+            case CAS: {
+                if (cpu_cas(cpu, uop) != 0) {
+                    goto out;   // Fault or watchpoint
+                }
+                pc++;
+                break;
+            }
+
+
+            // Superinstructions: the last instruction retires below as usual
+            case UOP_CMP_BZ:
+            case UOP_CMP_BNZ: {
+                uint16_t result = regs[uop->r2] - regs[uop->r3];
+                cpu->zf = (result == 0) ? 1 : 0;
+                cpu->nf = (result & 0x8000) ? 1 : 0;
+                CPU_STATS(cpu->stats.fused[op - UOP_FUSED_FIRST]++);
+                FUSED_STEP();
+                if (cpu->zf == (op == UOP_CMP_BZ)) {
+                    pc = regs[uop->r1] + uop->imm;
+                    CPU_STATS(cpu->stats.taken[uop->opcode]++);
+                } else {
+                    pc += 2;
+                }
+                break;
+            }
+            case UOP_LOAD_ADD: {
+                LOAD_DATA();
+                CPU_STATS(cpu->stats.fused[UOP_LOAD_ADD - UOP_FUSED_FIRST]++);
+                FUSED_STEP();
+                regs[uop->r1] = regs[uop->r2] + regs[uop->r3];
+                pc += 2;
+                break;
+            }
+            case UOP_ADDI_CMP_BNZ:
+            case UOP_SUBI_CMP_BNZ: {
+                if (op == UOP_ADDI_CMP_BNZ) {
+                    regs[uop->r1] = regs[uop->r1] + uop->imm;
+                } else {
+                    regs[uop->r1] = regs[uop->r1] - uop->imm;
+                }
+                CPU_STATS(cpu->stats.fused[op - UOP_FUSED_FIRST]++);
+                FUSED_STEP();
+                uint16_t result = regs[uop->r2] - regs[uop->r3];
+                cpu->zf = (result == 0) ? 1 : 0;
+                cpu->nf = (result & 0x8000) ? 1 : 0;
+                FUSED_STEP();
+                if (!cpu->zf) {
+                    pc = regs[uop->r1] + uop->imm;
+                    CPU_STATS(cpu->stats.taken[BNZ]++);
+                } else {
+                    pc += 3;
+                }
+                break;
+            }
+
+            case UOP_BREAK:
+                goto out;   // Stop before it; cpu_status() reports CPU_BREAK
 
             default:
                 // Handle unknown opcode
-                return;
+                goto out;
+        }
+        pc &= mask;
+        steps++;
+        CPU_STATS(cpu->stats.opcodes[uop->opcode]++);
+    }
+
+out:
+    cpu->pc = pc;
+    cpu->steps += steps;
+    return cpu_status(cpu);
+
+#undef STORE_DATA
+#undef LOAD_DATA
+#undef FUSED_STEP
+}
+
+void cpu_exec(cpu_t *cpu)
+{
+    cpu_exec_n(cpu, CPU_STEPS_UNLIMITED);
+}
+
+static const char* s_engine_str[] = {
+    [CPU_ENGINE_SWITCH] = "switch",
+    [CPU_ENGINE_THREADED] = "threaded",
+    [CPU_ENGINE_JIT] = "jit",
+    [CPU_ENGINE_SIMD] = "simd",
+    [CPU_ENGINE_BLOCK] = "block",
+    [CPU_ENGINE_AOT] = "aot",
+};
+
+int cpu_engine_parse(const char *name)
+{
+    for (int i = 0; i < ARRAY_SIZE(s_engine_str); i++) {
+        if (strcmp(name, s_engine_str[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *cpu_engine_name(int engine)
+{
+    if (engine < 0 || engine >= ARRAY_SIZE(s_engine_str)) {
+        return "unknown";
+    }
+    return s_engine_str[engine];
+}
+
+static int cpu_run_engine(cpu_t *cpu, int engine, uint64_t max_steps)
+{
+    switch (engine) {
+        case CPU_ENGINE_THREADED:
+            return cpu_exec_threaded(cpu, max_steps);
+        case CPU_ENGINE_JIT:
+            return cpu_exec_jit(cpu, max_steps);
+        case CPU_ENGINE_SIMD:
+            // Lockstep needs several CPUs; a single one runs scalar
+            return cpu_exec_threaded(cpu, max_steps);
+        case CPU_ENGINE_BLOCK:
+            return cpu_exec_blocks(cpu, max_steps);
+        case CPU_ENGINE_AOT:
+            return cpu_exec_aot(cpu, max_steps);
+        case CPU_ENGINE_SWITCH:
+        default:
+            return cpu_exec_n(cpu, max_steps);
+    }
+}
+
+// Run the instruction at pc as if there were no breakpoints or watchpoints
+static int cpu_step_over(cpu_t *cpu)
+{
+    uint64_t steps = cpu->steps;
+    cpu->debug->stepping = 1;
+    int status = cpu_exec_n(cpu, 1);
+    cpu->debug->stepping = 0;
+    // Landing on a breakpoint must report it, or the next run would step over it too
+    return cpu->steps == steps ? status : cpu_status(cpu);
+}
+
+/*
+ * Run with the given engine for at most max_steps instructions. Interrupts
+ * are taken here, between engine runs: each run ends at the next timer
+ * deadline, or early when RETI or a CSR write sets irq.stop. A CPU stopped
+ * at HALT, a fault, a breakpoint or a watchpoint still takes an interrupt
+ * that is ready. A run starting at a breakpoint or a watched access runs
+ * that instruction first.
+ */
+int cpu_run(cpu_t *cpu, int engine, uint64_t max_steps)
+{
+    uint64_t end = max_steps > CPU_STEPS_UNLIMITED - cpu->steps ? CPU_STEPS_UNLIMITED : cpu->steps + max_steps;
+    uint16_t resume = cpu->pc;
+    int status = cpu->debug && (cpu->text->valid || cpu_predecode(cpu) == 0) ? cpu_status(cpu) : CPU_BUDGET;
+    int resuming = status == CPU_BREAK || status == CPU_WATCH;
+
+
+    for (;;) {
+        uint64_t limit = end;
+        if (cpu->replay) {
+            limit = replay_update(cpu, limit);
+        }
+        if (irq_active(&cpu->irq)) {
+            cpu_irq_update(cpu);
+            if (cpu->irq.period && cpu->irq.next < limit) {
+                limit = cpu->irq.next;
+            }
+        }
+        cpu->irq.stop = 0;
+        status = CPU_BUDGET;
+        if (resuming && cpu->pc == resume && limit > cpu->steps) {
+            status = cpu_step_over(cpu);
+        }
+        resuming = 0;
+        if (status == CPU_BUDGET && !cpu->irq.stop) {
+            status = cpu_run_engine(cpu, engine, limit - cpu->steps);
+        }
+        if (cpu->steps >= end) {
+            return status;
+        }
+        if (status == CPU_BUDGET ? cpu->steps < limit && !cpu->irq.stop : !cpu_irq_update(cpu)) {
+            return status;
         }
     }
 }
 
+// Why the last cpu_exec/cpu_run call stopped
+int cpu_status(const cpu_t *cpu)
+{
+    return cpu_status_at(cpu, cpu->pc, cpu->regs);
+}
+
+/*
+ * Status of an engine stopped at pc with these registers: only HALT and
+ * faults stop it early.
+ */
+int cpu_status_at(const cpu_t *cpu, uint16_t pc, const uint16_t *regs)
+{
+    uop_t uop;
+
+    pc &= cpu->mem_mask;
+    if (pc >= cpu->mem_words) {
+        return CPU_FAULT;       // Bounds-checked PC left instruction memory
+    }
+    if (cpu->text->valid && cpu->code[pc].dispatch == UOP_BREAK) {
+        return CPU_BREAK;
+    }
+    cpu_decode(&uop, cpu->mem_inst[pc]);
+
+    switch (uop.opcode) {
+        case HALT:
+            return CPU_HALTED;
+        case TRAP:
+            return cpu_trap_status(cpu, &uop, regs);
+        case RESEVE4:
+            return CPU_FAULT;
+        case LOAD:
+        case STORE: {
+            // Bounds-checked access outside data memory and every device, then a watched one
+            uint16_t addr = (regs[uop.r2] + uop.imm) & cpu->mem_mask;
+            if (addr >= cpu->mem_words && !bus_find(cpu->bus, addr)) {
+                return CPU_FAULT;
+            }
+            if (cpu->debug && debug_watch_at(cpu->debug, addr, uop.opcode == LOAD ? WATCH_READ : WATCH_WRITE)) {
+                return CPU_WATCH;
+            }
+            return CPU_BUDGET;
+        }
+        case CAS: {
+            // Only plain data memory: outside it or in a device window it faults
+            uint16_t addr = regs[uop.r2] & cpu->mem_mask;
+            if (addr >= cpu->mem_words || bus_find(cpu->bus, addr)) {
+                return CPU_FAULT;
+            }
+            if (cpu->debug && debug_watch_at(cpu->debug, addr, WATCH_ACCESS)) {
+                return CPU_WATCH;
+            }
+            return CPU_BUDGET;
+        }
+        default:
+            return CPU_BUDGET;
+    }
+}
+
+static const char* s_status_str[] = {
+    [CPU_HALTED] = "halted",
+    [CPU_FAULT] = "fault",
+    [CPU_BUDGET] = "budget",
+    [CPU_BREAK] = "break",
+    [CPU_WATCH] = "watch",
+};
+
+const char *cpu_status_name(int status)
+{
+    if (status < 0 || status >= ARRAY_SIZE(s_status_str)) {
+        return "unknown";
+    }
+    return s_status_str[status];
+}
+
+// Exit code of a program stopped at TRAP_EXIT, 0 otherwise
+int cpu_exit_code(const cpu_t *cpu)
+{
+    uop_t uop;
+
+    if (cpu->pc >= cpu->mem_words) {
+        return 0;
+    }
+    cpu_decode(&uop, cpu->mem_inst[cpu->pc]);
+    return uop.opcode == TRAP && uop.imm == TRAP_EXIT ? cpu->regs[uop.r1] : 0;
+}
+
 void cpu_dump(cpu_t *cpu)
 {
-    uint16_t instruction = cpu->mem_inst[cpu->pc];
+    // A bounds-checked PC past the end shows as the guard TRAP
+    uint16_t instruction = cpu->pc < cpu->mem_words ? cpu->mem_inst[cpu->pc] : CPU_GUARD_WORD;
     uint8_t opcode = (instruction >> 11) & 0x1F;
     uint8_t op1 = (instruction >> 8) & 0x07;
     uint8_t op2 = (instruction >> 4) & 0x0F;
@@ -232,7 +1265,16 @@ void cpu_dump(cpu_t *cpu)
     printf("NF: %d, ZF: %d, CF: %d\n", cpu->nf, cpu->zf, cpu->cf);
 
     if (opcode == LOAD || opcode == STORE) {
-        uint8_t addr = cpu->regs[op2] + op3;
-        printf("    Data Memory: 0x%04X: 0x%04X\n", addr, cpu->mem_data[addr]);
+        uint16_t addr = (cpu->regs[op2 & REGISTER_MASK] + op3) & cpu->mem_mask;
+        if (addr < cpu->mem_words) {
+            printf("    Data Memory: 0x%04X: 0x%04X\n", addr, cpu_data_word(cpu, addr));
+        } else {
+            printf("    Data Memory: 0x%04X: %s\n", addr, bus_find(cpu->bus, addr) ? "device" : "out of range");
+        }
+    }
+    if (opcode == TRAP) {
+        uint8_t vector = op2 << 4 | op3;
+        const char *name = vector < ARRAY_SIZE(s_trap_str) ? s_trap_str[vector] : NULL;
+        printf("    Trap: 0x%02X (%s)\n", vector, name ? name : "unknown");
     }
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 #define EMULATOR_H_20251117_
 
 #include <stdint.h>
+#include <stdatomic.h>
+#include <sys/types.h>
 
 /*
 15              11 10                8 7                 4 3                  0
@@ -11,24 +13,354 @@
 */
 
 
-#define MEMORY_SIZE 256     // 2^8 * 16b
+#define MEMORY_SIZE 256     // Default words per memory space, 2^8 * 16b
+#define MEMORY_MAX 65536    // Largest memory space: every 16-bit address
 #define NUM_REGISTERS 8     // 8 general-purpose registers
+#define REGISTER_MASK (NUM_REGISTERS - 1)
+
+/*
+ * Predecoded instruction (micro-op).
+ * Register fields are already masked to valid indices and the immediate is
+ * pre-combined for the opcode, so the execution loop does no bit extraction:
+ *   I type:   imm = {val2, val3}  (LDIH: {val2, val3, 0000_0000})
+ *   RI type:  imm = val3
+ */
+struct uop_st {
+    uint8_t opcode;         // Op code
+    uint8_t r1;             // Operand 1 register index
+    uint8_t r2;             // Operand 2 register index
+    uint8_t r3;             // Operand 3 register index
+    uint16_t imm;           // Pre-combined immediate
+    uint8_t dispatch;       // opcode, the UOP_* superinstruction starting here or UOP_BREAK
+    const void *handler;    // Threaded engine label, bound by cpu_exec_threaded
+};
+
+typedef struct uop_st uop_t;
+
+/*
+ * Superinstructions fused at predecode from common instruction sequences.
+ * The first uop of a sequence gets the fused dispatch opcode; the uops after
+ * it are left as they are, so branches into the middle still work. The
+ * interpreters execute a superinstruction with one dispatch; the JIT and
+ * the lockstep engine ignore them. Sequences never cross the last word.
+ */
+#define FUSED_UOPS(XX) \
+    XX(UOP_CMP_BZ,          2, "CMP+BZ"         ) \
+    XX(UOP_CMP_BNZ,         2, "CMP+BNZ"        ) \
+    XX(UOP_LOAD_ADD,        2, "LOAD+ADD"       ) \
+    XX(UOP_ADDI_CMP_BNZ,    3, "ADDI+CMP+BNZ"   ) \
+    XX(UOP_SUBI_CMP_BNZ,    3, "SUBI+CMP+BNZ"   ) \
+
+#define FUSED_UOPS_ENUM_GEN(n, len, s) n,
+enum uop_fused {
+    UOP_FUSED_BASE = 31,        // Numbered after the 5-bit ISA opcodes
+    FUSED_UOPS(FUSED_UOPS_ENUM_GEN)
+    UOP_FUSED_END,
+    UOP_BREAK = UOP_FUSED_END,  // Breakpoint: stop before this instruction
+    UOP_COUNT,
+};
+
+#define UOP_FUSED_FIRST (UOP_FUSED_BASE + 1)
+#define UOP_FUSED_COUNT (UOP_FUSED_END - UOP_FUSED_FIRST)
+#define UOP_FUSED_MAX 3             // Longest superinstruction, in instructions
+
+struct trace_st;
+struct profile_st;
+struct jit_st;
+struct block_cache_st;
+struct bus_st;
+struct host_st;
+struct replay_st;
+struct debug_st;
+
+/*
+ * Execution counters, maintained only when built with EMU_STATS
+ * (make STATS=1); otherwise CPU_STATS() compiles to nothing.
+ */
+struct cpu_stats_st {
+    uint64_t opcodes[32];       // Retired instructions per opcode
+    uint64_t taken[32];         // Taken JUMP/JMPR/Bxx per opcode
+    uint64_t fused[UOP_FUSED_COUNT];    // Dispatches per superinstruction
+};
+
+#ifdef EMU_STATS
+#define CPU_STATS(expr) do { expr; } while (0)
+#else
+#define CPU_STATS(expr) do { } while (0)
+#endif
+
+/*
+ * Interrupts. A line raised by the instruction timer (every period retired
+ * instructions) or by cpu_irq_raise() stays pending until it is taken:
+ * with interrupts enabled, cpu_run() saves PC and flags, clears ie and
+ * jumps to the handler in the vector table, a data memory word per line.
+ * RETI resumes at epc with the saved flags and ie set again. The guest
+ * programs all of it with CSR (see enum cpu_csr). Interrupts are only
+ * taken between engine runs: cpu_run() ends each run at the next timer
+ * deadline and engines stop early after RETI or a CSR write, so the
+ * engines themselves never test for them.
+ */
+#define IRQ_LINES 8
+#define IRQ_TIMER 0             // Line of the instruction timer
+
+struct cpu_irq_st {
+    uint64_t next;              // Timer deadline, in cpu->steps
+    uint32_t period;            // Instructions between timer interrupts, 0 when stopped
+    uint16_t vectors;           // Data memory address of the vector table
+    uint16_t epc;               // PC to resume at after the handler
+    uint8_t eflags;             // NF << 2 | ZF << 1 | CF when the interrupt was taken
+    uint8_t ie;                 // Interrupts enabled
+    uint8_t mask;               // Enabled lines
+    uint8_t pending;            // Raised lines not yet taken
+    uint8_t stop;               // Set when an engine stops early for cpu_run()
+};
+
+/*
+ * Control registers: CSR grX, 0, n reads register n into grX, CSR grX, 1, n
+ * writes grX to it. Unknown registers read 0 and ignore writes.
+ */
+enum cpu_csr {
+    CSR_STATUS,                 // Bit 0: interrupts enabled
+    CSR_EPC,                    // Saved PC, RETI resumes here
+    CSR_EFLAGS,                 // Saved flags, NF << 2 | ZF << 1 | CF
+    CSR_VECTORS,                // Vector table address
+    CSR_MASK,                   // Enabled lines
+    CSR_PENDING,                // Raised lines; writing acknowledges the lines set
+    CSR_TIMER,                  // Timer period, low word; writing restarts the timer
+    CSR_TIMER_HI,               // Timer period, high word; writing restarts the timer
+    CSR_CORE,                   // Index of this core in its machine, read-only
+    CSR_CORES,                  // Cores in the machine, read-only
+};
+
+// Interrupt state cpu_run() has to look after
+#define irq_active(irq) ((irq)->period || (irq)->pending)
+
+enum cpu_backing {
+    CPU_BACKING_HEAP,       // calloc/malloc
+    CPU_BACKING_MMAP,       // Anonymous mmap, pages zero-filled on first touch
+};
+
+/*
+ * Memory layout chosen at cpu_init_config(); both spaces hold mem_words
+ * words. Wrap-around addressing masks every address into the space, so
+ * mem_words must be a power of two. Bounds-checked addressing allows any
+ * size and stops the CPU with CPU_FAULT at a LOAD/STORE outside data memory
+ * or when the PC leaves instruction memory.
+ */
+struct cpu_config_st {
+    uint32_t mem_words;     // Words per memory space, 1 to MEMORY_MAX
+    uint8_t checked;        // Bounds-checked instead of wrap-around addressing
+    uint8_t backing;        // enum cpu_backing of instruction memory
+};
+
+#define CPU_CONFIG_DEFAULT { .mem_words = MEMORY_SIZE, .checked = 0, .backing = CPU_BACKING_HEAP }
+
+/*
+ * Instruction memory with its predecoded form, and data memory. Forked CPUs
+ * share both copy-on-write. Instruction memory is copied whole before the
+ * first write to it (cpu_write_inst, predecode or handler binding), which
+ * also redoes work over all of it. Data memory is a page table per CPU, and
+ * a STORE copies only the page it writes to when another table holds it
+ * too. Pages never written are one shared zero page, the others are on
+ * the heap or in a private file mapping (cpu_map_data). The cores of a
+ * machine (machine.h) share one page table marked shared, whose pages are
+ * all their own, and write it in place.
+ * Instruction memory has one guard word past the end holding a TRAP, so
+ * straight-line code running off a bounds-checked memory stops there.
+ */
+struct cpu_text_st {
+    _Atomic int refs;                   // CPUs sharing this memory
+    uint8_t valid;                      // code[] matches words[]
+    uint8_t bound;                      // Threaded engine binding of code[].handler, 0 if none
+    uint8_t backing;                    // enum cpu_backing of this allocation
+    uint32_t size;                      // Words, not counting the guard
+    uint16_t *words;                    // [size + 1], after code[] or in map
+    void *map;                          // Private file mapping holding words[], or NULL
+    size_t map_bytes;
+    uop_t code[];                       // [size + 1]
+};
+
+#define CPU_GUARD_WORD (0b10011 << 11)  // TRAP, stored at words[size]
+
+#define CPU_PAGE_SHIFT 8
+#define CPU_PAGE_WORDS (1 << CPU_PAGE_SHIFT)    // Words per data memory page
+#define CPU_PAGE_MASK (CPU_PAGE_WORDS - 1)
+
+struct cpu_page_st {
+    _Atomic int refs;                   // Page tables holding this page
+    struct cpu_map_st *map;             // File mapping holding words, or NULL
+    uint16_t *words;                    // [CPU_PAGE_WORDS], after this struct or in map
+};
+
+// Data pages mapped from a file (cpu_map_data), freed with the last of them
+struct cpu_map_st {
+    _Atomic int refs;                   // Pages still in use
+    void *addr;
+    size_t bytes;
+    struct cpu_page_st pages[];
+};
+
+struct cpu_data_st {
+    _Atomic int refs;                   // CPUs sharing this page table
+    uint8_t shared;                     // Never copied: every holder writes it in place
+    uint32_t size;                      // Words
+    uint32_t count;                     // Pages, size rounded up
+    struct cpu_page_st **pages;         // [count], right after words[]
+    uint16_t *words[];                  // [count], pages[i]->words
+};
 
 struct cpu_st {
-    uint16_t mem_inst[MEMORY_SIZE];     // Instruction memory
-    uint16_t mem_data[MEMORY_SIZE];     // Data memory
+    uint16_t *mem_inst;                 // Instruction memory, text->words
+    uint16_t **mem_data;                // Data memory pages, data->words
+    uop_t *code;                        // Predecoded instruction memory, text->code
+    struct cpu_text_st *text;
+    struct cpu_data_st *data;
+    uint32_t mem_words;                 // Words per memory space
+    uint16_t mem_mask;                  // Address mask: mem_words - 1, 0xFFFF when bounds-checked
+    uint32_t data_limit;                // LOAD/STORE below this hit plain data memory
     uint16_t regs[NUM_REGISTERS];          // general-purpose registers
     uint16_t pc;            // Program counter
     uint16_t nf:1;        // NF flag
     uint16_t zf:1;        // ZF flag
     uint16_t cf:1;        // CF flag
+    uint16_t code_jitted:1; // jit holds translations of the current code[]
+    uint16_t code_blocked:1; // blocks hold the current code[]
+    uint16_t code_translated:1; // mem_inst matches the program linked in as the aot engine
+    uint64_t steps;         // Retired instructions (HALT not counted)
+    uint16_t core;          // Index among the cores of a machine, CSR_CORE
+    uint16_t cores;         // Cores of the machine, 1 for a lone CPU
+    struct cpu_stats_st stats;          // Execution counters
+    struct cpu_irq_st irq;              // Interrupt controller and timer
+    struct trace_st *trace;             // Execution trace, NULL when off
+    struct profile_st *profile;         // Per-PC profile, NULL when off
+    struct jit_st *jit;                 // JIT code cache, created on first use
+    struct block_cache_st *blocks;      // Block engine cache, created on first use
+    struct bus_st *bus;                 // Memory-mapped devices, NULL when none
+    struct host_st *host;               // TRAP host calls, NULL when none
+    struct replay_st *replay;           // Input record/replay log, NULL when off
+    struct debug_st *debug;             // Breakpoints and watchpoints, NULL when none
 };
 
 typedef struct cpu_st cpu_t;
 
+// Per-instruction observers (trace, profile) that force an interpreter
+#define cpu_hooked(cpu) ((cpu)->trace || (cpu)->profile)
+
+// Addresses past mem_words are possible and fault
+#define cpu_checked(cpu) ((cpu)->mem_mask >= (cpu)->mem_words)
+
+// Some LOAD/STORE addresses need the slow path: a device window or a bounds fault
+#define cpu_data_guarded(cpu) ((uint32_t)(cpu)->mem_mask + 1 > (cpu)->data_limit)
+
+// Data word at addr, which must be below mem_words
+#define cpu_data_word(cpu, addr) ((cpu)->mem_data[(addr) >> CPU_PAGE_SHIFT][(addr) & CPU_PAGE_MASK])
+
+// A STORE to addr must call cpu_own_page() first
+#define cpu_page_shared(cpu, addr) \
+    (atomic_load_explicit(&(cpu)->data->pages[(addr) >> CPU_PAGE_SHIFT]->refs, memory_order_relaxed) > 1)
+
+enum cpu_status {
+    CPU_HALTED,             // Stopped at HALT or TRAP_EXIT
+    CPU_FAULT,              // Stopped at a failed TRAP, a reserved opcode or a bounds violation
+    CPU_BUDGET,             // Step budget used up; resumes at pc
+    CPU_BREAK,              // At a breakpoint; cpu_run() resumes by running it
+    CPU_WATCH,              // Before a watched LOAD/STORE; cpu_run() resumes by running it
+};
+
+/*
+ * TRAP host calls: TRAP rX, vh, vl calls vector {vh, vl} with rX as its
+ * argument register. Every vector except TRAP_EXIT needs a host attached
+ * with cpu_set_host(); without one, or for any other vector, TRAP faults.
+ *   putc   write the low byte of rX
+ *   putn   write rX as an unsigned decimal number
+ *   getn   read a decimal number into rX, 0xFFFF at end of input or when
+ *          the input is not a number (that character is skipped)
+ *   write  write the low byte of each of the r(X+1) data words from
+ *          address rX; with bounds-checked memory they must all be inside
+ *   exit   stop like HALT with exit code rX (cpu_exit_code())
+ */
+#define TRAP_VECTORS(XX) \
+    XX(0x21, TRAP_PUTC,     "putc"      ) \
+    XX(0x22, TRAP_PUTN,     "putn"      ) \
+    XX(0x23, TRAP_GETN,     "getn"      ) \
+    XX(0x24, TRAP_WRITE,    "write"     ) \
+    XX(0x25, TRAP_EXIT,     "exit"      ) \
+
+#define TRAP_VECTORS_ENUM_GEN(v, n, s) n = (v),
+enum trap_vector {
+    TRAP_VECTORS(TRAP_VECTORS_ENUM_GEN)
+};
+
+#define CPU_STEPS_UNLIMITED UINT64_MAX  // No step budget
+
+enum cpu_engine {
+    CPU_ENGINE_SWITCH,      // Portable switch dispatch
+    CPU_ENGINE_THREADED,    // Direct threaded code (GCC labels-as-values)
+    CPU_ENGINE_JIT,         // x86-64 basic-block JIT
+    CPU_ENGINE_SIMD,        // SoA lockstep lanes (data image batches only)
+    CPU_ENGINE_BLOCK,       // Portable interpreter over cached, chained basic blocks
+    CPU_ENGINE_AOT,         // Program translated to C by translator/ (make AOT=file.c)
+};
+
+#if defined(__GNUC__) && !defined(NO_THREADED_DISPATCH)
+#define HAVE_THREADED_DISPATCH 1
+#define CPU_ENGINE_DEFAULT CPU_ENGINE_THREADED
+#else
+#define CPU_ENGINE_DEFAULT CPU_ENGINE_SWITCH
+#endif
+
+#if defined(__x86_64__) && defined(__unix__) && !defined(NO_JIT)
+#define HAVE_JIT 1
+#define CPU_ENGINE_FASTEST CPU_ENGINE_JIT
+#else
+#define CPU_ENGINE_FASTEST CPU_ENGINE_DEFAULT
+#endif
+
 int cpu_init(cpu_t *cpu);
+int cpu_init_config(cpu_t *cpu, const struct cpu_config_st *config);
+int cpu_configure(cpu_t *cpu, const struct cpu_config_st *config);
+void cpu_get_config(const cpu_t *cpu, struct cpu_config_st *config);
+void cpu_release(cpu_t *cpu);
+int cpu_fork(cpu_t *child, const cpu_t *parent);
+int cpu_own_text(cpu_t *cpu);
+int cpu_own_data(cpu_t *cpu);
+int cpu_own_page(cpu_t *cpu, uint16_t addr);
+void cpu_data_read(const cpu_t *cpu, uint16_t *words);
+int cpu_data_write(cpu_t *cpu, const uint16_t *words, uint32_t count);
 int cpu_load_program(cpu_t *cpu, const char* filename);
+int cpu_load_data(cpu_t *cpu, const char* filename);
+int cpu_map_data(cpu_t *cpu, int fd, off_t offset);
+void cpu_decode(uop_t *uop, uint16_t instruction);
+int cpu_predecode(cpu_t *cpu);
+int cpu_fused_length(int dispatch);
+const char *cpu_fused_name(int dispatch);
+void cpu_invalidate(cpu_t *cpu);
+int cpu_write_inst(cpu_t *cpu, uint16_t addr, uint16_t instruction);
+void cpu_set_trace(cpu_t *cpu, struct trace_st *trace);
+void cpu_set_profile(cpu_t *cpu, struct profile_st *profile);
+void cpu_set_bus(cpu_t *cpu, struct bus_st *bus);
+void cpu_set_host(cpu_t *cpu, struct host_st *host);
+void cpu_set_replay(cpu_t *cpu, struct replay_st *replay);
+void cpu_set_debug(cpu_t *cpu, struct debug_st *debug);
+void cpu_hook_step(cpu_t *cpu);
 void cpu_exec(cpu_t *cpu);
+int cpu_exec_n(cpu_t *cpu, uint64_t max_steps);
+int cpu_exec_threaded(cpu_t *cpu, uint64_t max_steps);
+int cpu_exec_jit(cpu_t *cpu, uint64_t max_steps);
+int cpu_exec_blocks(cpu_t *cpu, uint64_t max_steps);
+int cpu_exec_aot(cpu_t *cpu, uint64_t max_steps);
+int cpu_run(cpu_t *cpu, int engine, uint64_t max_steps);
+void cpu_irq_raise(cpu_t *cpu, int line);
+int cpu_irq_update(cpu_t *cpu);
+uint16_t cpu_reti(cpu_t *cpu);
+int cpu_csr(cpu_t *cpu, const uop_t *uop, uint64_t steps);
+int cpu_cas(cpu_t *cpu, const uop_t *uop);
+int cpu_status(const cpu_t *cpu);
+int cpu_status_at(const cpu_t *cpu, uint16_t pc, const uint16_t *regs);
+const char *cpu_status_name(int status);
+int cpu_exit_code(const cpu_t *cpu);
+int cpu_engine_parse(const char *name);
+const char *cpu_engine_name(int engine);
 void cpu_dump(cpu_t *cpu);
 
 
@@ -0,0 +1,797 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "opcodes.h"
+#include "emulator.h"
+#include "debug.h"
+#include "replay.h"
+#include "gdb.h"
+
+// Signals in stop replies
+#define GDB_SIGINT 2
+#define GDB_SIGILL 4
+#define GDB_SIGTRAP 5
+#define GDB_SIGSEGV 11
+#define GDB_SIGXCPU 24
+
+enum gdb_reg {
+    GDB_REG_PC = NUM_REGISTERS,
+    GDB_REG_FLAGS,
+    GDB_REGS,
+};
+
+static const char s_target_xml[] =
+    "<?xml version=\"1.0\"?>"
+    "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+    "<target version=\"1.0\"><feature name=\"org.emulator.core\">"
+    "<reg name=\"gr0\" bitsize=\"16\" type=\"uint16\"/>"
+    "<reg name=\"gr1\" bitsize=\"16\" type=\"uint16\"/>"
+    "<reg name=\"gr2\" bitsize=\"16\" type=\"uint16\"/>"
+    "<reg name=\"gr3\" bitsize=\"16\" type=\"uint16\"/>"
+    "<reg name=\"gr4\" bitsize=\"16\" type=\"uint16\"/>"
+    "<reg name=\"gr5\" bitsize=\"16\" type=\"uint16\"/>"
+    "<reg name=\"gr6\" bitsize=\"16\" type=\"uint16\"/>"
+    "<reg name=\"gr7\" bitsize=\"16\" type=\"uint16\"/>"
+    "<reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/>"
+    "<reg name=\"flags\" bitsize=\"16\" type=\"uint16\"/>"
+    "</feature></target>";
+
+// Remove the socket at path if it is still the one bound as st
+static void gdb_unlink(const char *path, const struct stat *st)
+{
+    struct stat now;
+
+    if (lstat(path, &now) == 0 && now.st_dev == st->st_dev && now.st_ino == st->st_ino) {
+        unlink(path);
+    }
+}
+
+/*
+ * Accept one connection on a Unix socket at path. A stale socket left
+ * there is replaced, but any other file makes it fail rather than be
+ * deleted.
+ */
+static int gdb_accept(const char *path)
+{
+    struct sockaddr_un sun = { .sun_family = AF_UNIX };
+    struct stat st;
+    int fd, conn;
+
+    if (strlen(path) >= sizeof(sun.sun_path)) {
+        return -1;
+    }
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "Not a socket, refusing to replace it: %s\n", path);
+            return -1;
+        }
+        unlink(path);
+    }
+    strcpy(sun.sun_path, path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0) {
+        close(fd);
+        return -1;
+    }
+    if (lstat(path, &st) != 0 || listen(fd, 1) != 0) {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    fprintf(stderr, "Waiting for GDB on %s\n", path);
+    do {
+        conn = accept(fd, NULL, NULL);
+    } while (conn < 0 && errno == EINTR);
+    close(fd);
+    gdb_unlink(path, &st);
+    return conn;
+}
+
+/*
+ * Wait for GDB: addr is a Unix socket path, or "-" for stdin/stdout, which
+ * are then replaced by /dev/null and stderr for the rest of the program.
+ */
+struct gdb_st *gdb_open(const char *addr)
+{
+    struct gdb_st *gdb = (struct gdb_st *)malloc(sizeof(struct gdb_st));
+    if (!gdb) {
+        return NULL;
+    }
+
+    if (strcmp(addr, "-") == 0) {
+        int null = open("/dev/null", O_RDONLY);
+        fflush(stdout);
+        gdb->in = dup(STDIN_FILENO);
+        gdb->out = dup(STDOUT_FILENO);
+        if (null < 0 || gdb->in < 0 || gdb->out < 0
+            || dup2(null, STDIN_FILENO) < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            free(gdb);
+            return NULL;
+        }
+        close(null);
+    } else {
+        gdb->in = gdb->out = gdb_accept(addr);
+        if (gdb->in < 0) {
+            free(gdb);
+            return NULL;
+        }
+    }
+    // A vanished GDB shows up as a failed write
+    signal(SIGPIPE, SIG_IGN);
+
+    gdb->ack = 1;
+    gdb->exited = 0;
+    gdb->frontier = 0;
+    gdb->rpos = 0;
+    gdb->rlen = 0;
+    strcpy(gdb->stop, "S05");
+    return gdb;
+}
+
+void gdb_close(struct gdb_st *gdb)
+{
+    if (gdb) {
+        if (gdb->out != gdb->in) {
+            close(gdb->out);
+        }
+        close(gdb->in);
+        free(gdb);
+    }
+}
+
+static int gdb_getc(struct gdb_st *gdb)
+{
+    if (gdb->rpos == gdb->rlen) {
+        ssize_t n;
+        do {
+            n = read(gdb->in, gdb->rbuf, sizeof(gdb->rbuf));
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) {
+            return -1;
+        }
+        gdb->rpos = 0;
+        gdb->rlen = n;
+    }
+    return (uint8_t)gdb->rbuf[gdb->rpos++];
+}
+
+static int gdb_write(struct gdb_st *gdb, const char *bytes, size_t len)
+{
+    while (len) {
+        ssize_t n = write(gdb->out, bytes, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        bytes += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int hex_value(int c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Next packet into gdb->packet; returns its length, -1 when GDB went away
+static int gdb_recv(struct gdb_st *gdb)
+{
+    for (;;) {
+        int c, len = 0;
+        uint8_t sum = 0;
+
+        // Acks and a Ctrl-C that came too late are dropped
+        do {
+            c = gdb_getc(gdb);
+        } while (c >= 0 && c != '$');
+        while (c >= 0 && (c = gdb_getc(gdb)) != '#') {
+            if (len < GDB_PACKET_MAX) {
+                gdb->packet[len++] = c;
+            }
+            sum += c;
+        }
+        int hi = c < 0 ? -1 : gdb_getc(gdb);
+        int lo = hi < 0 ? -1 : gdb_getc(gdb);
+        if (lo < 0) {
+            return -1;
+        }
+        gdb->packet[len] = '\0';
+        if (!gdb->ack) {
+            return len;
+        }
+        if (hex_value(hi) << 4 == (sum & 0xF0) && hex_value(lo) == (sum & 0x0F)) {
+            return gdb_write(gdb, "+", 1) == 0 ? len : -1;
+        }
+        if (gdb_write(gdb, "-", 1) != 0) {
+            return -1;
+        }
+    }
+}
+
+static int gdb_send(struct gdb_st *gdb, const char *data)
+{
+    size_t len = strlen(data);
+    uint8_t sum = 0;
+    int c;
+
+    if (len > GDB_PACKET_MAX) {
+        len = GDB_PACKET_MAX;
+    }
+    for (size_t i = 0; i < len; i++) {
+        sum += (uint8_t)data[i];
+    }
+    gdb->frame[0] = '$';
+    memcpy(gdb->frame + 1, data, len);
+    sprintf(gdb->frame + 1 + len, "#%02x", sum);
+
+    do {
+        if (gdb_write(gdb, gdb->frame, len + 4) != 0) {
+            return -1;
+        }
+        if (!gdb->ack) {
+            return 0;
+        }
+        do {
+            c = gdb_getc(gdb);
+        } while (c >= 0 && c != '+' && c != '-');
+    } while (c == '-');
+    return c < 0 ? -1 : 0;
+}
+
+// Whether GDB sent Ctrl-C (or went away) while the program runs
+static int gdb_interrupted(struct gdb_st *gdb)
+{
+    struct pollfd pfd = { .fd = gdb->in, .events = POLLIN };
+
+    while (gdb->rpos < gdb->rlen || poll(&pfd, 1, 0) > 0) {
+        int c = gdb_getc(gdb);
+        if (c < 0 || c == 0x03) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static char *put_hex(char *p, uint32_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++) {
+        p += sprintf(p, "%02x", (value >> (8 * i)) & 0xFF);
+    }
+    return p;
+}
+
+// Little-endian value of the given size from hex; -1 when it is short
+static int get_hex(const char **p, int bytes, uint32_t *value)
+{
+    *value = 0;
+    for (int i = 0; i < bytes; i++) {
+        int hi = hex_value((*p)[0]);
+        int lo = hi < 0 ? -1 : hex_value((*p)[1]);
+        if (lo < 0) {
+            return -1;
+        }
+        *value |= (uint32_t)(hi << 4 | lo) << (8 * i);
+        *p += 2;
+    }
+    return 0;
+}
+
+static uint32_t gdb_reg_get(const cpu_t *cpu, int reg)
+{
+    switch (reg) {
+        case GDB_REG_PC: return 2u * cpu->pc;
+        case GDB_REG_FLAGS: return cpu->nf << 2 | cpu->zf << 1 | cpu->cf;
+        default: return cpu->regs[reg];
+    }
+}
+
+static void gdb_reg_set(cpu_t *cpu, int reg, uint32_t value)
+{
+    switch (reg) {
+        case GDB_REG_PC:
+            cpu->pc = (value >> 1) & cpu->mem_mask;
+            break;
+        case GDB_REG_FLAGS:
+            cpu->nf = (value >> 2) & 1;
+            cpu->zf = (value >> 1) & 1;
+            cpu->cf = value & 1;
+            break;
+        default:
+            cpu->regs[reg] = value;
+            break;
+    }
+}
+
+static int gdb_reg_bytes(int reg)
+{
+    return reg == GDB_REG_PC ? 4 : 2;
+}
+
+/*
+ * Word holding the byte at a GDB address: sets *data for data memory.
+ * Returns the word address, -1 outside both memories.
+ */
+static int32_t gdb_word(const cpu_t *cpu, uint32_t addr, int *data)
+{
+    *data = addr >= GDB_DATA_BASE;
+    uint32_t word = (addr - (*data ? GDB_DATA_BASE : 0)) >> 1;
+    return word < cpu->mem_words ? (int32_t)word : -1;
+}
+
+// m addr,length: as many bytes as can be read from addr
+static void gdb_read_memory(const cpu_t *cpu, const char *args, char *reply)
+{
+    char *end;
+    uint32_t addr = strtoul(args, &end, 16);
+    uint32_t len = *end == ',' ? strtoul(end + 1, NULL, 16) : 0;
+    char *p = reply;
+
+    *p = '\0';
+    if (len > GDB_PACKET_MAX / 2) {
+        len = GDB_PACKET_MAX / 2;
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        int data;
+        int32_t word = gdb_word(cpu, addr + i, &data);
+        if (word < 0) {
+            break;
+        }
+        uint16_t value = data ? cpu_data_word(cpu, word) : cpu->mem_inst[word];
+        p = put_hex(p, value >> (8 * ((addr + i) & 1)), 1);
+    }
+    if (p == reply && len) {
+        strcpy(reply, "E01");
+    }
+}
+
+// M addr,length:bytes
+static void gdb_write_memory(cpu_t *cpu, const char *args, char *reply)
+{
+    char *end;
+    uint32_t addr = strtoul(args, &end, 16);
+    uint32_t len = *end == ',' ? strtoul(end + 1, &end, 16) : 0;
+    const char *p = strchr(end, ':');
+
+    strcpy(reply, "E01");
+    if (!p++) {
+        return;
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        uint32_t byte;
+        int data;
+        int32_t word = gdb_word(cpu, addr + i, &data);
+        if (word < 0 || get_hex(&p, 1, &byte) != 0) {
+            return;
+        }
+        int shift = 8 * ((addr + i) & 1);
+        if (data) {
+            if (cpu_own_page(cpu, word) != 0) {
+                return;
+            }
+            cpu_data_word(cpu, word) = (cpu_data_word(cpu, word) & ~(0xFF << shift)) | byte << shift;
+        } else {
+            uint16_t inst = (cpu->mem_inst[word] & ~(0xFF << shift)) | byte << shift;
+            if (cpu_write_inst(cpu, word, inst) != 0) {
+                return;
+            }
+        }
+    }
+    strcpy(reply, "OK");
+}
+
+/*
+ * Z/z type,addr,kind: software and hardware breakpoints are the same;
+ * watchpoints (2 write, 3 read, 4 access) cover the data words that the
+ * kind bytes from addr overlap.
+ */
+static void gdb_breakpoint(cpu_t *cpu, const char *packet, char *reply)
+{
+    static const int watch_type[] = { [2] = WATCH_WRITE, [3] = WATCH_READ, [4] = WATCH_ACCESS };
+    char *end;
+    int type = packet[1] - '0';
+    uint32_t addr = strtoul(packet + 3, &end, 16);
+    uint32_t len = *end == ',' ? strtoul(end + 1, NULL, 16) : 0;
+
+    reply[0] = '\0';
+    if (type < 0 || type > 4 || packet[2] != ',') {
+        return;
+    }
+    if (type >= 2) {
+        uint32_t first = (addr - GDB_DATA_BASE) >> 1;
+        uint32_t words = len ? ((addr + len - 1 - GDB_DATA_BASE) >> 1) - first + 1 : 0;
+        if (addr < GDB_DATA_BASE || first + words > MEMORY_MAX) {
+            strcpy(reply, "E01");
+        } else if (packet[0] == 'Z') {
+            strcpy(reply, cpu_watch_insert(cpu, first, words, watch_type[type]) == 0 ? "OK" : "E01");
+        } else {
+            cpu_watch_remove(cpu, first, words, watch_type[type]);
+            strcpy(reply, "OK");
+        }
+    } else if (addr >= GDB_DATA_BASE || (addr >> 1) >= cpu->mem_words) {
+        strcpy(reply, "E01");
+    } else if (packet[0] == 'Z') {
+        strcpy(reply, cpu_break_insert(cpu, addr >> 1) == 0 ? "OK" : "E01");
+    } else {
+        cpu_break_remove(cpu, addr >> 1);
+        strcpy(reply, "OK");
+    }
+}
+
+// qXfer:features:read:annex:offset,length
+static void gdb_read_features(const char *args, char *reply)
+{
+    const char *annex = "target.xml:";
+    size_t size = sizeof(s_target_xml) - 1;
+    char *end;
+
+    if (strncmp(args, annex, strlen(annex)) != 0) {
+        strcpy(reply, "E00");
+        return;
+    }
+    unsigned long offset = strtoul(args + strlen(annex), &end, 16);
+    unsigned long len = *end == ',' ? strtoul(end + 1, NULL, 16) : 0;
+    if (offset > size) {
+        strcpy(reply, "E01");
+        return;
+    }
+    if (len > GDB_PACKET_MAX - 1) {
+        len = GDB_PACKET_MAX - 1;
+    }
+    if (len > size - offset) {
+        len = size - offset;
+    }
+    reply[0] = offset + len < size ? 'm' : 'l';
+    memcpy(reply + 1, s_target_xml + offset, len);
+    reply[1 + len] = '\0';
+}
+
+/*
+ * Run up to n instructions. Whatever lies before gdb->frontier was already
+ * run once and is muted, like replay_seek(); so is the rest of it.
+ */
+static int gdb_run(struct gdb_st *gdb, cpu_t *cpu, int engine, uint64_t n)
+{
+    struct replay_st *replay = cpu->replay;
+    uint64_t target = cpu->steps + n;
+    int status = CPU_BUDGET;
+
+    if (replay && cpu->steps < gdb->frontier) {
+        replay->seeking = 1;
+        status = cpu_run(cpu, engine, (target < gdb->frontier ? target : gdb->frontier) - cpu->steps);
+        replay->seeking = 0;
+    }
+    if (status == CPU_BUDGET && cpu->steps < target) {
+        status = cpu_run(cpu, engine, target - cpu->steps);
+    }
+    if (cpu->steps > gdb->frontier) {
+        gdb->frontier = cpu->steps;
+    }
+    return status;
+}
+
+static void gdb_stopped(struct gdb_st *gdb, const cpu_t *cpu, int status, int signal)
+{
+    if (status == CPU_HALTED) {
+        gdb->exited = 1;
+        snprintf(gdb->stop, sizeof(gdb->stop), "W%02x", cpu_exit_code(cpu) & 0xFF);
+        return;
+    }
+    if (status == CPU_FAULT) {
+        // A PC or LOAD/STORE outside memory, otherwise an instruction that cannot run
+        uint16_t pc = cpu->pc & cpu->mem_mask;
+        uint8_t opcode = pc < cpu->mem_words ? cpu->mem_inst[pc] >> 11 : LOAD;
+        signal = opcode == LOAD || opcode == STORE ? GDB_SIGSEGV : GDB_SIGILL;
+    }
+    gdb->exited = 0;
+    snprintf(gdb->stop, sizeof(gdb->stop), "S%02x", signal);
+}
+
+// Stop reply for a watchpoint hit by a LOAD (read) or STORE (write) of addr
+static void gdb_watch_stop(struct gdb_st *gdb, int type, uint16_t addr)
+{
+    gdb->exited = 0;
+    snprintf(gdb->stop, sizeof(gdb->stop), "T%02x%s:%x;", GDB_SIGTRAP,
+             type & WATCH_WRITE ? "watch" : "rwatch", GDB_DATA_BASE + 2 * addr);
+}
+
+/*
+ * At a watched LOAD/STORE: GDB expects a watchpoint to stop after the
+ * access, so run it before reporting the hit.
+ */
+static void gdb_watch(struct gdb_st *gdb, cpu_t *cpu, int engine)
+{
+    uint16_t addr;
+    int type = cpu_watch_hit(cpu, &addr);
+    uint64_t steps = cpu->steps;
+    int status = gdb_run(gdb, cpu, engine, 1);
+
+    if (cpu->steps == steps) {
+        gdb_stopped(gdb, cpu, status, GDB_SIGTRAP);
+    } else {
+        gdb_watch_stop(gdb, type, addr);
+    }
+}
+
+// c or s: resume until a stop, the step budget, or Ctrl-C
+static void gdb_resume(struct gdb_st *gdb, cpu_t *cpu, int engine, uint64_t end, int step)
+{
+    int status;
+
+    if (gdb->exited) {
+        return;     // Report the exit again
+    }
+    if (cpu_status(cpu) == CPU_WATCH) {
+        gdb_watch(gdb, cpu, engine);
+        return;
+    }
+    if (step) {
+        status = gdb_run(gdb, cpu, engine, 1);
+        gdb_stopped(gdb, cpu, status, GDB_SIGTRAP);
+        return;
+    }
+    for (;;) {
+        if (cpu->steps >= end) {
+            gdb_stopped(gdb, cpu, CPU_BUDGET, GDB_SIGXCPU);
+            return;
+        }
+        uint64_t n = end - cpu->steps < GDB_SLICE ? end - cpu->steps : GDB_SLICE;
+        status = gdb_run(gdb, cpu, engine, n);
+        if (status == CPU_WATCH) {
+            gdb_watch(gdb, cpu, engine);
+            return;
+        }
+        if (status != CPU_BUDGET) {
+            gdb_stopped(gdb, cpu, status, GDB_SIGTRAP);
+            return;
+        }
+        if (gdb_interrupted(gdb)) {
+            gdb_stopped(gdb, cpu, status, GDB_SIGINT);
+            return;
+        }
+    }
+}
+
+/*
+ * Seek, then take what cpu_run() takes before the next instruction (an
+ * interrupt entry), so the CPU looks as it did when it stopped there.
+ */
+static void gdb_seek(cpu_t *cpu, int engine, uint64_t steps)
+{
+    replay_seek(cpu, engine, steps);
+    cpu_run(cpu, engine, 0);
+}
+
+/*
+ * bc: go back to the last breakpoint or watchpoint stop before the current
+ * instruction count; a watchpoint stops before its access. Each checkpoint
+ * interval, newest first, is re-run to find the last stop in it. Without
+ * one, stops at the start of the log.
+ */
+static void gdb_reverse_continue(struct gdb_st *gdb, cpu_t *cpu, int engine)
+{
+    struct replay_st *replay = cpu->replay;
+    uint64_t hi = cpu->steps;
+
+    for (int i = replay->checkpoints - 1; i >= 0; i--) {
+        uint64_t lo = replay->checkpoint[i].cpu.steps;
+        uint64_t hit = 0;
+        int found = 0;
+
+        if (lo >= hi) {
+            continue;
+        }
+        replay_seek(cpu, engine, lo);
+        replay->seeking = 1;
+        while (cpu->steps < hi) {
+            cpu_run(cpu, engine, 0);
+            int stop = cpu_status(cpu);
+            if (stop == CPU_BREAK || stop == CPU_WATCH) {
+                hit = cpu->steps;
+                found = 1;
+            }
+            int status = cpu_run(cpu, engine, hi - cpu->steps);
+            if (status == CPU_HALTED || status == CPU_FAULT) {
+                break;
+            }
+        }
+        replay->seeking = 0;
+        if (found) {
+            uint16_t addr;
+            gdb_seek(cpu, engine, hit);
+            int type = cpu_watch_hit(cpu, &addr);
+            if (cpu_status(cpu) == CPU_WATCH) {
+                gdb_watch_stop(gdb, type, addr);
+            } else {
+                gdb_stopped(gdb, cpu, CPU_BREAK, GDB_SIGTRAP);
+            }
+            return;
+        }
+        hi = lo;
+    }
+    if (replay->checkpoints) {
+        gdb_seek(cpu, engine, replay->checkpoint[0].cpu.steps);
+    }
+    gdb->exited = 0;
+    strcpy(gdb->stop, "T05replaylog:begin;");
+}
+
+// bs: back one instruction, or report the start of the log
+static void gdb_reverse_step(struct gdb_st *gdb, cpu_t *cpu, int engine)
+{
+    struct replay_st *replay = cpu->replay;
+
+    if (!replay->checkpoints || cpu->steps <= replay->checkpoint[0].cpu.steps) {
+        gdb->exited = 0;
+        strcpy(gdb->stop, "T05replaylog:begin;");
+        return;
+    }
+    gdb_seek(cpu, engine, cpu->steps - 1);
+    gdb_stopped(gdb, cpu, CPU_BUDGET, GDB_SIGTRAP);
+}
+
+static void gdb_query(const cpu_t *cpu, const char *packet, char *reply)
+{
+    reply[0] = '\0';
+    if (strncmp(packet, "qSupported", 10) == 0) {
+        sprintf(reply, "PacketSize=%x;qXfer:features:read+;QStartNoAckMode+%s",
+                GDB_PACKET_MAX, cpu->replay ? ";ReverseStep+;ReverseContinue+" : "");
+    } else if (strncmp(packet, "qXfer:features:read:", 20) == 0) {
+        gdb_read_features(packet + 20, reply);
+    } else if (strcmp(packet, "qAttached") == 0) {
+        strcpy(reply, "1");
+    } else if (strcmp(packet, "qC") == 0) {
+        strcpy(reply, "QC1");
+    } else if (strcmp(packet, "qfThreadInfo") == 0) {
+        strcpy(reply, "m1");
+    } else if (strcmp(packet, "qsThreadInfo") == 0) {
+        strcpy(reply, "l");
+    } else if (strcmp(packet, "QStartNoAckMode") == 0) {
+        strcpy(reply, "OK");
+    }
+}
+
+/*
+ * Serve GDB until it detaches or kills the program. max_steps bounds the
+ * instructions run in the session; a continue that reaches it stops with
+ * SIGXCPU. Returns the enum gdb_end.
+ */
+int gdb_serve(struct gdb_st *gdb, cpu_t *cpu, int engine, uint64_t max_steps)
+{
+    uint64_t end = max_steps > CPU_STEPS_UNLIMITED - cpu->steps ? CPU_STEPS_UNLIMITED : cpu->steps + max_steps;
+    char reply[GDB_PACKET_MAX + 1];
+
+    gdb->frontier = cpu->steps;
+    for (;;) {
+        if (gdb_recv(gdb) < 0) {
+            return GDB_KILLED;
+        }
+        const char *packet = gdb->packet;
+        const char *p;
+        uint32_t value;
+        char *q;
+
+        reply[0] = '\0';
+        switch (packet[0]) {
+            case '?':
+                strcpy(reply, gdb->stop);
+                break;
+            case 'g':
+                q = reply;
+                for (int reg = 0; reg < GDB_REGS; reg++) {
+                    q = put_hex(q, gdb_reg_get(cpu, reg), gdb_reg_bytes(reg));
+                }
+                break;
+            case 'G':
+                p = packet + 1;
+                strcpy(reply, "OK");
+                for (int reg = 0; reg < GDB_REGS; reg++) {
+                    if (get_hex(&p, gdb_reg_bytes(reg), &value) != 0) {
+                        strcpy(reply, "E01");
+                        break;
+                    }
+                    gdb_reg_set(cpu, reg, value);
+                }
+                break;
+            case 'p': {
+                unsigned long reg = strtoul(packet + 1, NULL, 16);
+                if (reg < GDB_REGS) {
+                    put_hex(reply, gdb_reg_get(cpu, reg), gdb_reg_bytes(reg));
+                } else {
+                    strcpy(reply, "E01");
+                }
+                break;
+            }
+            case 'P': {
+                unsigned long reg = strtoul(packet + 1, &q, 16);
+                p = q + 1;
+                if (reg < GDB_REGS && *q == '=' && get_hex(&p, gdb_reg_bytes(reg), &value) == 0) {
+                    gdb_reg_set(cpu, reg, value);
+                    strcpy(reply, "OK");
+                } else {
+                    strcpy(reply, "E01");
+                }
+                break;
+            }
+            case 'm':
+                gdb_read_memory(cpu, packet + 1, reply);
+                break;
+            case 'M':
+                gdb_write_memory(cpu, packet + 1, reply);
+                break;
+            case 'c':
+            case 's':
+                if (packet[1]) {
+                    cpu->pc = (strtoul(packet + 1, NULL, 16) >> 1) & cpu->mem_mask;
+                }
+                gdb_resume(gdb, cpu, engine, end, packet[0] == 's');
+                strcpy(reply, gdb->stop);
+                break;
+            case 'b':
+                if (!cpu->replay || (packet[1] != 's' && packet[1] != 'c')) {
+                    break;
+                }
+                if (packet[1] == 's') {
+                    gdb_reverse_step(gdb, cpu, engine);
+                } else {
+                    gdb_reverse_continue(gdb, cpu, engine);
+                }
+                strcpy(reply, gdb->stop);
+                break;
+            case 'Z':
+            case 'z':
+                gdb_breakpoint(cpu, packet, reply);
+                break;
+            case 'q':
+            case 'Q':
+                gdb_query(cpu, packet, reply);
+                break;
+            case 'H':
+            case 'T':
+                strcpy(reply, "OK");
+                break;
+            case 'D':
+                gdb_send(gdb, "OK");
+                return GDB_DETACHED;
+            case 'k':
+                return GDB_KILLED;
+            case 'v':
+                if (strcmp(packet, "vKill") == 0 || strncmp(packet, "vKill;", 6) == 0) {
+                    gdb_send(gdb, "OK");
+                    return GDB_KILLED;
+                }
+                break;
+            default:
+                break;  // Unsupported: empty reply
+        }
+        if (gdb_send(gdb, reply) != 0) {
+            return GDB_KILLED;
+        }
+        if (strcmp(packet, "QStartNoAckMode") == 0) {
+            gdb->ack = 0;
+        }
+    }
+}
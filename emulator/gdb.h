@@ -0,0 +1,50 @@
+#ifndef GDB_H_20251117_
+#define GDB_H_20251117_
+
+#include <stdint.h>
+
+#include "emulator.h"
+
+#define GDB_PACKET_MAX 4096         // Largest packet payload, both directions
+#define GDB_SLICE (1u << 20)        // Instructions run between checks for Ctrl-C
+#define GDB_DATA_BASE 0x20000       // GDB address of data memory word 0
+
+/*
+ * GDB remote serial protocol stub. GDB connects over a Unix socket or
+ * through the emulator's stdin/stdout ("target remote | emulator --gdb=-
+ * prog.bin"); in that mode the program reads an empty input and its
+ * output goes to stderr.
+ * Registers: gr0-gr7 (16 bits), pc (32 bits, a byte address: 2 * PC) and
+ * flags (16 bits, NF << 2 | ZF << 1 | CF), little-endian, described to
+ * GDB by target.xml. Memory is byte addressed, little-endian words:
+ * instruction memory from 0, data memory from GDB_DATA_BASE. Breakpoints
+ * (Z0/Z1) and watchpoints on data memory (Z2-Z4) use the debug set, so
+ * need cpu_set_debug(); a watchpoint reports after its access. With a
+ * replay log attached, reverse step and continue (bs/bc) seek through its
+ * checkpoints; execution that GDB re-runs after going back is muted like
+ * replay_seek().
+ */
+struct gdb_st {
+    int in;                         // Connection from GDB
+    int out;                        // Connection to GDB, the same socket or stdout
+    uint8_t ack;                    // Acknowledge packets, until QStartNoAckMode
+    uint8_t exited;                 // The program halted and GDB was told
+    uint64_t frontier;              // Furthest cpu->steps reached
+    char stop[32];                  // Last stop reply, for '?'
+    uint32_t rpos;                  // Next byte in rbuf
+    uint32_t rlen;                  // Bytes in rbuf
+    char rbuf[GDB_PACKET_MAX];
+    char packet[GDB_PACKET_MAX + 1];
+    char frame[GDB_PACKET_MAX + 4];
+};
+
+enum gdb_end {
+    GDB_DETACHED,                   // D: the program should run on
+    GDB_KILLED,                     // k, vKill, or the connection closed
+};
+
+struct gdb_st *gdb_open(const char *addr);
+void gdb_close(struct gdb_st *gdb);
+int gdb_serve(struct gdb_st *gdb, cpu_t *cpu, int engine, uint64_t max_steps);
+
+#endif  // GDB_H_20251117_
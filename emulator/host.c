@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "opcodes.h"
+#include "emulator.h"
+#include "host.h"
+#include "replay.h"
+
+struct host_st *host_create(FILE *out, FILE *in)
+{
+    struct host_st *host = (struct host_st *)malloc(sizeof(struct host_st));
+    if (!host) {
+        return NULL;
+    }
+    host->out = out;
+    host->in = in;
+    host->line = out && isatty(fileno(out));
+    host->len = 0;
+    return host;
+}
+
+void host_flush(struct host_st *host)
+{
+    if (host->len) {
+        if (host->out) {
+            fwrite(host->buf, 1, host->len, host->out);
+            fflush(host->out);
+        }
+        host->len = 0;
+    }
+}
+
+void host_destroy(struct host_st *host)
+{
+    if (host) {
+        host_flush(host);
+        free(host);
+    }
+}
+
+static void host_put(struct host_st *host, const char *bytes, uint32_t n)
+{
+    while (n) {
+        uint32_t chunk = HOST_BUFFER_SIZE - host->len;
+        if (chunk > n) {
+            chunk = n;
+        }
+        memcpy(host->buf + host->len, bytes, chunk);
+        host->len += chunk;
+        bytes += chunk;
+        n -= chunk;
+        if (host->len == HOST_BUFFER_SIZE) {
+            host_flush(host);
+        }
+    }
+}
+
+// Decimal number from the input, 0xFFFF at end of input or on a non-digit
+static uint16_t host_get_number(struct host_st *host)
+{
+    int c;
+    int negative = 0;
+    int digits = 0;
+    uint16_t value = 0;
+
+    if (!host->in) {
+        return 0xFFFF;
+    }
+    do {
+        c = getc(host->in);
+    } while (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+    if (c == '-') {
+        negative = 1;
+        c = getc(host->in);
+    }
+    while (c >= '0' && c <= '9') {
+        value = value * 10 + (c - '0');
+        digits++;
+        c = getc(host->in);
+    }
+    if (digits && c != EOF) {
+        ungetc(c, host->in);
+    }
+    if (!digits) {
+        return 0xFFFF;
+    }
+    return negative ? -value : value;
+}
+
+/*
+ * Whether the TRAP in uop can run with these registers: CPU_BUDGET when it
+ * would complete, CPU_HALTED for TRAP_EXIT and CPU_FAULT otherwise.
+ */
+int cpu_trap_status(const cpu_t *cpu, const uop_t *uop, const uint16_t *regs)
+{
+    if (uop->imm == TRAP_EXIT) {
+        return CPU_HALTED;
+    }
+    if (!cpu->host) {
+        return CPU_FAULT;
+    }
+    switch (uop->imm) {
+        case TRAP_PUTC:
+        case TRAP_PUTN:
+        case TRAP_GETN:
+            return CPU_BUDGET;
+        case TRAP_WRITE: {
+            uint32_t end = (uint32_t)regs[uop->r1] + regs[(uop->r1 + 1) & REGISTER_MASK];
+            return !cpu_checked(cpu) || end <= cpu->mem_words ? CPU_BUDGET : CPU_FAULT;
+        }
+        default:
+            return CPU_FAULT;
+    }
+}
+
+/*
+ * Run the TRAP in uop. Returns 0 when it retired, -1 to stop at it:
+ * TRAP_EXIT, or a call cpu_trap_status() reports as a fault.
+ */
+int cpu_trap(cpu_t *cpu, const uop_t *uop)
+{
+    struct host_st *host = cpu->host;
+    uint16_t *regs = cpu->regs;
+    char text[8];
+    int n;
+
+    if (cpu_trap_status(cpu, uop, regs) != CPU_BUDGET) {
+        return -1;
+    }
+    if (cpu_replay_muted(cpu) && uop->imm != TRAP_GETN) {
+        return 0;
+    }
+
+    switch (uop->imm) {
+        case TRAP_PUTC:
+            text[0] = (char)regs[uop->r1];
+            host_put(host, text, 1);
+            if (host->line && text[0] == '\n') {
+                host_flush(host);
+            }
+            break;
+        case TRAP_PUTN:
+            n = snprintf(text, sizeof(text), "%u", regs[uop->r1]);
+            host_put(host, text, n);
+            break;
+        case TRAP_GETN:
+            if (cpu->replay && replay_input(cpu->replay, REPLAY_GETN, 0, &regs[uop->r1])) {
+                break;
+            }
+            // Prompts written so far must be visible before blocking on input
+            host_flush(host);
+            regs[uop->r1] = host_get_number(host);
+            if (cpu->replay) {
+                replay_record(cpu->replay, REPLAY_GETN, 0, regs[uop->r1]);
+            }
+            break;
+        case TRAP_WRITE: {
+            uint16_t addr = regs[uop->r1];
+            uint16_t count = regs[(uop->r1 + 1) & REGISTER_MASK];
+            int newline = 0;
+
+            while (count) {
+                uint32_t chunk = HOST_BUFFER_SIZE - host->len;
+                if (chunk > count) {
+                    chunk = count;
+                }
+                for (uint32_t i = 0; i < chunk; i++) {
+                    char c = (char)cpu_data_word(cpu, (uint16_t)(addr + i) & cpu->mem_mask);
+                    host->buf[host->len + i] = c;
+                    newline |= c == '\n';
+                }
+                host->len += chunk;
+                addr += chunk;
+                count -= chunk;
+                if (host->len == HOST_BUFFER_SIZE) {
+                    host_flush(host);
+                }
+            }
+            if (host->line && newline) {
+                host_flush(host);
+            }
+            break;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef HOST_H_20251117_
+#define HOST_H_20251117_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "emulator.h"
+
+#define HOST_BUFFER_SIZE 65536  // Output bytes held before a write
+
+/*
+ * Host side of the TRAP calls (TRAP_VECTORS in emulator.h). Guest output
+ * collects in buf and reaches the stream in one fwrite when the buffer
+ * fills, before reading input, on host_flush() and on host_destroy(), so
+ * a program printing one character at a time costs no syscall per
+ * character. On a terminal a newline also flushes. Other writers to the
+ * same stream (cpu_dump, the console device) are only ordered against
+ * guest output at those flush points. Forks share their parent's host;
+ * it is not thread-safe.
+ */
+struct host_st {
+    FILE *out;
+    FILE *in;
+    uint8_t line;                       // Flush at each newline (out is a terminal)
+    uint32_t len;                       // Bytes in buf
+    char buf[HOST_BUFFER_SIZE];
+};
+
+struct host_st *host_create(FILE *out, FILE *in);
+void host_flush(struct host_st *host);
+void host_destroy(struct host_st *host);
+int cpu_trap(cpu_t *cpu, const uop_t *uop);
+int cpu_trap_status(const cpu_t *cpu, const uop_t *uop, const uint16_t *regs);
+
+#endif  // HOST_H_20251117_
@@ -0,0 +1,109 @@
+#include <stdio.h>
+
+#include "opcodes.h"
+#include "emulator.h"
+#include "replay.h"
+
+// Raise an interrupt line; it is taken at the next cpu_run() check
+void cpu_irq_raise(cpu_t *cpu, int line)
+{
+    if (cpu->replay && replay_irq(cpu->replay, cpu, line)) {
+        return;     // Replaying: the log raises it at the recorded step
+    }
+    cpu->irq.pending |= 1 << (line & (IRQ_LINES - 1));
+}
+
+/*
+ * Raise the timer line when its deadline has passed, then take the lowest
+ * pending line if interrupts are enabled. Returns 1 when the CPU entered a
+ * handler.
+ */
+int cpu_irq_update(cpu_t *cpu)
+{
+    struct cpu_irq_st *irq = &cpu->irq;
+
+    if (irq->period && cpu->steps >= irq->next) {
+        irq->pending |= 1 << IRQ_TIMER;
+        irq->next = cpu->steps + irq->period;
+    }
+
+    uint8_t ready = irq->pending & irq->mask;
+    if (!irq->ie || !ready) {
+        return 0;
+    }
+
+    int line = __builtin_ctz(ready);
+    uint16_t entry = (irq->vectors + line) & cpu->mem_mask;
+
+    irq->pending &= ~(1 << line);
+    irq->epc = cpu->pc;
+    irq->eflags = cpu->nf << 2 | cpu->zf << 1 | cpu->cf;
+    irq->ie = 0;
+    // A table outside bounds-checked data memory sends the PC out of range
+    cpu->pc = entry < cpu->mem_words ? cpu_data_word(cpu, entry) & cpu->mem_mask : cpu->mem_mask;
+    return 1;
+}
+
+// RETI: restore the flags, enable interrupts and return the PC to resume at
+uint16_t cpu_reti(cpu_t *cpu)
+{
+    struct cpu_irq_st *irq = &cpu->irq;
+
+    cpu->nf = (irq->eflags >> 2) & 1;
+    cpu->zf = (irq->eflags >> 1) & 1;
+    cpu->cf = irq->eflags & 1;
+    irq->ie = 1;
+    // Another line may be waiting; the engine stops so cpu_run() can take it
+    irq->stop = 1;
+    return irq->epc;
+}
+
+/*
+ * CSR: read or write a control register. steps is cpu->steps once this
+ * instruction has retired. Returns 1 after a write: the engine must stop
+ * after this instruction so cpu_run() sees the new interrupt state.
+ */
+int cpu_csr(cpu_t *cpu, const uop_t *uop, uint64_t steps)
+{
+    struct cpu_irq_st *irq = &cpu->irq;
+    uint16_t *reg = &cpu->regs[uop->r1];
+    int write = uop->imm >> 4;
+
+    if (!write) {
+        switch (uop->imm & 0x0F) {
+            case CSR_STATUS: *reg = irq->ie; break;
+            case CSR_EPC: *reg = irq->epc; break;
+            case CSR_EFLAGS: *reg = irq->eflags; break;
+            case CSR_VECTORS: *reg = irq->vectors; break;
+            case CSR_MASK: *reg = irq->mask; break;
+            case CSR_PENDING: *reg = irq->pending; break;
+            case CSR_TIMER: *reg = (uint16_t)irq->period; break;
+            case CSR_TIMER_HI: *reg = (uint16_t)(irq->period >> 16); break;
+            case CSR_CORE: *reg = cpu->core; break;
+            case CSR_CORES: *reg = cpu->cores; break;
+            default: *reg = 0; break;
+        }
+        return 0;
+    }
+
+    switch (uop->imm & 0x0F) {
+        case CSR_STATUS: irq->ie = *reg & 1; break;
+        case CSR_EPC: irq->epc = *reg; break;
+        case CSR_EFLAGS: irq->eflags = *reg & 0x07; break;
+        case CSR_VECTORS: irq->vectors = *reg; break;
+        case CSR_MASK: irq->mask = (uint8_t)*reg; break;
+        case CSR_PENDING: irq->pending &= ~*reg; break;
+        case CSR_TIMER:
+            irq->period = (irq->period & 0xFFFF0000) | *reg;
+            irq->next = steps + irq->period;
+            break;
+        case CSR_TIMER_HI:
+            irq->period = (irq->period & 0xFFFF) | (uint32_t)*reg << 16;
+            irq->next = steps + irq->period;
+            break;
+        default:
+            break;
+    }
+    irq->stop = 1;
+    return 1;
+}
@@ -0,0 +1,738 @@
+#define _GNU_SOURCE         // memfd_create()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "opcodes.h"
+#include "emulator.h"
+#include "jit.h"
+
+#ifdef HAVE_JIT
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*
+ * x86-64 basic-block JIT.
+ * Guest state lives in host registers while translated code runs:
+ *   gr0-gr7 -> r8d-r15d (zero-extended 16-bit values)
+ *   NF -> ebx, ZF -> ebp, CF -> ecx (0 or 1)
+ *   rdi -> struct jit_state_st, eax/edx scratch
+ *   rsi -> mem_data: the words of each data page, then its pages[]
+ * Every block ends with the next PC in eax and jumps to the dispatch stub,
+ * which chains straight into the translated successor or leaves to C when
+ * there is none (not yet translated, HALT, TRAP or an unknown opcode) or
+ * when fewer than JIT_BLOCK_MAX steps of the budget are left; C finishes
+ * that remainder in the interpreter so the budget is exact.
+ * With bounds-checked memory the dispatch table covers every 16-bit PC and
+ * has no blocks past the end. When a LOAD/STORE address can reach past
+ * cpu->data_limit (bounds checks or device windows), it is compared against
+ * that limit and leaves with JIT_SLOW set in eax; C then runs that one
+ * instruction in the interpreter, which calls the device or faults. A
+ * STORE to a data page another CPU still shares leaves the same way, and
+ * the interpreter copies the page. TRAP,
+ * RETI, CSR and CAS run the same way; RETI and CSR writes end the run. Blocks
+ * end before a breakpoint, where C stops.
+ * No page is ever writable and executable at once: the code buffer is a
+ * memfd mapped twice, read/write for emitting and read/execute for running.
+ * Code only jumps relative within the buffer, so it is emitted through the
+ * first view; absolute addresses (enter, blocks[]) point into the second.
+ */
+
+enum {
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+};
+
+#define HOST_REG(r) (8 + (r))   // r8d-r15d
+#define HOST_NF RBX
+#define HOST_ZF RBP
+#define HOST_CF RCX
+
+#define JIT_SLOW 0x10000        // Exit flag: stopped at a LOAD/STORE for the interpreter
+
+// STORE compares a page's refs as the dword it points at
+_Static_assert(offsetof(struct cpu_page_st, refs) == 0 && sizeof(atomic_int) == 4
+               && offsetof(struct cpu_page_st, words) < 0x80, "page layout");
+
+struct jit_state_st {
+    uint32_t regs[NUM_REGISTERS];
+    uint32_t nf;
+    uint32_t zf;
+    uint32_t cf;
+    uint32_t pc;
+    uint64_t steps;
+    uint64_t limit;     // Last steps value that may still enter a block
+    struct cpu_stats_st *stats;
+};
+
+typedef uint32_t (*jit_enter_fn)(struct jit_state_st *state, uint16_t **mem_data, const void *block);
+
+struct jit_st {
+    uint8_t *mem;                       // Code buffer, read/write view
+    uint8_t *exec;                      // The same pages, read/execute view
+    size_t used;                        // Bytes emitted so far
+    size_t stubs_end;                   // Start of the block area
+    jit_enter_fn enter;                 // Entry trampoline
+    uint8_t *dispatch;                  // Chain to blocks[eax] or exit
+    uint8_t *exit;                      // Spill guest state and return eax
+    uint32_t entries;                   // Dispatch table size, mem_mask + 1
+    const void **blocks;                // Translated block per start PC
+};
+
+// Executable address of p in the read/write view
+static const void *jit_code(const struct jit_st *jit, const uint8_t *p)
+{
+    return jit->exec + (p - jit->mem);
+}
+
+static void emit8(struct jit_st *jit, uint8_t b)
+{
+    jit->mem[jit->used++] = b;
+}
+
+static void emit32(struct jit_st *jit, uint32_t v)
+{
+    memcpy(&jit->mem[jit->used], &v, sizeof(v));
+    jit->used += sizeof(v);
+}
+
+static void emit64(struct jit_st *jit, uint64_t v)
+{
+    memcpy(&jit->mem[jit->used], &v, sizeof(v));
+    jit->used += sizeof(v);
+}
+
+static void emit_rex(struct jit_st *jit, int w, int reg, int rm)
+{
+    uint8_t rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+    if (rex != 0x40) {
+        emit8(jit, rex);
+    }
+}
+
+// <op> rm, reg (register direct)
+static void emit_rr(struct jit_st *jit, uint8_t op, int reg, int rm)
+{
+    emit_rex(jit, 0, reg, rm);
+    emit8(jit, op);
+    emit8(jit, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// 0F <op> reg, rm (movzx/movsx)
+static void emit_0f_rr(struct jit_st *jit, uint8_t op, int reg, int rm)
+{
+    emit_rex(jit, 0, reg, rm);
+    emit8(jit, 0x0F);
+    emit8(jit, op);
+    emit8(jit, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+static void emit_mov(struct jit_st *jit, int dst, int src)
+{
+    emit_rr(jit, 0x89, src, dst);
+}
+
+static void emit_movzx16(struct jit_st *jit, int dst, int src)
+{
+    emit_0f_rr(jit, 0xB7, dst, src);
+}
+
+static void emit_mov_imm(struct jit_st *jit, int dst, uint32_t imm)
+{
+    emit_rex(jit, 0, 0, dst);
+    emit8(jit, 0xB8 | (dst & 7));
+    emit32(jit, imm);
+}
+
+// 81 /ext rm, imm32
+static void emit_alu_imm(struct jit_st *jit, int ext, int dst, uint32_t imm)
+{
+    emit_rex(jit, 0, 0, dst);
+    emit8(jit, 0x81);
+    emit8(jit, 0xC0 | ext << 3 | (dst & 7));
+    emit32(jit, imm);
+}
+
+// C1 /ext rm, imm8
+static void emit_shift_imm(struct jit_st *jit, int ext, int dst, uint8_t imm)
+{
+    emit_rex(jit, 0, 0, dst);
+    emit8(jit, 0xC1);
+    emit8(jit, 0xC0 | ext << 3 | (dst & 7));
+    emit8(jit, imm);
+}
+
+#define ALU_ADD 0x01
+#define ALU_OR  0x09
+#define ALU_AND 0x21
+#define ALU_SUB 0x29
+#define ALU_XOR 0x31
+#define ALU_TEST 0x85
+#define EXT_ADD 0
+#define EXT_AND 4
+#define EXT_SUB 5
+#define EXT_CMP 7
+#define EXT_SHL 4
+#define EXT_SHR 5
+#define EXT_SAR 7
+
+// mov r32, [rdi + disp8] / mov [rdi + disp8], r32
+static void emit_state(struct jit_st *jit, uint8_t op, int reg, uint8_t disp)
+{
+    emit_rex(jit, 0, reg, RDI);
+    emit8(jit, op);
+    emit8(jit, 0x40 | (reg & 7) << 3 | RDI);
+    emit8(jit, disp);
+}
+
+static void emit_jmp(struct jit_st *jit, const uint8_t *target)
+{
+    emit8(jit, 0xE9);
+    emit32(jit, (uint32_t)(target - (jit->mem + jit->used + 4)));
+}
+
+// state->steps += n
+static void emit_steps(struct jit_st *jit, uint32_t n)
+{
+    emit8(jit, 0x48); emit8(jit, 0x81);         // add qword [rdi + disp8], imm32
+    emit8(jit, 0x40 | EXT_ADD << 3 | RDI);
+    emit8(jit, offsetof(struct jit_state_st, steps));
+    emit32(jit, n);
+}
+
+#ifdef EMU_STATS
+// rdx = state->stats; stats->field[opcode] += n
+static void emit_stat(struct jit_st *jit, size_t offset, uint32_t n)
+{
+    emit8(jit, 0x48); emit8(jit, 0x8B);         // mov rdx, [rdi + disp8]
+    emit8(jit, 0x40 | RDX << 3 | RDI);
+    emit8(jit, offsetof(struct jit_state_st, stats));
+    emit8(jit, 0x48); emit8(jit, 0x81);         // add qword [rdx + disp32], imm32
+    emit8(jit, 0x80 | EXT_ADD << 3 | RDX);
+    emit32(jit, offset);
+    emit32(jit, n);
+}
+#endif
+
+// Account for the n instructions of a block, hist[] counts them per opcode
+static void emit_retire(struct jit_st *jit, uint32_t n, const uint16_t *hist)
+{
+    emit_steps(jit, n);
+#ifdef EMU_STATS
+    for (int op = 0; op < 32; op++) {
+        if (hist[op]) {
+            emit_stat(jit, offsetof(struct cpu_stats_st, opcodes[op]), hist[op]);
+        }
+    }
+#endif
+}
+
+static void emit_taken(struct jit_st *jit, uint8_t opcode)
+{
+#ifdef EMU_STATS
+    emit_stat(jit, offsetof(struct cpu_stats_st, taken[opcode]), 1);
+#endif
+}
+
+// eax = (reg + imm) & mask
+static void emit_effective(struct jit_st *jit, int reg, uint16_t imm, uint16_t mask)
+{
+    emit_mov(jit, RAX, reg);
+    if (imm) {
+        emit_alu_imm(jit, EXT_ADD, RAX, imm);
+    }
+    emit_alu_imm(jit, EXT_AND, RAX, mask);
+}
+
+/*
+ * Unless the flags satisfy jcc (0F <jcc> rel32), retire the n instructions
+ * before the LOAD/STORE at pc and leave with pc | JIT_SLOW
+ */
+static void emit_slow(struct jit_st *jit, uint8_t jcc, uint16_t pc, int n, const uint16_t *hist)
+{
+    emit8(jit, 0x0F); emit8(jit, jcc);          // j<cc> fast
+    size_t fixup = jit->used;
+    emit32(jit, 0);
+    if (n) {
+        emit_retire(jit, n, hist);
+    }
+    emit_mov_imm(jit, RAX, pc | JIT_SLOW);
+    emit_jmp(jit, jit->exit);
+    uint32_t rel = (uint32_t)(jit->used - (fixup + 4));
+    memcpy(&jit->mem[fixup], &rel, sizeof(rel));
+}
+
+// Guarded LOAD/STORE: leave for the interpreter when eax >= limit
+static void emit_guard(struct jit_st *jit, uint32_t limit, uint16_t pc, int n, const uint16_t *hist)
+{
+    emit_alu_imm(jit, EXT_CMP, RAX, limit);
+    emit_slow(jit, 0x82, pc, n, hist);          // jb
+}
+
+/*
+ * rdx = [rsi + (eax >> CPU_PAGE_SHIFT) * 8 + disp]: mem_data[] at 0, pages[]
+ * past it. eax is below mem_words here, so with a single page it is page 0.
+ */
+static void emit_page(struct jit_st *jit, const cpu_t *cpu, uint32_t disp)
+{
+    if (cpu->data->count == 1) {
+        emit8(jit, 0x48); emit8(jit, 0x8B);     // mov rdx, [rsi + disp32]
+        emit8(jit, 0x96);
+        emit32(jit, disp);
+        return;
+    }
+    emit_mov(jit, RDX, RAX);
+    emit_shift_imm(jit, EXT_SHR, RDX, CPU_PAGE_SHIFT);
+    emit8(jit, 0x48); emit8(jit, 0x8B);         // mov rdx, [rsi + rdx*8 + disp32]
+    emit8(jit, 0x94); emit8(jit, 0xD6);
+    emit32(jit, disp);
+}
+
+// eax = its offset in its page
+static void emit_offset(struct jit_st *jit, const cpu_t *cpu)
+{
+    if (cpu->data->count > 1) {
+        emit_alu_imm(jit, EXT_AND, RAX, CPU_PAGE_MASK);
+    }
+}
+
+// r1 = r2 <op> r3
+static void emit_alu3(struct jit_st *jit, uint8_t op, const uop_t *uop)
+{
+    emit_mov(jit, RAX, HOST_REG(uop->r2));
+    emit_rr(jit, op, HOST_REG(uop->r3), RAX);
+    emit_movzx16(jit, HOST_REG(uop->r1), RAX);
+}
+
+static void emit_stubs(struct jit_st *jit)
+{
+    static const int saved[] = { RBX, RBP, 12, 13, 14, 15 };
+
+    // exit: spill guest state, state->pc = eax, restore and return
+    jit->exit = jit->mem + jit->used;
+    for (int i = 0; i < NUM_REGISTERS; i++) {
+        emit_state(jit, 0x89, HOST_REG(i), offsetof(struct jit_state_st, regs[i]));
+    }
+    emit_state(jit, 0x89, HOST_NF, offsetof(struct jit_state_st, nf));
+    emit_state(jit, 0x89, HOST_ZF, offsetof(struct jit_state_st, zf));
+    emit_state(jit, 0x89, HOST_CF, offsetof(struct jit_state_st, cf));
+    emit_state(jit, 0x89, RAX, offsetof(struct jit_state_st, pc));
+    for (int i = ARRAY_SIZE(saved) - 1; i >= 0; i--) {
+        emit_rex(jit, 0, 0, saved[i]);
+        emit8(jit, 0x58 | (saved[i] & 7));     // pop
+    }
+    emit8(jit, 0xC3);                           // ret
+
+    // dispatch: unless steps > limit, rdx = blocks[rax]; if (rdx) goto *rdx;
+    // otherwise goto exit
+    jit->dispatch = jit->mem + jit->used;
+    emit8(jit, 0x48);                           // mov rdx, [rdi + steps]
+    emit_state(jit, 0x8B, RDX, offsetof(struct jit_state_st, steps));
+    emit8(jit, 0x48);                           // cmp rdx, [rdi + limit]
+    emit_state(jit, 0x3B, RDX, offsetof(struct jit_state_st, limit));
+    emit8(jit, 0x0F); emit8(jit, 0x87);         // ja exit
+    emit32(jit, (uint32_t)(jit->exit - (jit->mem + jit->used + 4)));
+    emit8(jit, 0x48); emit8(jit, 0xBA);         // movabs rdx, blocks
+    emit64(jit, (uint64_t)(uintptr_t)jit->blocks);
+    emit8(jit, 0x48); emit8(jit, 0x8B);         // mov rdx, [rdx + rax*8]
+    emit8(jit, 0x14); emit8(jit, 0xC2);
+    emit8(jit, 0x48); emit8(jit, 0x85);         // test rdx, rdx
+    emit8(jit, 0xD2);
+    emit8(jit, 0x0F); emit8(jit, 0x84);         // jz exit
+    emit32(jit, (uint32_t)(jit->exit - (jit->mem + jit->used + 4)));
+    emit8(jit, 0xFF); emit8(jit, 0xE2);         // jmp rdx
+
+    // enter(state, mem_data, block): save, load guest state, jump to block
+    jit->enter = (jit_enter_fn)(void *)jit_code(jit, jit->mem + jit->used);
+    for (int i = 0; i < ARRAY_SIZE(saved); i++) {
+        emit_rex(jit, 0, 0, saved[i]);
+        emit8(jit, 0x50 | (saved[i] & 7));     // push
+    }
+    for (int i = 0; i < NUM_REGISTERS; i++) {
+        emit_state(jit, 0x8B, HOST_REG(i), offsetof(struct jit_state_st, regs[i]));
+    }
+    emit_state(jit, 0x8B, HOST_NF, offsetof(struct jit_state_st, nf));
+    emit_state(jit, 0x8B, HOST_ZF, offsetof(struct jit_state_st, zf));
+    emit_state(jit, 0x8B, HOST_CF, offsetof(struct jit_state_st, cf));
+    emit8(jit, 0xFF); emit8(jit, 0xE2);         // jmp rdx
+
+    jit->stubs_end = jit->used;
+}
+
+// entries: dispatch table size, one past the largest PC a block can jump to
+struct jit_st *jit_create(uint32_t entries)
+{
+    struct jit_st *jit = (struct jit_st *)malloc(sizeof(struct jit_st));
+    if (!jit) {
+        return NULL;
+    }
+
+    jit->entries = entries;
+    jit->blocks = (const void **)malloc(entries * sizeof(jit->blocks[0]));
+    jit->mem = MAP_FAILED;
+    jit->exec = MAP_FAILED;
+    int fd = memfd_create("jit", MFD_CLOEXEC);
+    if (fd >= 0) {
+        if (ftruncate(fd, JIT_BUFFER_SIZE) == 0) {
+            jit->mem = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            jit->exec = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+    }
+    if (!jit->blocks || jit->mem == MAP_FAILED || jit->exec == MAP_FAILED) {
+        if (jit->mem != MAP_FAILED) {
+            munmap(jit->mem, JIT_BUFFER_SIZE);
+        }
+        if (jit->exec != MAP_FAILED) {
+            munmap(jit->exec, JIT_BUFFER_SIZE);
+        }
+        free(jit->blocks);
+        free(jit);
+        return NULL;
+    }
+
+    jit->used = 0;
+    emit_stubs(jit);
+    jit_flush(jit);
+    return jit;
+}
+
+void jit_flush(struct jit_st *jit)
+{
+    jit->used = jit->stubs_end;
+    memset(jit->blocks, 0, jit->entries * sizeof(jit->blocks[0]));
+}
+
+void jit_destroy(struct jit_st *jit)
+{
+    if (jit) {
+        munmap(jit->mem, JIT_BUFFER_SIZE);
+        munmap(jit->exec, JIT_BUFFER_SIZE);
+        free(jit->blocks);
+        free(jit);
+    }
+}
+
+// Instructions the JIT leaves to the interpreter, one at a time
+static int jit_interpreted(uint8_t opcode)
+{
+    return opcode == TRAP || opcode == RETI || opcode == CSR || opcode == CAS;
+}
+
+static int jit_translatable(uint8_t opcode)
+{
+    switch (opcode) {
+        case HALT:
+        case TRAP:
+        case RETI:
+        case CSR:
+        case CAS:
+        case RESEVE4:
+            return 0;
+        default:
+            return 1;
+    }
+}
+
+// Largest code emitted for one guest instruction, including a block exit
+#ifdef EMU_STATS
+#define JIT_INST_MAX (160 + 3 * 32 * 16)
+#else
+#define JIT_INST_MAX 160
+#endif
+
+// Translate the basic block at pc into executable code; NULL when the buffer is full
+static const void *jit_translate(struct jit_st *jit, const cpu_t *cpu, uint16_t pc)
+{
+    const uint8_t *start = jit->mem + jit->used;
+    uint16_t hist[32] = { 0 };
+    uint16_t mask = cpu->mem_mask;
+    int guarded = cpu_data_guarded(cpu);
+
+    for (int n = 0; ; n++) {
+        const uop_t *uop = &cpu->code[pc];
+        uint16_t next = (pc + 1) & mask;
+
+        if (jit->used + JIT_INST_MAX > JIT_BUFFER_SIZE) {
+            return NULL;
+        }
+
+        if (!jit_translatable(uop->opcode) || uop->dispatch == UOP_BREAK) {
+            // Leave to C, which stops at this instruction
+            if (n) {
+                emit_retire(jit, n, hist);
+            }
+            emit_mov_imm(jit, RAX, pc);
+            emit_jmp(jit, jit->exit);
+            break;
+        }
+
+        hist[uop->opcode]++;
+        switch (uop->opcode) {
+            case NOP:
+                break;
+            case LOAD:
+                emit_effective(jit, HOST_REG(uop->r2), uop->imm, mask);
+                if (guarded) {
+                    hist[LOAD]--;
+                    emit_guard(jit, cpu->data_limit, pc, n, hist);
+                    hist[LOAD]++;
+                }
+                emit_page(jit, cpu, 0);
+                emit_offset(jit, cpu);
+                emit_rex(jit, 0, HOST_REG(uop->r1), 0);
+                emit8(jit, 0x0F); emit8(jit, 0xB7);     // movzx r1, word [rdx + rax*2]
+                emit8(jit, 0x04 | (HOST_REG(uop->r1) & 7) << 3);
+                emit8(jit, 0x42);
+                break;
+            case STORE:
+                emit_effective(jit, HOST_REG(uop->r2), uop->imm, mask);
+                if (guarded) {
+                    hist[STORE]--;
+                    emit_guard(jit, cpu->data_limit, pc, n, hist);
+                    hist[STORE]++;
+                }
+                // A page another CPU shares is copied by the interpreter first
+                emit_page(jit, cpu, cpu->data->count * sizeof(uint16_t *));
+                emit8(jit, 0x83); emit8(jit, 0x3A);     // cmp dword [rdx], 1 (page refs)
+                emit8(jit, 0x01);
+                hist[STORE]--;
+                emit_slow(jit, 0x84, pc, n, hist);      // je
+                hist[STORE]++;
+                emit8(jit, 0x48); emit8(jit, 0x8B);     // mov rdx, [rdx + words] (page words)
+                emit8(jit, 0x52);
+                emit8(jit, offsetof(struct cpu_page_st, words));
+                emit_offset(jit, cpu);
+                emit8(jit, 0x66);                       // mov word [rdx + rax*2], r1
+                emit_rex(jit, 0, HOST_REG(uop->r1), 0);
+                emit8(jit, 0x89);
+                emit8(jit, 0x04 | (HOST_REG(uop->r1) & 7) << 3);
+                emit8(jit, 0x42);
+                break;
+            case LDIH:
+            case ADDI:
+                emit_alu_imm(jit, EXT_ADD, HOST_REG(uop->r1), uop->imm);
+                emit_movzx16(jit, HOST_REG(uop->r1), HOST_REG(uop->r1));
+                break;
+            case SUBI:
+                emit_alu_imm(jit, EXT_SUB, HOST_REG(uop->r1), uop->imm);
+                emit_movzx16(jit, HOST_REG(uop->r1), HOST_REG(uop->r1));
+                break;
+            case ADD: emit_alu3(jit, ALU_ADD, uop); break;
+            case SUB: emit_alu3(jit, ALU_SUB, uop); break;
+            case AND: emit_alu3(jit, ALU_AND, uop); break;
+            case OR: emit_alu3(jit, ALU_OR, uop); break;
+            case XOR: emit_alu3(jit, ALU_XOR, uop); break;
+            case ADDC:
+                // eax = r2 + r3 + cf; cf = eax >> 16
+                emit_mov(jit, RAX, HOST_REG(uop->r2));
+                emit_rr(jit, ALU_ADD, HOST_REG(uop->r3), RAX);
+                emit_rr(jit, ALU_ADD, HOST_CF, RAX);
+                emit_mov(jit, HOST_CF, RAX);
+                emit_shift_imm(jit, EXT_SHR, HOST_CF, 16);
+                emit_movzx16(jit, HOST_REG(uop->r1), RAX);
+                break;
+            case SUBC:
+                // eax = r2 - r3 - cf; cf = borrow (result negative)
+                emit_mov(jit, RAX, HOST_REG(uop->r2));
+                emit_rr(jit, ALU_SUB, HOST_REG(uop->r3), RAX);
+                emit_rr(jit, ALU_SUB, HOST_CF, RAX);
+                emit_mov(jit, HOST_CF, RAX);
+                emit_shift_imm(jit, EXT_SHR, HOST_CF, 31);
+                emit_movzx16(jit, HOST_REG(uop->r1), RAX);
+                break;
+            case CMP:
+                emit_mov(jit, RAX, HOST_REG(uop->r2));
+                emit_rr(jit, ALU_SUB, HOST_REG(uop->r3), RAX);
+                emit_movzx16(jit, RAX, RAX);
+                emit_mov(jit, HOST_NF, RAX);
+                emit_shift_imm(jit, EXT_SHR, HOST_NF, 15);
+                emit_rr(jit, ALU_XOR, HOST_ZF, HOST_ZF);
+                emit_rr(jit, ALU_TEST, RAX, RAX);
+                emit8(jit, 0x40); emit8(jit, 0x0F);     // sete bpl
+                emit8(jit, 0x94); emit8(jit, 0xC5);
+                break;
+            case SLL:
+            case SLA:
+                emit_mov(jit, RAX, HOST_REG(uop->r2));
+                emit_shift_imm(jit, EXT_SHL, RAX, uop->imm);
+                emit_movzx16(jit, HOST_REG(uop->r1), RAX);
+                break;
+            case SRL:
+                emit_mov(jit, RAX, HOST_REG(uop->r2));
+                emit_shift_imm(jit, EXT_SHR, RAX, uop->imm);
+                emit_mov(jit, HOST_REG(uop->r1), RAX);
+                break;
+            case SRA:
+                emit_0f_rr(jit, 0xBF, RAX, HOST_REG(uop->r2));  // movsx eax, r2w
+                emit_shift_imm(jit, EXT_SAR, RAX, uop->imm);
+                emit_movzx16(jit, HOST_REG(uop->r1), RAX);
+                break;
+            case JUMP:
+                emit_retire(jit, n + 1, hist);
+                emit_taken(jit, JUMP);
+                emit_mov_imm(jit, RAX, uop->imm & mask);
+                emit_jmp(jit, jit->dispatch);
+                return jit_code(jit, start);
+            case JMPR:
+                emit_retire(jit, n + 1, hist);
+                emit_taken(jit, JMPR);
+                emit_effective(jit, HOST_REG(uop->r1), uop->imm, mask);
+                emit_jmp(jit, jit->dispatch);
+                return jit_code(jit, start);
+            case BZ:
+            case BNZ:
+            case BN:
+            case BNN:
+            case BC:
+            case BNC: {
+                int flag = (uop->opcode == BZ || uop->opcode == BNZ) ? HOST_ZF
+                         : (uop->opcode == BN || uop->opcode == BNN) ? HOST_NF : HOST_CF;
+                // BZ/BN/BC (even low bit) branch when the flag is set
+                int taken_if_set = !(uop->opcode & 1);
+
+                emit_retire(jit, n + 1, hist);
+                emit_rr(jit, ALU_TEST, flag, flag);
+                emit8(jit, 0x0F);                       // jz/jnz not_taken
+                emit8(jit, taken_if_set ? 0x84 : 0x85);
+                size_t fixup = jit->used;
+                emit32(jit, 0);
+                emit_taken(jit, uop->opcode);
+                emit_effective(jit, HOST_REG(uop->r1), uop->imm, mask);
+                emit_jmp(jit, jit->dispatch);
+                uint32_t rel = (uint32_t)(jit->used - (fixup + 4));
+                memcpy(&jit->mem[fixup], &rel, sizeof(rel));
+                emit_mov_imm(jit, RAX, next);
+                emit_jmp(jit, jit->dispatch);
+                return jit_code(jit, start);
+            }
+            default:
+                break;
+        }
+
+        pc = next;
+        if (n + 1 >= JIT_BLOCK_MAX || pc == 0) {
+            emit_retire(jit, n + 1, hist);
+            emit_mov_imm(jit, RAX, pc);
+            emit_jmp(jit, jit->dispatch);
+            break;
+        }
+    }
+
+    return jit_code(jit, start);
+}
+
+int cpu_exec_jit(cpu_t *cpu, uint64_t max_steps)
+{
+    if (cpu_hooked(cpu)) {
+        // Per-instruction hooks need an interpreter
+        return cpu_exec_threaded(cpu, max_steps);
+    }
+
+    if (!cpu->jit && !(cpu->jit = jit_create(cpu->mem_mask + 1))) {
+        return cpu_exec_threaded(cpu, max_steps);
+    }
+    if (!cpu->text->valid && cpu_predecode(cpu) != 0) {
+        return cpu_status(cpu);
+    }
+    if (!cpu->code_jitted) {
+        jit_flush(cpu->jit);
+        cpu->code_jitted = 1;
+    }
+
+    struct jit_st *jit = cpu->jit;
+    struct jit_state_st state;
+    uint64_t done = 0;      // Steps retired by this call
+    uint16_t pc;
+    int slow;
+
+    state.stats = &cpu->stats;
+    do {
+        for (int i = 0; i < NUM_REGISTERS; i++) {
+            state.regs[i] = cpu->regs[i];
+        }
+        state.nf = cpu->nf;
+        state.zf = cpu->zf;
+        state.cf = cpu->cf;
+        state.steps = 0;
+        state.limit = max_steps - done >= JIT_BLOCK_MAX ? max_steps - done - JIT_BLOCK_MAX : 0;
+
+        pc = cpu->pc & cpu->mem_mask;
+        slow = 0;
+        while (pc < cpu->mem_words && max_steps - done - state.steps >= JIT_BLOCK_MAX) {
+            if (jit_interpreted(cpu->code[pc].opcode)) {
+                slow = 1;
+                break;
+            }
+            if (!jit_translatable(cpu->code[pc].opcode) || cpu->code[pc].dispatch == UOP_BREAK) {
+                break;
+            }
+            if (!jit->blocks[pc]) {
+                const void *block = jit_translate(jit, cpu, pc);
+                if (!block) {
+                    jit_flush(jit);
+                    block = jit_translate(jit, cpu, pc);
+                }
+                jit->blocks[pc] = block;
+            }
+            uint32_t exit = jit->enter(&state, cpu->mem_data, jit->blocks[pc]);
+            pc = (uint16_t)exit;
+            if (exit & JIT_SLOW) {
+                slow = 1;
+                break;
+            }
+        }
+
+        for (int i = 0; i < NUM_REGISTERS; i++) {
+            cpu->regs[i] = state.regs[i];
+        }
+        cpu->nf = state.nf;
+        cpu->zf = state.zf;
+        cpu->cf = state.cf;
+        cpu->pc = pc;
+        cpu->steps += state.steps;
+        done += state.steps;
+
+        if (slow) {
+            // Device access, bounds fault, shared page, TRAP, RETI, CSR or CAS: one instruction in the interpreter
+            uint64_t steps = cpu->steps;
+            cpu->irq.stop = 0;
+            cpu_exec_n(cpu, 1);
+            if (cpu->steps == steps || cpu->irq.stop) {
+                return cpu_status(cpu);
+            }
+            done++;
+        }
+    } while (slow && done < max_steps);
+
+    if (done < max_steps && cpu_status(cpu) == CPU_BUDGET) {
+        // Less than a block of budget left: finish it one step at a time
+        return cpu_exec_threaded(cpu, max_steps - done);
+    }
+    return cpu_status(cpu);
+}
+
+#else
+
+struct jit_st *jit_create(uint32_t entries)
+{
+    return NULL;
+}
+
+void jit_flush(struct jit_st *jit)
+{
+}
+
+void jit_destroy(struct jit_st *jit)
+{
+}
+
+// No JIT for this host: run the fastest interpreter instead
+int cpu_exec_jit(cpu_t *cpu, uint64_t max_steps)
+{
+    return cpu_exec_threaded(cpu, max_steps);
+}
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef JIT_H_20251117_
+#define JIT_H_20251117_
+
+#include <stdint.h>
+
+#include "emulator.h"
+
+#define JIT_BUFFER_SIZE (1024 * 1024)   // Code buffer
+#define JIT_BLOCK_MAX 64                // Max guest instructions per block
+
+struct jit_st;
+
+struct jit_st *jit_create(uint32_t entries);
+void jit_flush(struct jit_st *jit);
+void jit_destroy(struct jit_st *jit);
+
+#endif  // JIT_H_20251117_
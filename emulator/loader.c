@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "emulator.h"
+#include "loader.h"
+
+_Static_assert(sizeof(struct object_header_st) == 24, "object header layout");
+
+// Apply an object header to cpu: memory layout, entry PC and data words
+static int object_setup(cpu_t *cpu, int fd, const struct object_header_st *header, off_t file_size)
+{
+    off_t text_end = header->header_bytes + (off_t)header->text_words * sizeof(uint16_t);
+
+    if (header->version != OBJECT_VERSION
+        || header->header_bytes < sizeof(*header) || (header->header_bytes & 1)
+        || text_end + (off_t)header->data_words * sizeof(uint16_t) > file_size) {
+        return -1;
+    }
+
+    struct cpu_config_st config;
+    cpu_get_config(cpu, &config);
+    if (header->mem_words
+        && (header->mem_words != config.mem_words
+            || !!(header->flags & OBJECT_CHECKED) != config.checked)) {
+        config.mem_words = header->mem_words;
+        config.checked = !!(header->flags & OBJECT_CHECKED);
+        if (cpu_configure(cpu, &config) != 0) {
+            return -1;
+        }
+    }
+
+    if (header->data_words) {
+        size_t words = header->data_words < cpu->mem_words ? header->data_words : cpu->mem_words;
+        for (size_t addr = 0; addr < words; addr += CPU_PAGE_WORDS) {
+            size_t n = words - addr < CPU_PAGE_WORDS ? words - addr : CPU_PAGE_WORDS;
+            if (cpu_own_page(cpu, addr) != 0
+                || pread(fd, cpu->mem_data[addr >> CPU_PAGE_SHIFT], n * sizeof(uint16_t),
+                         text_end + addr * sizeof(uint16_t)) != (ssize_t)(n * sizeof(uint16_t))) {
+                return -1;
+            }
+        }
+    }
+    cpu->pc = header->entry & cpu->mem_mask;
+    return 0;
+}
+
+/*
+ * Map text_words instruction words at offset of fd, a file of file_size
+ * bytes, as instruction memory instead of reading them: mem_inst points
+ * straight into the page cache and a page is only copied when something
+ * writes to it (the guard word, cpu_write_inst). Words past text_words read
+ * as zero. offset is small; the mapping starts at the beginning of the file.
+ */
+int cpu_map_text(cpu_t *cpu, int fd, size_t offset, size_t text_words, off_t file_size)
+{
+    if (cpu_own_text(cpu) != 0) {
+        return -1;
+    }
+
+    uint32_t size = cpu->mem_words;
+    if (text_words > size) {
+        text_words = size;
+    }
+
+    // Anonymous zero pages for the whole memory, the file mapped over its start
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t map_bytes = (offset + (size + 1) * sizeof(uint16_t) + page - 1) & ~(page - 1);
+    size_t file_bytes = offset + text_words * sizeof(uint16_t);
+    uint8_t *map = mmap(NULL, map_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    if (text_words && mmap(map, file_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(map, map_bytes);
+        return -1;
+    }
+
+    // The last file page also holds whatever follows the text in the file
+    size_t page_end = (file_bytes + page - 1) & ~(page - 1);
+    if (text_words && (off_t)file_bytes < file_size && page_end > file_bytes) {
+        memset(map + file_bytes, 0, page_end - file_bytes);
+    }
+
+    struct cpu_text_st *text = cpu->text;
+    if (text->map) {
+        munmap(text->map, text->map_bytes);
+    }
+    text->map = map;
+    text->map_bytes = map_bytes;
+    text->words = (uint16_t *)(map + offset);
+    text->words[size] = CPU_GUARD_WORD;
+    cpu->mem_inst = text->words;
+    cpu_invalidate(cpu);
+    return 0;
+}
+
+/*
+ * Load a program by mapping the file privately instead of reading it
+ * (cpu_map_text). Returns the number of instruction words loaded like
+ * cpu_load_program(), or -1.
+ */
+int cpu_map_program(cpu_t *cpu, const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    struct object_header_st header;
+    size_t offset = 0;
+    size_t text_words;
+
+    if (fstat(fd, &st) != 0) {
+        goto fail;
+    }
+    text_words = st.st_size / sizeof(uint16_t);
+    if (st.st_size >= (off_t)sizeof(header)
+        && pread(fd, &header, sizeof(header), 0) == sizeof(header)
+        && memcmp(header.magic, OBJECT_MAGIC, 4) == 0) {
+        if (object_setup(cpu, fd, &header, st.st_size) != 0) {
+            goto fail;
+        }
+        offset = header.header_bytes;
+        text_words = header.text_words;
+    }
+    if (text_words > cpu->mem_words) {
+        text_words = cpu->mem_words;
+    }
+    if (cpu_map_text(cpu, fd, offset, text_words, st.st_size) != 0) {
+        goto fail;
+    }
+    close(fd);
+    return text_words;
+
+fail:
+    close(fd);
+    return -1;
+}
@@ -0,0 +1,33 @@
+#ifndef LOADER_H_20251117_
+#define LOADER_H_20251117_
+
+#include <stdint.h>
+
+#include "emulator.h"
+
+/*
+ * Object file: the header below, text_words instruction words and
+ * data_words data words, all little-endian like program images. A file
+ * without OBJECT_MAGIC is a raw image of instruction words.
+ */
+#define OBJECT_MAGIC "SOBJ"
+#define OBJECT_VERSION 1
+
+#define OBJECT_CHECKED 0x01             // Wants bounds-checked addressing
+
+struct object_header_st {
+    char magic[4];                  // OBJECT_MAGIC
+    uint8_t version;                // OBJECT_VERSION
+    uint8_t flags;                  // OBJECT_*
+    uint16_t header_bytes;          // Offset of the text words, even, >= sizeof(header)
+    uint32_t mem_words;             // Memory size to run with, 0 to keep the CPU's
+    uint16_t entry;                 // Initial PC
+    uint16_t reserved;
+    uint32_t text_words;
+    uint32_t data_words;
+};
+
+int cpu_map_text(cpu_t *cpu, int fd, size_t offset, size_t text_words, off_t file_size);
+int cpu_map_program(cpu_t *cpu, const char *filename);
+
+#endif  // LOADER_H_20251117_
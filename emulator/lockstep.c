@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "opcodes.h"
+#include "emulator.h"
+#include "lockstep.h"
+
+int cpu_batch_init(cpu_batch_t *batch, const cpu_t *program, int lanes)
+{
+    if (lanes <= 0 || lanes > CPU_LANES) {
+        return -1;
+    }
+
+    batch->cpu = (cpu_t *)malloc(sizeof(cpu_t));
+    if (!batch->cpu) {
+        return -1;
+    }
+
+    if (cpu_fork(batch->cpu, program) != 0) {
+        free(batch->cpu);
+        batch->cpu = NULL;
+        return -1;
+    }
+    batch->mem_data = (uint16_t *)malloc((size_t)CPU_LANES * program->mem_words * sizeof(uint16_t));
+    if (!batch->mem_data
+        || (!batch->cpu->text->valid && cpu_predecode(batch->cpu) != 0)) {
+        free(batch->mem_data);
+        batch->mem_data = NULL;
+        cpu_release(batch->cpu);
+        free(batch->cpu);
+        batch->cpu = NULL;
+        return -1;
+    }
+
+    batch->lanes = lanes;
+    for (int i = 0; i < CPU_LANES; i++) {
+        cpu_batch_set_lane(batch, i, program);
+    }
+    return 0;
+}
+
+void cpu_batch_release(cpu_batch_t *batch)
+{
+    if (batch->cpu) {
+        free(batch->mem_data);
+        batch->mem_data = NULL;
+        cpu_release(batch->cpu);
+        free(batch->cpu);
+        batch->cpu = NULL;
+    }
+}
+
+void cpu_batch_set_lane(cpu_batch_t *batch, int lane, const cpu_t *cpu)
+{
+    for (int r = 0; r < NUM_REGISTERS; r++) {
+        batch->regs[r][lane] = cpu->regs[r];
+    }
+    batch->nf[lane] = cpu->nf;
+    batch->zf[lane] = cpu->zf;
+    batch->cf[lane] = cpu->cf;
+    batch->pc[lane] = cpu->pc & cpu->mem_mask;
+    batch->steps[lane] = cpu->steps;
+    batch->irq[lane] = cpu->irq;
+    cpu_data_read(cpu, cpu_batch_data(batch, lane));
+}
+
+int cpu_batch_get_lane(const cpu_batch_t *batch, int lane, cpu_t *cpu)
+{
+    if (cpu_data_write(cpu, cpu_batch_data(batch, lane), cpu->mem_words) != 0) {
+        return -1;
+    }
+    for (int r = 0; r < NUM_REGISTERS; r++) {
+        cpu->regs[r] = batch->regs[r][lane];
+    }
+    cpu->nf = batch->nf[lane];
+    cpu->zf = batch->zf[lane];
+    cpu->cf = batch->cf[lane];
+    cpu->pc = batch->pc[lane];
+    cpu->steps = batch->steps[lane];
+    cpu->irq = batch->irq[lane];
+    return 0;
+}
+
+// Finish every lane with a scalar engine, starting from its own PC
+static void cpu_batch_scalar(cpu_batch_t *batch, int engine, uint64_t max_steps)
+{
+    for (int i = 0; i < batch->lanes; i++) {
+        cpu_batch_get_lane(batch, i, batch->cpu);
+        cpu_run(batch->cpu, engine, max_steps);
+        cpu_batch_set_lane(batch, i, batch->cpu);
+    }
+}
+
+// Why a lane stopped, after cpu_batch_exec
+int cpu_batch_status(const cpu_batch_t *batch, int lane)
+{
+    uint16_t regs[NUM_REGISTERS];
+
+    for (int r = 0; r < NUM_REGISTERS; r++) {
+        regs[r] = batch->regs[r][lane];
+    }
+    return cpu_status_at(batch->cpu, batch->pc[lane], regs);
+}
+
+void cpu_batch_exec(cpu_batch_t *batch, int engine, uint64_t max_steps)
+{
+    const uop_t *code = batch->cpu->code;
+    lanes_t *regs = batch->regs;
+    uint16_t mask = batch->cpu->mem_mask;
+    uint32_t words = batch->cpu->mem_words;
+    uint64_t steps = 0;
+    int scalar = 0;
+
+    // Unused lanes shadow lane 0 so they never cause divergence
+    for (int i = batch->lanes; i < CPU_LANES; i++) {
+        for (int r = 0; r < NUM_REGISTERS; r++) {
+            regs[r][i] = regs[r][0];
+        }
+        batch->nf[i] = batch->nf[0];
+        batch->zf[i] = batch->zf[0];
+        batch->cf[i] = batch->cf[0];
+        batch->pc[i] = batch->pc[0];
+        memcpy(cpu_batch_data(batch, i), batch->mem_data, words * sizeof(uint16_t));
+    }
+
+    if (cpu_data_guarded(batch->cpu)) {
+        // Lanes could fault or reach devices at different instructions
+        cpu_batch_scalar(batch, engine, max_steps);
+        return;
+    }
+    for (int i = 0; i < batch->lanes; i++) {
+        if (irq_active(&batch->irq[i])) {
+            // Lanes take interrupts at their own times
+            cpu_batch_scalar(batch, engine, max_steps);
+            return;
+        }
+    }
+    for (int i = 1; i < batch->lanes; i++) {
+        if (batch->pc[i] != batch->pc[0]) {
+            cpu_batch_scalar(batch, engine, max_steps);
+            return;
+        }
+    }
+
+    uint16_t pc = batch->pc[0];
+    while (steps < max_steps) {
+        const uop_t *uop = &code[pc];
+        uint16_t next = (pc + 1) & mask;
+        lanes_t target, taken;
+
+        switch (uop->opcode) {
+            case NOP:
+                break;
+            case LOAD:
+                for (int i = 0; i < CPU_LANES; i++) {
+                    regs[uop->r1][i] = cpu_batch_data(batch, i)[(regs[uop->r2][i] + uop->imm) & mask];
+                }
+                break;
+            case STORE:
+                for (int i = 0; i < CPU_LANES; i++) {
+                    cpu_batch_data(batch, i)[(regs[uop->r2][i] + uop->imm) & mask] = regs[uop->r1][i];
+                }
+                break;
+            case LDIH:
+            case ADDI:
+                regs[uop->r1] += uop->imm;
+                break;
+            case SUBI:
+                regs[uop->r1] -= uop->imm;
+                break;
+            case ADD:
+                regs[uop->r1] = regs[uop->r2] + regs[uop->r3];
+                break;
+            case ADDC: {
+                lanes_t sum = regs[uop->r2] + regs[uop->r3];
+                lanes_t carry = (lanes_t)(sum < regs[uop->r2]);
+                lanes_t result = sum + batch->cf;
+                carry |= (lanes_t)(result < sum);
+                regs[uop->r1] = result;
+                batch->cf = carry & 1;
+                break;
+            }
+            case SUB:
+                regs[uop->r1] = regs[uop->r2] - regs[uop->r3];
+                break;
+            case SUBC: {
+                lanes_t diff = regs[uop->r2] - regs[uop->r3];
+                lanes_t borrow = (lanes_t)(regs[uop->r2] < regs[uop->r3]);
+                borrow |= (lanes_t)(diff < batch->cf);
+                regs[uop->r1] = diff - batch->cf;
+                batch->cf = borrow & 1;
+                break;
+            }
+            case CMP: {
+                lanes_t result = regs[uop->r2] - regs[uop->r3];
+                batch->zf = (lanes_t)(result == 0) & 1;
+                batch->nf = result >> 15;
+                break;
+            }
+            case AND:
+                regs[uop->r1] = regs[uop->r2] & regs[uop->r3];
+                break;
+            case OR:
+                regs[uop->r1] = regs[uop->r2] | regs[uop->r3];
+                break;
+            case XOR:
+                regs[uop->r1] = regs[uop->r2] ^ regs[uop->r3];
+                break;
+            case SLL:
+            case SLA:
+                regs[uop->r1] = regs[uop->r2] << uop->imm;
+                break;
+            case SRL:
+                regs[uop->r1] = regs[uop->r2] >> uop->imm;
+                break;
+            case SRA: {
+                typedef int16_t slanes_t __attribute__((vector_size(sizeof(lanes_t))));
+                regs[uop->r1] = (lanes_t)((slanes_t)regs[uop->r2] >> uop->imm);
+                break;
+            }
+            case JUMP:
+                next = uop->imm & mask;
+                CPU_STATS(batch->cpu->stats.taken[JUMP] += batch->lanes);
+                break;
+            case JMPR:
+            case BZ:
+            case BNZ:
+            case BN:
+            case BNN:
+            case BC:
+            case BNC: {
+                switch (uop->opcode) {
+                    case BZ: taken = batch->zf; break;
+                    case BNZ: taken = batch->zf ^ 1; break;
+                    case BN: taken = batch->nf; break;
+                    case BNN: taken = batch->nf ^ 1; break;
+                    case BC: taken = batch->cf; break;
+                    case BNC: taken = batch->cf ^ 1; break;
+                    default: taken = batch->zf | 1; break;
+                }
+                taken = -taken;     // 0 or 0xFFFF
+                target = (regs[uop->r1] + uop->imm) & mask;
+                target = (target & taken) | (next & ~taken);
+
+#ifdef EMU_STATS
+                for (int i = 0; i < batch->lanes; i++) {
+                    batch->cpu->stats.taken[uop->opcode] += taken[i] & 1;
+                }
+#endif
+                next = target[0];
+                for (int i = 1; i < CPU_LANES; i++) {
+                    if (target[i] != next) {
+                        // Lanes diverge: commit this step and go scalar
+                        CPU_STATS(batch->cpu->stats.opcodes[uop->opcode] += batch->lanes);
+                        for (int j = 0; j < CPU_LANES; j++) {
+                            batch->pc[j] = target[j];
+                            batch->steps[j] += steps + 1;
+                        }
+                        cpu_batch_scalar(batch, engine, max_steps - steps - 1);
+                        return;
+                    }
+                }
+                break;
+            }
+            case TRAP:
+                // Host calls run lane by lane; without a host every lane stops
+                scalar = batch->cpu->host != NULL;
+                goto out;
+            case RETI:
+            case CSR:
+                // Interrupt state is per lane
+                scalar = 1;
+                goto out;
+            case CAS:
+                // Each lane compares its own data word
+                scalar = 1;
+                goto out;
+            default:
+                // HALT or unknown opcode: every lane stops here
+                goto out;
+        }
+
+        CPU_STATS(batch->cpu->stats.opcodes[uop->opcode] += batch->lanes);
+        pc = next;
+        steps++;
+    }
+
+out:
+    for (int i = 0; i < CPU_LANES; i++) {
+        batch->pc[i] = pc;
+        batch->steps[i] += steps;
+    }
+    if (scalar) {
+        cpu_batch_scalar(batch, engine, max_steps - steps);
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef LOCKSTEP_H_20251117_
+#define LOCKSTEP_H_20251117_
+
+#include <stdint.h>
+
+#include "emulator.h"
+
+#ifndef CPU_LANES
+#define CPU_LANES 16        // CPUs per lockstep batch (8, 16 or 32)
+#endif
+
+// One 16-bit value per lane; maps onto SSE2/AVX2 registers
+typedef uint16_t lanes_t __attribute__((vector_size(CPU_LANES * sizeof(uint16_t))));
+
+/*
+ * Structure-of-arrays state of CPU_LANES CPUs running the same program.
+ * While every lane is at the same PC, an instruction executes for all lanes
+ * at once as vector operations; LOAD/STORE gather and scatter per lane.
+ * When a JMPR or conditional branch sends lanes to different PCs, each lane
+ * is finished on its own with a scalar engine. A step budget counts the
+ * steps each lane retires in one cpu_batch_exec call. Programs with
+ * bounds-checked memory or memory-mapped devices, and lanes with an active
+ * timer or pending interrupt, always run on the scalar engine.
+ */
+struct cpu_batch_st {
+    lanes_t regs[NUM_REGISTERS];            // regs[r][lane]
+    lanes_t nf;                             // Flags, 0 or 1 per lane
+    lanes_t zf;
+    lanes_t cf;
+    uint16_t pc[CPU_LANES];
+    uint64_t steps[CPU_LANES];
+    struct cpu_irq_st irq[CPU_LANES];
+    uint16_t *mem_data;                     // CPU_LANES memories, see cpu_batch_data()
+    int lanes;                              // Lanes in use
+    cpu_t *cpu;                             // Program and scalar fallback state
+};
+
+typedef struct cpu_batch_st cpu_batch_t;
+
+// Data memory of one lane, cpu->mem_words words
+#define cpu_batch_data(batch, lane) ((batch)->mem_data + (size_t)(lane) * (batch)->cpu->mem_words)
+
+int cpu_batch_init(cpu_batch_t *batch, const cpu_t *program, int lanes);
+void cpu_batch_release(cpu_batch_t *batch);
+void cpu_batch_set_lane(cpu_batch_t *batch, int lane, const cpu_t *cpu);
+int cpu_batch_get_lane(const cpu_batch_t *batch, int lane, cpu_t *cpu);
+void cpu_batch_exec(cpu_batch_t *batch, int engine, uint64_t max_steps);
+int cpu_batch_status(const cpu_batch_t *batch, int lane);
+
+#endif  // LOCKSTEP_H_20251117_
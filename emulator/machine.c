@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "opcodes.h"
+#include "emulator.h"
+#include "batch.h"
+#include "host.h"
+#include "machine.h"
+
+/*
+ * Fork count cores from program. Core 0 takes a copy of the program's data
+ * memory and marks it shared; the other cores fork from core 0, so all of
+ * them write that copy in place and the program's own memory is untouched.
+ */
+int machine_init(struct machine_st *machine, const cpu_t *program, int count)
+{
+    machine->count = 0;
+    if (count < 1 || count > MACHINE_CORES_MAX) {
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        cpu_t *core = (cpu_t *)malloc(sizeof(cpu_t));
+        if (!core) {
+            machine_release(machine);
+            return -1;
+        }
+        if (cpu_fork(core, i == 0 ? program : machine->cores[0]) != 0) {
+            free(core);
+            machine_release(machine);
+            return -1;
+        }
+        machine->cores[machine->count++] = core;
+        if (i == 0) {
+            if (cpu_own_data(core) != 0) {
+                machine_release(machine);
+                return -1;
+            }
+            core->data->shared = 1;
+        }
+        core->core = i;
+        core->cores = count;
+    }
+    return 0;
+}
+
+void machine_release(struct machine_st *machine)
+{
+    for (int i = 0; i < machine->count; i++) {
+        cpu_release(machine->cores[i]);
+        free(machine->cores[i]);
+    }
+    machine->count = 0;
+}
+
+/*
+ * Run every core until it stops or has run max_steps. With slice 0 each
+ * core runs on a host thread of its own; the cores then have private hosts
+ * on the streams of the program's host, whose output is written core by
+ * core when all of them have stopped. Otherwise the cores take turns of
+ * slice steps on the calling thread, which gives the same interleaving on
+ * every run and on every engine.
+ */
+int machine_run(struct machine_st *machine, int engine, uint64_t slice, uint64_t max_steps,
+                struct cpu_result_st *results)
+{
+    if (slice) {
+        return cpu_exec_round_robin(machine->cores, machine->count, engine, slice, max_steps, results);
+    }
+
+    struct host_st *host = machine->cores[0]->host;
+    int ret = 0;
+    if (host) {
+        host_flush(host);
+        for (int i = 0; i < machine->count; i++) {
+            if (!(machine->cores[i]->host = host_create(host->out, host->in))) {
+                ret = -1;
+            }
+        }
+    }
+    if (ret == 0) {
+        // A core spinning on a lock must not wait for a thread its holder never gets
+        ret = cpu_exec_batch(machine->cores, machine->count, engine, machine->count, max_steps, results);
+    }
+    if (host) {
+        for (int i = 0; i < machine->count; i++) {
+            host_destroy(machine->cores[i]->host);
+            machine->cores[i]->host = host;
+        }
+    }
+    return ret;
+}
+
+/*
+ * Instruction and per-opcode counts of every core summed into total, a
+ * shallow copy of core 0 for cpu_stats_print(); it must not be released.
+ */
+void machine_total(const struct machine_st *machine, cpu_t *total)
+{
+    *total = *machine->cores[0];
+    for (int i = 1; i < machine->count; i++) {
+        const struct cpu_stats_st *stats = &machine->cores[i]->stats;
+        total->steps += machine->cores[i]->steps;
+        for (int op = 0; op < ARRAY_SIZE(stats->opcodes); op++) {
+            total->stats.opcodes[op] += stats->opcodes[op];
+            total->stats.taken[op] += stats->taken[op];
+        }
+        for (int f = 0; f < UOP_FUSED_COUNT; f++) {
+            total->stats.fused[f] += stats->fused[f];
+        }
+    }
+}
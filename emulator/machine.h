@@ -0,0 +1,30 @@
+#ifndef MACHINE_H_20251117_
+#define MACHINE_H_20251117_
+
+#include <stdint.h>
+
+#include "emulator.h"
+#include "batch.h"
+
+#define MACHINE_CORES_MAX 64
+
+/*
+ * A machine of count cores running one program. Each core is a forked
+ * cpu_t with its own registers, flags, PC, interrupt state, host calls and
+ * engine caches; all of them read and write one data memory in place.
+ * Plain LOAD/STORE are host loads and stores with no ordering between
+ * cores; CAS is atomic and a full barrier, which is what guest locks and
+ * counters build on. CSR_CORE reads a core's index and CSR_CORES the count.
+ */
+struct machine_st {
+    cpu_t *cores[MACHINE_CORES_MAX];
+    int count;
+};
+
+int machine_init(struct machine_st *machine, const cpu_t *program, int count);
+void machine_release(struct machine_st *machine);
+int machine_run(struct machine_st *machine, int engine, uint64_t slice, uint64_t max_steps,
+                struct cpu_result_st *results);
+void machine_total(const struct machine_st *machine, cpu_t *total);
+
+#endif  // MACHINE_H_20251117_
@@ -1,30 +1,664 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 #include <assert.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
 
 #include "emulator.h"
+#include "trace.h"
+#include "batch.h"
+#include "stats.h"
+#include "profile.h"
+#include "snapshot.h"
+#include "loader.h"
+#include "bus.h"
+#include "host.h"
+#include "replay.h"
+#include "debug.h"
+#include "gdb.h"
+#include "machine.h"
+
+#define TRACE_FILE_DEFAULT "trace.bin"
+#define BREAK_OPTIONS_MAX 64    // --break options
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-e switch|threaded|jit|simd|block|aot] [-n max_steps] [-t inst|regs|mem] [-o trace_file]\n"
+           "          [--stats[=text|json]] [--stats-file=file] [--profile[=top]] [--folded=file]\n"
+           "          [--save=snapshot] [--memory=words] [--checked] [--mmap] [--io[=base]]\n"
+           "          [--disk=file] [--record=log] [--replay=log] [--back=steps] [--checkpoint=steps]\n"
+           "          [--gdb=socket|-] [--break=pc]... [--watch=addr[,words][:r|w|rw]]...\n"
+           "          <program_file> | --restore=snapshot\n"
+           "       %s [-e engine] [-n max_steps] [--stats[=text|json]] [--stats-file=file]\n"
+           "          --cores=N [--interleave=slice]\n"
+           "          <program_file> | --restore=snapshot\n"
+           "       %s [-e engine] [-j threads] [-n max_steps] <program_file> <data_image>...\n"
+           "       %s [-e engine] [-j threads] [-n max_steps] --restore=snapshot <data_image>...\n"
+           "       %s -d <trace_file>\n"
+           "Tracing can also be enabled with EMU_TRACE=<level> and EMU_TRACE_FILE=<file>.\n"
+           "With data images the program runs once per image on a thread pool and\n"
+           "each final data memory is written back to <data_image>.out; -e simd runs\n"
+           "groups of images in lockstep.\n"
+           "--stats prints instruction counts and MIPS after the run; per-opcode and\n"
+           "branch counters need a build with make STATS=1. --stats=json writes one JSON\n"
+           "object to stderr, and --stats-file writes the report to a file instead.\n"
+           "--profile prints the hottest PCs with their disassembly; --folded writes\n"
+           "guest call stacks in flamegraph folded format.\n"
+           "-n stops every run after max_steps instructions; the exit status is 2\n"
+           "when a run hits that limit.\n"
+           "--save writes the CPU state to a snapshot when the run stops; --restore starts\n"
+           "from one instead of a program file.\n"
+           "--memory sets the words per memory space (default 256, up to 65536; a power\n"
+           "of two unless --checked). Addresses wrap around by default; --checked stops\n"
+           "with a fault on an access or jump outside memory instead. --mmap backs\n"
+           "instruction memory with anonymous mmap instead of the heap.\n"
+           "The program file is mapped, not read; an object file (emulator/loader.h)\n"
+           "also sets the memory size, entry PC and initial data memory.\n"
+           "--io maps the console, timer and (with --disk) block devices into data memory\n"
+           "at base (default 0xFFE0, which needs --checked or --memory=65536); see\n"
+           "emulator/bus.h for the registers.\n"
+           "TRAP host calls (emulator/emulator.h) write buffered output to stdout and read\n"
+           "numbers from stdin; TRAP_EXIT sets the exit status. Data image runs have no\n"
+           "host, so their TRAPs other than TRAP_EXIT fault.\n"
+           "--record writes device reads, TRAP input and raised interrupts to a log;\n"
+           "--replay feeds them back from one, then continues live (and --record can\n"
+           "extend it). --back then rewinds the finished run by that many instructions\n"
+           "from checkpoints taken every --checkpoint instructions (default %u) and\n"
+           "dumps that state instead; the exit status is still that of the run.\n"
+           "--gdb waits for GDB on a Unix socket, or talks to it on stdin/stdout with\n"
+           "--gdb=- (target remote | %s --gdb=- prog.bin), and runs the program under\n"
+           "its control; see emulator/gdb.h.\n"
+           "--break stops the run before the instruction at pc, --watch before a STORE\n"
+           "(w, the default), LOAD (r) or either (rw) to words data addresses from addr;\n"
+           "the exit status is then 3. Restoring a snapshot --saved there with the\n"
+           "same options resumes past it.\n"
+           "--cores runs the program on N cores (up to %d) with their own registers and\n"
+           "PC, sharing one data memory; CSR reads a core's index (%d) and the count (%d)\n"
+           "and CAS updates a data word atomically. Each core runs on a host thread of\n"
+           "its own, with its TRAP output written core by core at the end, or with\n"
+           "--interleave the cores take turns of slice instructions on one thread, the\n"
+           "same way on every run. --stats then counts the instructions of all cores.\n",
+           prog, prog, prog, prog, prog, REPLAY_INTERVAL_DEFAULT, prog,
+           MACHINE_CORES_MAX, CSR_CORE, CSR_CORES);
+}
+
+// Run the loaded program over every data image given on the command line
+static int run_images(cpu_t *cpu, int engine, int threads, uint64_t max_steps,
+                      char **files, int count)
+{
+    size_t words = cpu->mem_words;
+    uint16_t *images = calloc(count * words, sizeof(uint16_t));
+    struct cpu_result_st *results = calloc(count, sizeof(*results));
+    int limited = 0;
+    int ret = 1;
+
+    if (!images || !results) {
+        fprintf(stderr, "Out of memory\n");
+        goto out;
+    }
+
+    for (int i = 0; i < count; i++) {
+        // Words past the end of the file stay zero
+        if (cpu_data_write(cpu, images + i * words, words) != 0 || cpu_load_data(cpu, files[i]) < 0) {
+            fprintf(stderr, "Failed to load data image: %s\n", files[i]);
+            goto out;
+        }
+        cpu_data_read(cpu, images + i * words);
+    }
+
+    if (cpu_exec_images(cpu, images, count, engine, threads, max_steps, results) != 0) {
+        fprintf(stderr, "Batch execution failed\n");
+        goto out;
+    }
+
+    for (int i = 0; i < count; i++) {
+        char name[1024];
+        snprintf(name, sizeof(name), "%s.out", files[i]);
+        FILE *file = fopen(name, "wb");
+        if (!file) {
+            fprintf(stderr, "Unable to write: %s\n", name);
+            goto out;
+        }
+        fwrite(images + i * words, sizeof(uint16_t), words, file);
+        fclose(file);
+
+        printf("%s: %s at PC 0x%04X, %llu steps, Regs(R0-7):", files[i],
+               cpu_status_name(results[i].status),
+               results[i].pc, (unsigned long long)results[i].steps);
+        for (int r = 0; r < NUM_REGISTERS; r++) {
+            printf(" 0x%04X", results[i].regs[r]);
+        }
+        printf("\n");
+        limited |= results[i].status == CPU_BUDGET;
+    }
+    ret = limited ? 2 : 0;
+
+out:
+    free(images);
+    free(results);
+    return ret;
+}
+
+// --watch=addr[,words][:r|w|rw]
+static int parse_watch(const char *arg, struct debug_watch_st *watch)
+{
+    char *end;
+
+    watch->addr = strtoul(arg, &end, 0) & 0xFFFF;
+    watch->words = *end == ',' ? strtoul(end + 1, &end, 0) : 1;
+    watch->type = WATCH_WRITE;
+    if (*end == ':') {
+        end++;
+        if (strcmp(end, "r") == 0) {
+            watch->type = WATCH_READ;
+        } else if (strcmp(end, "rw") == 0) {
+            watch->type = WATCH_ACCESS;
+        } else if (strcmp(end, "w") != 0) {
+            return -1;
+        }
+    } else if (*end) {
+        return -1;
+    }
+    return 0;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * The --stats report: to --stats-file when given, else text to stdout after
+ * the dump and JSON to stderr, so a tool reads it without the dump around it
+ */
+static void print_stats(const cpu_t *cpu, int format, const char *file, double seconds)
+{
+    FILE *out = format == STATS_JSON ? stderr : stdout;
+
+    if (file && !(out = fopen(file, "w"))) {
+        fprintf(stderr, "Unable to write: %s\n", file);
+        return;
+    }
+    cpu_stats_print(cpu, out, format, seconds);
+    if (file) {
+        fclose(out);
+    }
+}
+
+// Run the loaded program on count cores sharing its data memory
+static int run_machine(cpu_t *cpu, int engine, int count, uint64_t slice, uint64_t max_steps,
+                       int stats, const char *stats_file)
+{
+    struct machine_st machine;
+    struct cpu_result_st results[MACHINE_CORES_MAX];
+    int limited = 0;
+    int exit_code = 0;
+
+    struct host_st *host = host_create(stdout, stdin);
+    if (!host) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    cpu_set_host(cpu, host);
+    if (machine_init(&machine, cpu, count) != 0) {
+        fprintf(stderr, "Failed to create a machine of %d cores\n", count);
+        return 1;
+    }
+
+    double start = now();
+    int ret = machine_run(&machine, engine, slice, max_steps, results);
+    double elapsed = now() - start;
+
+    // Guest output first, then the dumps and reports
+    host_destroy(host);
+    cpu_set_host(cpu, NULL);
+    if (ret != 0) {
+        fprintf(stderr, "Machine execution failed\n");
+        machine_release(&machine);
+        return 1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        printf("Core %d: %s after %llu steps\n", i, cpu_status_name(results[i].status),
+               (unsigned long long)results[i].steps);
+        cpu_dump(machine.cores[i]);
+        limited |= results[i].status == CPU_BUDGET;
+        if (!exit_code) {
+            exit_code = cpu_exit_code(machine.cores[i]);
+        }
+    }
+    if (stats >= 0) {
+        cpu_t total;
+        machine_total(&machine, &total);
+        print_stats(&total, stats, stats_file, elapsed);
+    }
+    machine_release(&machine);
+
+    if (limited) {
+        printf("Step limit reached.\n");
+        return 2;
+    }
+    printf("Program executed successfully.\n");
+    return exit_code;
+}
 
 int main(int argc, char** argv)
 {
+    static const struct option long_options[] = {
+        { "stats", optional_argument, NULL, 'S' },
+        { "stats-file", required_argument, NULL, 'Q' },
+        { "profile", optional_argument, NULL, 'P' },
+        { "folded", required_argument, NULL, 'F' },
+        { "save", required_argument, NULL, 'W' },
+        { "restore", required_argument, NULL, 'R' },
+        { "memory", required_argument, NULL, 'M' },
+        { "checked", no_argument, NULL, 'C' },
+        { "mmap", no_argument, NULL, 'A' },
+        { "io", optional_argument, NULL, 'I' },
+        { "disk", required_argument, NULL, 'K' },
+        { "record", required_argument, NULL, 'O' },
+        { "replay", required_argument, NULL, 'Y' },
+        { "back", required_argument, NULL, 'B' },
+        { "checkpoint", required_argument, NULL, 'T' },
+        { "gdb", required_argument, NULL, 'G' },
+        { "break", required_argument, NULL, 'X' },
+        { "watch", required_argument, NULL, 'Z' },
+        { "cores", required_argument, NULL, 'N' },
+        { "interleave", required_argument, NULL, 'L' },
+        { NULL, 0, NULL, 0 },
+    };
     cpu_t cpu;
+    struct cpu_config_st config = CPU_CONFIG_DEFAULT;
+    long io_base = -1;
+    const char *disk_file = NULL;
+    const char *record_file = NULL;
+    const char *replay_file = NULL;
+    uint64_t back = 0;
+    uint64_t interval = 0;
+    const char *gdb_addr = NULL;
+    uint16_t break_pcs[BREAK_OPTIONS_MAX];
+    int breaks = 0;
+    struct debug_watch_st watches[DEBUG_WATCH_MAX];
+    int watch_count = 0;
+    int engine = CPU_ENGINE_DEFAULT;
+    int threads = 0;
+    int cores = 0;
+    uint64_t slice = 0;
+    uint64_t max_steps = CPU_STEPS_UNLIMITED;
+    int stats = -1;
+    const char *stats_file = NULL;
+    int profile_top = -1;
+    const char *folded_file = NULL;
+    const char *save_file = NULL;
+    const char *restore_file = NULL;
+    int trace_level = TRACE_OFF;
+    const char *trace_file = getenv("EMU_TRACE_FILE");
+    const char *env;
+    int opt;
+
+    if ((env = getenv("EMU_TRACE")) != NULL && (trace_level = trace_level_parse(env)) < 0) {
+        fprintf(stderr, "Unknown trace level: %s\n", env);
+        return 1;
+    }
+
+    while ((opt = getopt_long(argc, argv, "e:j:n:t:o:d:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'e':
+                engine = cpu_engine_parse(optarg);
+                if (engine < 0) {
+                    fprintf(stderr, "Unknown engine: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'n':
+                max_steps = strtoull(optarg, NULL, 0);
+                break;
+            case 't':
+                trace_level = trace_level_parse(optarg);
+                if (trace_level < 0) {
+                    fprintf(stderr, "Unknown trace level: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'o':
+                trace_file = optarg;
+                break;
+            case 'S':
+                if (!optarg || strcmp(optarg, "text") == 0) {
+                    stats = STATS_TEXT;
+                } else if (strcmp(optarg, "json") == 0) {
+                    stats = STATS_JSON;
+                } else {
+                    fprintf(stderr, "Unknown stats format: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'Q':
+                stats_file = optarg;
+                break;
+            case 'P':
+                profile_top = optarg ? atoi(optarg) : 20;
+                break;
+            case 'F':
+                folded_file = optarg;
+                break;
+            case 'W':
+                save_file = optarg;
+                break;
+            case 'R':
+                restore_file = optarg;
+                break;
+            case 'M':
+                config.mem_words = strtoul(optarg, NULL, 0);
+                break;
+            case 'C':
+                config.checked = 1;
+                break;
+            case 'A':
+                config.backing = CPU_BACKING_MMAP;
+                break;
+            case 'I':
+                io_base = optarg ? strtol(optarg, NULL, 0) & 0xFFFF : IO_BASE_DEFAULT;
+                break;
+            case 'K':
+                disk_file = optarg;
+                break;
+            case 'O':
+                record_file = optarg;
+                break;
+            case 'Y':
+                replay_file = optarg;
+                break;
+            case 'B':
+                back = strtoull(optarg, NULL, 0);
+                break;
+            case 'T':
+                interval = strtoull(optarg, NULL, 0);
+                break;
+            case 'G':
+                gdb_addr = optarg;
+                break;
+            case 'X':
+                if (breaks == BREAK_OPTIONS_MAX) {
+                    fprintf(stderr, "Too many breakpoints\n");
+                    return 1;
+                }
+                break_pcs[breaks++] = strtoul(optarg, NULL, 0) & 0xFFFF;
+                break;
+            case 'Z':
+                if (watch_count == DEBUG_WATCH_MAX) {
+                    fprintf(stderr, "Too many watchpoints\n");
+                    return 1;
+                }
+                if (parse_watch(optarg, &watches[watch_count++]) != 0) {
+                    fprintf(stderr, "Bad watchpoint: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'N':
+                cores = atoi(optarg);
+                if (cores < 1 || cores > MACHINE_CORES_MAX) {
+                    fprintf(stderr, "Cores must be 1 to %d\n", MACHINE_CORES_MAX);
+                    return 1;
+                }
+                break;
+            case 'L':
+                slice = strtoull(optarg, NULL, 0);
+                if (slice == 0) {
+                    fprintf(stderr, "Bad interleave slice: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'd':
+                if (trace_print(optarg, stdout) < 0) {
+                    fprintf(stderr, "Failed to read trace: %s\n", optarg);
+                    return 1;
+                }
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (stats_file && stats < 0) {
+        stats = STATS_TEXT;
+    }
+
+    if (optind >= argc && !restore_file) {
+        usage(argv[0]);
+        return 1;
+    }
 
-    if (argc < 2) {
-        printf("Usage: %s <program_file>\n", argv[0]);
+    if (cpu_init_config(&cpu, &config) != 0) {
+        fprintf(stderr, "Failed to initialize CPU with %u words of memory\n", config.mem_words);
         return 1;
     }
 
-    if (cpu_init(&cpu) != 0) {
-        fprintf(stderr, "Failed to initialize CPU\n");
+    if (restore_file) {
+        // The snapshot replaces the program file; remaining arguments are images
+        if (cpu_snapshot_restore(&cpu, restore_file) != 0) {
+            fprintf(stderr, "Failed to restore snapshot: %s\n", restore_file);
+            return 1;
+        }
+        optind--;
+    } else if (cpu_map_program(&cpu, argv[optind]) < 0) {
+        fprintf(stderr, "Failed to load program: %s\n", argv[optind]);
         return 1;
     }
 
-    if (cpu_load_program(&cpu, argv[1]) < 0) {
-        fprintf(stderr, "Failed to load program: %s\n", argv[1]);
+    if (cores) {
+        if (optind + 1 < argc || io_base >= 0 || trace_level != TRACE_OFF || profile_top >= 0 || folded_file
+            || save_file || record_file || replay_file || back || gdb_addr || breaks || watch_count) {
+            fprintf(stderr, "--cores cannot be used with data images, --io, tracing, profiles, --save,\n"
+                    "--record, --replay, --back, --gdb, --break or --watch\n");
+            return 1;
+        }
+        int ret = run_machine(&cpu, engine, cores, slice, max_steps, stats, stats_file);
+        cpu_release(&cpu);
+        return ret;
+    }
+    if (slice) {
+        fprintf(stderr, "--interleave needs --cores\n");
         return 1;
     }
 
-    cpu_exec(&cpu);
+    if (optind + 1 < argc) {
+        if (io_base >= 0) {
+            fprintf(stderr, "--io cannot be used with data images\n");
+            return 1;
+        }
+        if (record_file || replay_file || back || gdb_addr || breaks || watch_count) {
+            fprintf(stderr, "--record, --replay, --back, --gdb, --break and --watch cannot be used with data images\n");
+            return 1;
+        }
+        int ret = run_images(&cpu, engine, threads, max_steps, &argv[optind + 1], argc - optind - 1);
+        cpu_release(&cpu);
+        return ret;
+    }
+
+    struct trace_st *trace = NULL;
+    if (trace_level != TRACE_OFF) {
+        if (!trace_file) {
+            trace_file = TRACE_FILE_DEFAULT;
+        }
+        trace = trace_open(trace_file, trace_level);
+        if (!trace) {
+            fprintf(stderr, "Failed to open trace file: %s\n", trace_file);
+            return 1;
+        }
+        cpu_set_trace(&cpu, trace);
+    }
+
+    struct bus_st *bus = NULL;
+    if (io_base >= 0) {
+        bus = bus_create();
+        if (!bus || bus_map_standard(bus, io_base, disk_file) != 0) {
+            fprintf(stderr, "Failed to map devices at 0x%04lX\n", io_base);
+            return 1;
+        }
+        cpu_set_bus(&cpu, bus);
+    }
+
+    // Before the host: GDB on stdin/stdout moves the program's output to stderr
+    struct gdb_st *gdb = NULL;
+    if (gdb_addr && !(gdb = gdb_open(gdb_addr))) {
+        fprintf(stderr, "Failed to open GDB connection: %s\n", gdb_addr);
+        return 1;
+    }
+
+    struct debug_st *debug = NULL;
+    if (gdb || breaks || watch_count) {
+        debug = debug_create();
+        if (!debug) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+        cpu_set_debug(&cpu, debug);
+        for (int i = 0; i < breaks; i++) {
+            cpu_break_insert(&cpu, break_pcs[i]);
+        }
+        for (int i = 0; i < watch_count; i++) {
+            if (cpu_watch_insert(&cpu, watches[i].addr, watches[i].words, watches[i].type) != 0) {
+                fprintf(stderr, "Bad watchpoint range: 0x%04X,%u\n", watches[i].addr, watches[i].words);
+                return 1;
+            }
+        }
+    }
 
+    struct host_st *host = host_create(stdout, stdin);
+    if (!host) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    cpu_set_host(&cpu, host);
+
+    struct profile_st *profile = NULL;
+    if (profile_top >= 0 || folded_file) {
+        profile = profile_create(folded_file != NULL);
+        if (!profile) {
+            fprintf(stderr, "Failed to create profile\n");
+            return 1;
+        }
+        cpu_set_profile(&cpu, profile);
+    }
+
+    struct replay_st *replay = NULL;
+    // Under GDB the checkpoints give reverse execution
+    if (record_file || replay_file || back || gdb) {
+        replay = replay_create(interval);
+        if (!replay) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+        if (replay_file && replay_load(replay, replay_file) != 0) {
+            fprintf(stderr, "Failed to load replay log: %s\n", replay_file);
+            return 1;
+        }
+        cpu_set_replay(&cpu, replay);
+    }
+
+    double start = now();
+    int status;
+    int rewound = 0;                // --back moved the CPU; the run stopped as below
+    int run_limited = 0;
+    int run_exit_code = 0;
+    if (gdb) {
+        uint64_t first = cpu.steps;
+        int end = gdb_serve(gdb, &cpu, engine, max_steps);
+        gdb_close(gdb);
+        status = cpu_status(&cpu);
+        if (end == GDB_DETACHED && cpu.steps - first < max_steps) {
+            status = cpu_run(&cpu, engine, max_steps - (cpu.steps - first));
+        }
+    } else {
+        status = cpu_run(&cpu, engine, max_steps);
+    }
+    double elapsed = now() - start;
+
+    if (replay) {
+        if (replay->diverged) {
+            fprintf(stderr, "Run diverged from replay log: %s\n", replay_file);
+        } else if (cpu.steps < replay->steps) {
+            fprintf(stderr, "Run stopped after %llu steps, before the end of replay log %s at %llu\n",
+                    (unsigned long long)cpu.steps, replay_file, (unsigned long long)replay->steps);
+        }
+        if (record_file && replay_save(replay, record_file, cpu.steps) != 0) {
+            fprintf(stderr, "Unable to write replay log: %s\n", record_file);
+        }
+        if (back) {
+            // The host stays attached: a rewound TRAP_GETN takes its logged value
+            uint64_t target = cpu.steps > back ? cpu.steps - back : 0;
+            run_limited = status == CPU_BUDGET;
+            run_exit_code = cpu_exit_code(&cpu);
+            status = replay_seek(&cpu, engine, target);
+            if (status < 0) {
+                fprintf(stderr, "No checkpoint before step %llu\n", (unsigned long long)target);
+                return 1;
+            }
+            rewound = 1;
+        }
+    }
+
+    // Guest output first, then the dump and reports
+    host_destroy(host);
+    cpu_set_host(&cpu, NULL);
+    trace_close(trace);
+    if (save_file && cpu_snapshot_save(&cpu, save_file) != 0) {
+        fprintf(stderr, "Unable to write snapshot: %s\n", save_file);
+    }
+    cpu_dump(&cpu);
+    if (stats >= 0) {
+        print_stats(&cpu, stats, stats_file, elapsed);
+    }
+    if (profile && profile_top >= 0) {
+        profile_report(profile, &cpu, stdout, profile_top);
+    }
+    if (profile && folded_file) {
+        FILE *file = fopen(folded_file, "w");
+        if (!file) {
+            fprintf(stderr, "Unable to write: %s\n", folded_file);
+        } else {
+            profile_write_folded(profile, file);
+            fclose(file);
+        }
+    }
+    if (status == CPU_BREAK) {
+        printf("Breakpoint at PC 0x%04X after %llu steps.\n", cpu.pc, (unsigned long long)cpu.steps);
+    } else if (status == CPU_WATCH) {
+        uint16_t addr;
+        int type = cpu_watch_hit(&cpu, &addr);
+        printf("Watchpoint: %s of 0x%04X at PC 0x%04X after %llu steps.\n", type & WATCH_WRITE ? "STORE" : "LOAD",
+               addr, cpu.pc, (unsigned long long)cpu.steps);
+    }
+    profile_destroy(profile);
+    replay_destroy(replay);
+    cpu_set_debug(&cpu, NULL);
+    debug_destroy(debug);
+    bus_destroy(bus);
+    int exit_code = cpu_exit_code(&cpu);
+    cpu_release(&cpu);
+
+    if (rewound && status == CPU_BUDGET) {
+        // Where --back asked to stop; the exit status is still the run's
+        printf("Rewound to step %llu.\n", (unsigned long long)cpu.steps);
+        return run_limited ? 2 : run_exit_code;
+    }
+    if (status == CPU_BUDGET) {
+        printf("Step limit reached after %llu steps.\n", (unsigned long long)cpu.steps);
+        return 2;
+    }
+    if (status == CPU_BREAK || status == CPU_WATCH) {
+        return 3;
+    }
     printf("Program executed successfully.\n");
-    return 0;
-}
\ No newline at end of file
+    return exit_code;
+}
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "opcodes.h"
+#include "emulator.h"
+#include "profile.h"
+#include "assembler/assembler.h"
+
+static int profile_node(struct profile_st *profile, int parent, uint16_t entry)
+{
+    for (int i = 0; i < profile->node_count; i++) {
+        if (profile->nodes[i].parent == parent && profile->nodes[i].entry == entry) {
+            return i;
+        }
+    }
+
+    if (profile->node_count == profile->node_capacity) {
+        int capacity = profile->node_capacity ? profile->node_capacity * 2 : 64;
+        struct profile_node_st *nodes = realloc(profile->nodes, capacity * sizeof(*nodes));
+        if (!nodes) {
+            return -1;
+        }
+        profile->nodes = nodes;
+        profile->node_capacity = capacity;
+    }
+
+    struct profile_node_st *node = &profile->nodes[profile->node_count];
+    node->parent = parent;
+    node->entry = entry;
+    node->count = 0;
+    return profile->node_count++;
+}
+
+struct profile_st *profile_create(int fold)
+{
+    struct profile_st *profile = (struct profile_st *)calloc(1, sizeof(struct profile_st));
+    if (!profile) {
+        return NULL;
+    }
+
+    profile->fold = fold;
+    profile->current = -1;
+    return profile;
+}
+
+void profile_destroy(struct profile_st *profile)
+{
+    if (profile) {
+        free(profile->nodes);
+        free(profile);
+    }
+}
+
+static void profile_call_return(struct profile_st *profile, const cpu_t *cpu)
+{
+    const uop_t *uop = &cpu->code[cpu->pc];
+    uint16_t ret = (cpu->pc + 1) & cpu->mem_mask;
+    uint16_t target;
+
+    if (uop->opcode == JUMP) {
+        target = uop->imm & cpu->mem_mask;
+    } else if (uop->opcode == JMPR) {
+        target = (cpu->regs[uop->r1] + uop->imm) & cpu->mem_mask;
+        if (profile->depth > 0 && target == profile->stack[profile->depth - 1]) {
+            profile->depth--;
+            profile->current = profile->nodes[profile->current].parent;
+            return;
+        }
+    } else {
+        return;
+    }
+
+    if (profile->depth == PROFILE_STACK_MAX) {
+        return;
+    }
+    for (int i = 0; i < NUM_REGISTERS; i++) {
+        if (cpu->regs[i] == ret) {
+            int node = profile_node(profile, profile->current, target);
+            if (node >= 0) {
+                profile->stack[profile->depth++] = ret;
+                profile->current = node;
+            }
+            return;
+        }
+    }
+}
+
+void profile_step(struct profile_st *profile, const cpu_t *cpu)
+{
+    profile->counts[cpu->pc]++;
+
+    if (profile->fold) {
+        if (profile->current < 0) {
+            profile->current = profile_node(profile, -1, cpu->pc);
+            if (profile->current < 0) {
+                profile->fold = 0;
+                return;
+            }
+        }
+        profile->nodes[profile->current].count++;
+        profile_call_return(profile, cpu);
+    }
+}
+
+static const uint64_t *s_sort_counts;
+
+static int profile_cmp(const void *a, const void *b)
+{
+    uint64_t ca = s_sort_counts[*(const uint16_t *)a];
+    uint64_t cb = s_sort_counts[*(const uint16_t *)b];
+    if (ca != cb) {
+        return ca < cb ? 1 : -1;
+    }
+    return *(const uint16_t *)a - *(const uint16_t *)b;
+}
+
+// Hot PCs sorted by share of execution, top <= 0 prints all executed PCs
+void profile_report(const struct profile_st *profile, const cpu_t *cpu, FILE *out, int top)
+{
+    uint16_t *order = (uint16_t *)malloc(cpu->mem_words * sizeof(uint16_t));
+    uint64_t total = 0;
+    int n = 0;
+
+    if (!order) {
+        return;
+    }
+    for (uint32_t pc = 0; pc < cpu->mem_words; pc++) {
+        if (profile->counts[pc]) {
+            order[n++] = pc;
+            total += profile->counts[pc];
+        }
+    }
+    s_sort_counts = profile->counts;
+    qsort(order, n, sizeof(order[0]), profile_cmp);
+    if (top > 0 && top < n) {
+        n = top;
+    }
+
+    fprintf(out, "  PC        Count   Share    Cumul  Instruction\n");
+    uint64_t cumulative = 0;
+    for (int i = 0; i < n; i++) {
+        char text[256];
+        uint16_t pc = order[i];
+        cumulative += profile->counts[pc];
+        disassemble(cpu->mem_inst[pc], text);
+        fprintf(out, "0x%04X %10llu %6.2f%% %6.2f%%  %s\n", pc,
+                (unsigned long long)profile->counts[pc],
+                100.0 * profile->counts[pc] / total, 100.0 * cumulative / total, text);
+    }
+    free(order);
+}
+
+static void profile_write_frames(const struct profile_st *profile, FILE *out, int node)
+{
+    const struct profile_node_st *n = &profile->nodes[node];
+    if (n->parent >= 0) {
+        profile_write_frames(profile, out, n->parent);
+        fprintf(out, ";sub_%02X", n->entry);
+    } else {
+        fprintf(out, "main");
+    }
+}
+
+// One "main;sub_XX;sub_YY count" line per call path, for flamegraph.pl
+int profile_write_folded(const struct profile_st *profile, FILE *out)
+{
+    if (!profile->fold) {
+        return -1;
+    }
+
+    for (int i = 0; i < profile->node_count; i++) {
+        if (profile->nodes[i].count) {
+            profile_write_frames(profile, out, i);
+            fprintf(out, " %llu\n", (unsigned long long)profile->nodes[i].count);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef PROFILE_H_20251117_
+#define PROFILE_H_20251117_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "emulator.h"
+
+#define PROFILE_STACK_MAX 64    // Deepest tracked guest call stack
+
+/*
+ * Call tree node for folded-stack output. The ISA has no call instruction,
+ * so calls and returns are guessed: a JUMP/JMPR is a call when a register
+ * holds its return address (pc + 1), and a JMPR is a return when it targets
+ * the return address on top of the shadow stack.
+ */
+struct profile_node_st {
+    int parent;                 // Index of the caller node, -1 for the root
+    uint16_t entry;             // Entry PC of the frame
+    uint64_t count;             // Instructions executed in this frame
+};
+
+struct profile_st {
+    uint64_t counts[MEMORY_MAX];            // Executions per PC
+    int fold;                               // Track the call tree
+    int current;                            // Node of the running frame
+    int depth;
+    uint16_t stack[PROFILE_STACK_MAX];      // Shadow return addresses
+    int node_count;
+    int node_capacity;
+    struct profile_node_st *nodes;
+};
+
+struct profile_st *profile_create(int fold);
+void profile_destroy(struct profile_st *profile);
+void profile_step(struct profile_st *profile, const cpu_t *cpu);
+void profile_report(const struct profile_st *profile, const cpu_t *cpu, FILE *out, int top);
+int profile_write_folded(const struct profile_st *profile, FILE *out);
+
+#endif  // PROFILE_H_20251117_
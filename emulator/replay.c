@@ -0,0 +1,369 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emulator.h"
+#include "replay.h"
+
+_Static_assert(sizeof(struct replay_header_st) == 24, "replay header layout");
+
+struct replay_st *replay_create(uint64_t interval)
+{
+    struct replay_st *replay = (struct replay_st *)calloc(1, sizeof(struct replay_st));
+    if (replay) {
+        replay->interval = interval ? interval : REPLAY_INTERVAL_DEFAULT;
+    }
+    return replay;
+}
+
+void replay_destroy(struct replay_st *replay)
+{
+    if (replay) {
+        for (int i = 0; i < replay->checkpoints; i++) {
+            cpu_release(&replay->checkpoint[i].cpu);
+        }
+        free(replay->events);
+        free(replay);
+    }
+}
+
+static int replay_push(struct replay_st *replay, const struct replay_event_st *event)
+{
+    if (replay->count == replay->capacity) {
+        uint32_t capacity = replay->capacity ? replay->capacity * 2 : 1024;
+        struct replay_event_st *events = realloc(replay->events, capacity * sizeof(*events));
+        if (!events) {
+            return -1;
+        }
+        replay->events = events;
+        replay->capacity = capacity;
+    }
+    replay->events[replay->count++] = *event;
+    return 0;
+}
+
+static void put_leb128(FILE *file, uint64_t value)
+{
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        putc(value ? byte | 0x80 : byte, file);
+    } while (value);
+}
+
+static int get_leb128(FILE *file, uint64_t *value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = getc(file);
+        if (c == EOF) {
+            return -1;
+        }
+        *value |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Append the events of a log file to replay. An interrupt logged past the
+ * instruction count the log covers means a corrupt file.
+ */
+int replay_load(struct replay_st *replay, const char *filename)
+{
+    struct replay_header_st header;
+    uint64_t irq_steps = 0;
+    int ret = -1;
+
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        return -1;
+    }
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || memcmp(header.magic, REPLAY_MAGIC, 4) != 0 || header.version != REPLAY_VERSION) {
+        goto out;
+    }
+
+    for (uint32_t i = 0; i < header.count; i++) {
+        struct replay_event_st event = { 0 };
+        uint64_t a = 0, b = 0;
+        int c = getc(file);
+
+        event.kind = c & 0x0F;
+        switch (event.kind) {
+            case REPLAY_READ:
+                if (get_leb128(file, &a) != 0 || get_leb128(file, &b) != 0) {
+                    goto out;
+                }
+                event.addr = a;
+                event.value = b;
+                break;
+            case REPLAY_GETN:
+                if (get_leb128(file, &b) != 0) {
+                    goto out;
+                }
+                event.value = b;
+                break;
+            case REPLAY_IRQ:
+                if (get_leb128(file, &a) != 0) {
+                    goto out;
+                }
+                irq_steps += a;
+                if (irq_steps > header.steps) {
+                    goto out;
+                }
+                event.steps = irq_steps;
+                event.value = (c >> 4) & (IRQ_LINES - 1);
+                break;
+            default:
+                goto out;
+        }
+        if (replay_push(replay, &event) != 0) {
+            goto out;
+        }
+    }
+    if (header.steps > replay->steps) {
+        replay->steps = header.steps;
+    }
+    ret = 0;
+
+out:
+    fclose(file);
+    return ret;
+}
+
+// Write the whole log; steps is the instruction count it covers
+int replay_save(const struct replay_st *replay, const char *filename, uint64_t steps)
+{
+    struct replay_header_st header = {
+        .magic = REPLAY_MAGIC,
+        .version = REPLAY_VERSION,
+        .count = replay->count,
+        .steps = steps,
+    };
+    uint64_t irq_steps = 0;
+
+    FILE *file = fopen(filename, "wb");
+    if (!file) {
+        return -1;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    for (uint32_t i = 0; i < replay->count; i++) {
+        const struct replay_event_st *event = &replay->events[i];
+        switch (event->kind) {
+            case REPLAY_READ:
+                putc(REPLAY_READ, file);
+                put_leb128(file, event->addr);
+                put_leb128(file, event->value);
+                break;
+            case REPLAY_GETN:
+                putc(REPLAY_GETN, file);
+                put_leb128(file, event->value);
+                break;
+            case REPLAY_IRQ:
+                putc(REPLAY_IRQ | event->value << 4, file);
+                put_leb128(file, event->steps - irq_steps);
+                irq_steps = event->steps;
+                break;
+        }
+    }
+    int ret = ferror(file) ? -1 : 0;
+    if (fclose(file) != 0) {
+        ret = -1;
+    }
+    return ret;
+}
+
+/*
+ * Next logged input of this kind and address into *value: returns 1 when
+ * the log supplied it, 0 when the caller must read it live and pass it to
+ * replay_record(). An input that does not match the log ends the replay.
+ */
+int replay_input(struct replay_st *replay, uint8_t kind, uint16_t addr, uint16_t *value)
+{
+    while (replay->input < replay->count && replay->events[replay->input].kind == REPLAY_IRQ) {
+        replay->input++;
+    }
+    if (replay->input == replay->count) {
+        return 0;
+    }
+
+    const struct replay_event_st *event = &replay->events[replay->input];
+    if (event->kind != kind || event->addr != addr) {
+        replay->diverged = 1;
+        replay->input = replay->count;
+        return 0;
+    }
+    *value = event->value;
+    replay->input++;
+    return 1;
+}
+
+void replay_record(struct replay_st *replay, uint8_t kind, uint16_t addr, uint16_t value)
+{
+    struct replay_event_st event = { .kind = kind, .addr = addr, .value = value };
+
+    if (replay_push(replay, &event) == 0) {
+        replay->input = replay->count;
+    }
+}
+
+// cpu_irq_raise() hook: returns 1 when the log raises this interrupt itself
+int replay_irq(struct replay_st *replay, const cpu_t *cpu, int line)
+{
+    while (replay->irq < replay->count && replay->events[replay->irq].kind != REPLAY_IRQ) {
+        replay->irq++;
+    }
+    if (replay->irq < replay->count) {
+        return 1;
+    }
+
+    struct replay_event_st event = { .kind = REPLAY_IRQ, .steps = cpu->steps, .value = line };
+    if (replay_push(replay, &event) == 0) {
+        replay->irq = replay->count;
+    }
+    return 0;
+}
+
+static void replay_checkpoint(struct replay_st *replay, const cpu_t *cpu)
+{
+    if (replay->checkpoints == REPLAY_CHECKPOINTS_MAX) {
+        // Thin out: keep every other checkpoint and space new ones twice as far
+        int kept = 0;
+        for (int i = 0; i < replay->checkpoints; i++) {
+            if (i % 2 == 0) {
+                replay->checkpoint[kept++] = replay->checkpoint[i];
+            } else {
+                cpu_release(&replay->checkpoint[i].cpu);
+            }
+        }
+        replay->checkpoints = kept;
+        replay->interval *= 2;
+    }
+
+    struct replay_checkpoint_st *checkpoint = &replay->checkpoint[replay->checkpoints];
+    if (cpu_fork(&checkpoint->cpu, cpu) != 0) {
+        return;     // No memory for its page table: go on without it
+    }
+    replay->checkpoints++;
+    checkpoint->input = replay->input;
+    checkpoint->irq = replay->irq;
+}
+
+/*
+ * cpu_run() hook before each engine run: raise logged interrupts that are
+ * due and take a checkpoint when one is due. Returns limit, lowered to the
+ * next logged interrupt or checkpoint.
+ */
+uint64_t replay_update(cpu_t *cpu, uint64_t limit)
+{
+    struct replay_st *replay = cpu->replay;
+
+    for (;;) {
+        while (replay->irq < replay->count && replay->events[replay->irq].kind != REPLAY_IRQ) {
+            replay->irq++;
+        }
+        if (replay->irq == replay->count || replay->events[replay->irq].steps > cpu->steps) {
+            break;
+        }
+        cpu->irq.pending |= 1 << replay->events[replay->irq].value;
+        replay->irq++;
+    }
+    if (replay->irq < replay->count && replay->events[replay->irq].steps < limit) {
+        limit = replay->events[replay->irq].steps;
+    }
+
+    if (cpu->steps >= replay->next_checkpoint) {
+        replay_checkpoint(replay, cpu);
+        replay->next_checkpoint = cpu->steps + replay->interval;
+    }
+    if (replay->next_checkpoint < limit) {
+        limit = replay->next_checkpoint;
+    }
+    return limit;
+}
+
+// Continue from a checkpoint, keeping cpu's JIT and block caches, observers and breakpoints
+static int replay_restore(cpu_t *cpu, const struct replay_checkpoint_st *checkpoint)
+{
+    struct replay_st *replay = cpu->replay;
+    struct jit_st *jit = cpu->jit;
+    struct block_cache_st *blocks = cpu->blocks;
+    struct trace_st *trace = cpu->trace;
+    struct profile_st *profile = cpu->profile;
+    struct debug_st *debug = cpu->debug;
+
+    cpu_t restored;
+    if (cpu_fork(&restored, &checkpoint->cpu) != 0) {
+        return -1;
+    }
+    cpu->jit = NULL;
+    cpu->blocks = NULL;
+    cpu_release(cpu);
+    *cpu = restored;
+    cpu->jit = jit;
+    cpu->blocks = blocks;
+    cpu->trace = trace;
+    cpu->profile = profile;
+    cpu->replay = replay;
+    if (debug) {
+        // The checkpoint's code[] carries the breakpoints of its time
+        cpu_set_debug(cpu, debug);
+    }
+    replay->input = checkpoint->input;
+    replay->irq = checkpoint->irq;
+    return 0;
+}
+
+// Run to the given instruction count, through any breakpoints and watchpoints on the way
+static int replay_run(cpu_t *cpu, int engine, uint64_t steps)
+{
+    int status;
+
+    do {
+        status = cpu_run(cpu, engine, steps - cpu->steps);
+    } while ((status == CPU_BREAK || status == CPU_WATCH) && cpu->steps < steps);
+    return status;
+}
+
+/*
+ * Move cpu to the given instruction count: backwards by restoring the
+ * last checkpoint at or before it and re-executing, forwards by running.
+ * Re-executed history is muted (no device writes or TRAP output); new
+ * ground past the starting point runs normally. Returns the enum
+ * cpu_status where it stopped, which is short of steps if the program
+ * halts or faults first, or -1 without a usable checkpoint.
+ */
+int replay_seek(cpu_t *cpu, int engine, uint64_t steps)
+{
+    struct replay_st *replay = cpu->replay;
+    uint64_t from = cpu->steps;
+    int status;
+
+    if (!replay) {
+        return -1;
+    }
+    if (steps < cpu->steps) {
+        int i = replay->checkpoints - 1;
+        while (i >= 0 && replay->checkpoint[i].cpu.steps > steps) {
+            i--;
+        }
+        if (i < 0 || replay_restore(cpu, &replay->checkpoint[i]) != 0) {
+            return -1;
+        }
+    }
+
+    // Even a zero-step cpu_run() takes a ready interrupt, so only run to move
+    status = cpu_status(cpu);
+    if (steps > cpu->steps && from > cpu->steps) {
+        replay->seeking = 1;
+        status = replay_run(cpu, engine, steps < from ? steps : from);
+        replay->seeking = 0;
+    }
+    if (steps > cpu->steps && cpu->steps >= from) {
+        status = replay_run(cpu, engine, steps);
+    }
+    return status;
+}
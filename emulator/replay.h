@@ -0,0 +1,90 @@
+#ifndef REPLAY_H_20251117_
+#define REPLAY_H_20251117_
+
+#include <stdint.h>
+
+#include "emulator.h"
+
+/*
+ * Record/replay of the inputs that make a run non-deterministic: device
+ * reads, TRAP_GETN input and interrupts raised from outside with
+ * cpu_irq_raise(). Everything else, the instruction timer included, is a
+ * function of the program and these inputs.
+ * A log is consumed from the start while it lasts: each device read or
+ * TRAP input takes the next logged value instead of asking the device or
+ * host, and each logged interrupt is raised again at its instruction
+ * count. Past the end of the log the CPU runs live and new inputs are
+ * appended, so recording is replaying an empty log. Replaying needs the
+ * same devices mapped as the recording; device writes still happen.
+ * While attached, cpu_run() also keeps copy-on-write checkpoints of the
+ * CPU (cpu_fork) every interval instructions; replay_seek() goes back to
+ * the nearest one and re-executes from there.
+ */
+#define REPLAY_MAGIC "RPLY"
+#define REPLAY_VERSION 1
+
+#define REPLAY_INTERVAL_DEFAULT (1u << 20)  // Instructions between checkpoints
+#define REPLAY_CHECKPOINTS_MAX 64           // When full, every other one is dropped
+
+enum replay_kind {
+    REPLAY_READ,                // Device read: address, value
+    REPLAY_GETN,                // TRAP_GETN input: value
+    REPLAY_IRQ,                 // cpu_irq_raise(): instruction count, line
+};
+
+/*
+ * Log file: the header, then count events. Each event is a kind byte
+ * (REPLAY_IRQ also carries the line in bits 4-6) followed by LEB128
+ * fields: READ address and value, GETN value, IRQ instruction count as
+ * the delta from the previous IRQ.
+ */
+struct replay_header_st {
+    char magic[4];                  // REPLAY_MAGIC
+    uint8_t version;                // REPLAY_VERSION
+    uint8_t reserved[3];
+    uint32_t count;                 // Events
+    uint64_t steps;                 // Instructions retired when the log was saved
+};
+
+struct replay_event_st {
+    uint64_t steps;                 // REPLAY_IRQ: cpu->steps when raised
+    uint16_t addr;                  // REPLAY_READ: device address
+    uint16_t value;                 // Value read, or the IRQ line
+    uint8_t kind;                   // enum replay_kind
+};
+
+struct replay_checkpoint_st {
+    cpu_t cpu;                      // Fork sharing memories copy-on-write
+    uint32_t input;                 // Cursors at that point
+    uint32_t irq;
+};
+
+struct replay_st {
+    struct replay_event_st *events;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t input;                 // Next READ/GETN event to replay
+    uint32_t irq;                   // Next IRQ event to replay
+    uint8_t diverged;               // An input did not match the log; the rest ran live
+    uint8_t seeking;                // replay_seek() re-executing: device writes and output muted
+    uint64_t steps;                 // Instructions the loaded log covers, 0 when none
+    uint64_t interval;              // Instructions between checkpoints
+    uint64_t next_checkpoint;       // cpu->steps of the next checkpoint
+    int checkpoints;
+    struct replay_checkpoint_st checkpoint[REPLAY_CHECKPOINTS_MAX];
+};
+
+// Device writes and TRAP output are skipped while replay_seek() re-executes
+#define cpu_replay_muted(cpu) ((cpu)->replay && (cpu)->replay->seeking)
+
+struct replay_st *replay_create(uint64_t interval);
+void replay_destroy(struct replay_st *replay);
+int replay_load(struct replay_st *replay, const char *filename);
+int replay_save(const struct replay_st *replay, const char *filename, uint64_t steps);
+int replay_input(struct replay_st *replay, uint8_t kind, uint16_t addr, uint16_t *value);
+void replay_record(struct replay_st *replay, uint8_t kind, uint16_t addr, uint16_t value);
+int replay_irq(struct replay_st *replay, const cpu_t *cpu, int line);
+uint64_t replay_update(cpu_t *cpu, uint64_t limit);
+int replay_seek(cpu_t *cpu, int engine, uint64_t steps);
+
+#endif  // REPLAY_H_20251117_
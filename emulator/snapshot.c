@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "emulator.h"
+#include "loader.h"
+#include "snapshot.h"
+
+_Static_assert(sizeof(struct snapshot_header_st) == 64, "snapshot header layout");
+
+#define SNAPSHOT_SIZE(words) (sizeof(struct snapshot_header_st) + 2 * (size_t)(words) * sizeof(uint16_t))
+
+int cpu_snapshot_save(const cpu_t *cpu, const char *filename)
+{
+    struct snapshot_header_st header = {
+        .magic = SNAPSHOT_MAGIC,
+        .version = SNAPSHOT_VERSION,
+        .checked = cpu_checked(cpu),
+        .words = cpu->mem_words,
+        .steps = cpu->steps,
+        .pc = cpu->pc,
+        .flags = cpu->nf << 2 | cpu->zf << 1 | cpu->cf,
+        .irq_next = cpu->irq.next,
+        .irq_period = cpu->irq.period,
+        .irq_vectors = cpu->irq.vectors,
+        .irq_epc = cpu->irq.epc,
+        .irq_eflags = cpu->irq.eflags,
+        .irq_ie = cpu->irq.ie,
+        .irq_mask = cpu->irq.mask,
+        .irq_pending = cpu->irq.pending,
+    };
+    memcpy(header.regs, cpu->regs, sizeof(header.regs));
+
+    FILE *file = fopen(filename, "wb");
+    if (!file) {
+        return -1;
+    }
+
+    int ret = 0;
+    if (fwrite(&header, sizeof(header), 1, file) != 1
+        || fwrite(cpu->mem_inst, sizeof(uint16_t), cpu->mem_words, file) != cpu->mem_words) {
+        ret = -1;
+    }
+    for (uint32_t addr = 0; ret == 0 && addr < cpu->mem_words; addr += CPU_PAGE_WORDS) {
+        uint32_t n = cpu->mem_words - addr < CPU_PAGE_WORDS ? cpu->mem_words - addr : CPU_PAGE_WORDS;
+        if (fwrite(cpu->mem_data[addr >> CPU_PAGE_SHIFT], sizeof(uint16_t), n, file) != n) {
+            ret = -1;
+        }
+    }
+    if (fclose(file) != 0) {
+        ret = -1;
+    }
+    return ret;
+}
+
+/*
+ * Map the snapshot into cpu instead of reading it: both memories point
+ * straight into private mappings of the file (cpu_map_text, cpu_map_data),
+ * so restoring copies no memory and a page is only copied when it is
+ * written. The file size is checked against the
+ * header first, so a short file leaves cpu untouched. A snapshot of another
+ * memory size or addressing mode reconfigures cpu. Attached trace/profile
+ * state is kept; the predecoded code is invalidated.
+ */
+int cpu_snapshot_restore(cpu_t *cpu, const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct snapshot_header_st header;
+    struct stat st;
+    struct cpu_config_st config;
+    cpu_get_config(cpu, &config);
+    if (fstat(fd, &st) != 0
+        || pread(fd, &header, sizeof(header), 0) != sizeof(header)
+        || memcmp(header.magic, SNAPSHOT_MAGIC, 4) != 0
+        || header.version != SNAPSHOT_VERSION
+        || header.words == 0 || header.words > MEMORY_MAX
+        || (size_t)st.st_size < SNAPSHOT_SIZE(header.words)) {
+        close(fd);
+        return -1;
+    }
+    if (header.words != config.mem_words || header.checked != config.checked) {
+        config.mem_words = header.words;
+        config.checked = header.checked;
+        if (cpu_configure(cpu, &config) != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    size_t text_bytes = header.words * sizeof(uint16_t);
+    if (cpu_map_text(cpu, fd, sizeof(header), header.words, st.st_size) != 0
+        || cpu_map_data(cpu, fd, sizeof(header) + text_bytes) != 0) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    memcpy(cpu->regs, header.regs, sizeof(cpu->regs));
+    cpu->pc = header.pc & cpu->mem_mask;
+    cpu->nf = (header.flags >> 2) & 1;
+    cpu->zf = (header.flags >> 1) & 1;
+    cpu->cf = header.flags & 1;
+    cpu->steps = header.steps;
+    cpu->irq.next = header.irq_next;
+    cpu->irq.period = header.irq_period;
+    cpu->irq.vectors = header.irq_vectors;
+    cpu->irq.epc = header.irq_epc;
+    cpu->irq.eflags = header.irq_eflags & 0x07;
+    cpu->irq.ie = header.irq_ie & 1;
+    cpu->irq.mask = header.irq_mask;
+    cpu->irq.pending = header.irq_pending;
+    cpu_invalidate(cpu);
+    return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef SNAPSHOT_H_20251117_
+#define SNAPSHOT_H_20251117_
+
+#include <stdint.h>
+
+#include "emulator.h"
+
+/*
+ * CPU snapshot file: the header below followed by mem_inst[words] and
+ * mem_data[words], all in host byte order, so a snapshot only restores on
+ * a host of the same endianness. Counters, the
+ * predecoded code, the memory backing and attached trace/profile/JIT state
+ * are not saved.
+ */
+#define SNAPSHOT_MAGIC "SNAP"
+#define SNAPSHOT_VERSION 3
+
+struct snapshot_header_st {
+    char magic[4];                  // SNAPSHOT_MAGIC
+    uint8_t version;                // SNAPSHOT_VERSION
+    uint8_t checked;                // Bounds-checked addressing
+    uint16_t flags;                 // NF << 2 | ZF << 1 | CF
+    uint32_t words;                 // Words per memory, cpu->mem_words
+    uint16_t pc;
+    uint16_t reserved;
+    uint64_t steps;                 // Retired instructions
+    uint16_t regs[NUM_REGISTERS];
+    uint64_t irq_next;              // Interrupt state, struct cpu_irq_st
+    uint32_t irq_period;
+    uint16_t irq_vectors;
+    uint16_t irq_epc;
+    uint8_t irq_eflags;
+    uint8_t irq_ie;
+    uint8_t irq_mask;
+    uint8_t irq_pending;
+    uint32_t reserved2;
+};
+
+int cpu_snapshot_save(const cpu_t *cpu, const char *filename);
+int cpu_snapshot_restore(cpu_t *cpu, const char *filename);
+
+#endif  // SNAPSHOT_H_20251117_
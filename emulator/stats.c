@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "opcodes.h"
+#include "emulator.h"
+#include "stats.h"
+
+#ifdef EMU_STATS
+static const char* s_op_code_str[] = {
+    OPCODES(OPCODES_ARRAY_GEN)
+};
+
+static const uint8_t s_branches[] = { JUMP, JMPR, BZ, BNZ, BN, BNN, BC, BNC };
+
+// Dispatches avoided by superinstructions: each saves all but one
+static uint64_t stats_saved(const struct cpu_stats_st *stats)
+{
+    uint64_t saved = 0;
+    for (int i = 0; i < UOP_FUSED_COUNT; i++) {
+        saved += stats->fused[i] * (cpu_fused_length(UOP_FUSED_FIRST + i) - 1);
+    }
+    return saved;
+}
+#endif
+
+void cpu_stats_reset(cpu_t *cpu)
+{
+    cpu->steps = 0;
+    memset(&cpu->stats, 0, sizeof(cpu->stats));
+}
+
+static void stats_print_text(const cpu_t *cpu, FILE *out, double seconds)
+{
+    const struct cpu_stats_st *stats = &cpu->stats;
+
+    fprintf(out, "Instructions: %llu\n", (unsigned long long)cpu->steps);
+    if (seconds > 0) {
+        fprintf(out, "Time: %.6f s, %.2f MIPS\n", seconds, cpu->steps / seconds / 1e6);
+    }
+
+#ifdef EMU_STATS
+    fprintf(out, "Loads: %llu, Stores: %llu\n",
+            (unsigned long long)stats->opcodes[LOAD], (unsigned long long)stats->opcodes[STORE]);
+
+    fprintf(out, "Opcodes:\n");
+    for (int op = 0; op < 32; op++) {
+        if (stats->opcodes[op]) {
+            fprintf(out, "    %-8s %12llu %6.2f%%\n", s_op_code_str[op],
+                    (unsigned long long)stats->opcodes[op],
+                    cpu->steps ? 100.0 * stats->opcodes[op] / cpu->steps : 0.0);
+        }
+    }
+
+    fprintf(out, "Branches:           taken    not taken\n");
+    for (int i = 0; i < ARRAY_SIZE(s_branches); i++) {
+        uint8_t op = s_branches[i];
+        if (stats->opcodes[op]) {
+            fprintf(out, "    %-8s %12llu %12llu\n", s_op_code_str[op],
+                    (unsigned long long)stats->taken[op],
+                    (unsigned long long)(stats->opcodes[op] - stats->taken[op]));
+        }
+    }
+
+    uint64_t saved = stats_saved(stats);
+    if (saved) {
+        fprintf(out, "Superinstructions:    dispatches\n");
+        for (int i = 0; i < UOP_FUSED_COUNT; i++) {
+            if (stats->fused[i]) {
+                fprintf(out, "    %-14s %12llu\n", cpu_fused_name(UOP_FUSED_FIRST + i),
+                        (unsigned long long)stats->fused[i]);
+            }
+        }
+        fprintf(out, "Dispatches saved: %llu (%.2f%% of instructions)\n", (unsigned long long)saved,
+                cpu->steps ? 100.0 * saved / cpu->steps : 0.0);
+    }
+#else
+    (void)stats;
+    fprintf(out, "Per-opcode counters not built in (make STATS=1)\n");
+#endif
+}
+
+static void stats_print_json(const cpu_t *cpu, FILE *out, double seconds)
+{
+    const struct cpu_stats_st *stats = &cpu->stats;
+
+    fprintf(out, "{\"instructions\": %llu, \"seconds\": %.6f, \"mips\": %.2f",
+            (unsigned long long)cpu->steps, seconds,
+            seconds > 0 ? cpu->steps / seconds / 1e6 : 0.0);
+
+#ifdef EMU_STATS
+    fprintf(out, ", \"loads\": %llu, \"stores\": %llu",
+            (unsigned long long)stats->opcodes[LOAD], (unsigned long long)stats->opcodes[STORE]);
+
+    fprintf(out, ", \"opcodes\": {");
+    const char *sep = "";
+    for (int op = 0; op < 32; op++) {
+        if (stats->opcodes[op]) {
+            fprintf(out, "%s\"%s\": %llu", sep, s_op_code_str[op], (unsigned long long)stats->opcodes[op]);
+            sep = ", ";
+        }
+    }
+
+    fprintf(out, "}, \"branches\": {");
+    sep = "";
+    for (int i = 0; i < ARRAY_SIZE(s_branches); i++) {
+        uint8_t op = s_branches[i];
+        if (stats->opcodes[op]) {
+            fprintf(out, "%s\"%s\": {\"taken\": %llu, \"not_taken\": %llu}", sep, s_op_code_str[op],
+                    (unsigned long long)stats->taken[op],
+                    (unsigned long long)(stats->opcodes[op] - stats->taken[op]));
+            sep = ", ";
+        }
+    }
+
+    fprintf(out, "}, \"fused\": {");
+    sep = "";
+    for (int i = 0; i < UOP_FUSED_COUNT; i++) {
+        if (stats->fused[i]) {
+            fprintf(out, "%s\"%s\": %llu", sep, cpu_fused_name(UOP_FUSED_FIRST + i),
+                    (unsigned long long)stats->fused[i]);
+            sep = ", ";
+        }
+    }
+    fprintf(out, "}, \"dispatches_saved\": %llu", (unsigned long long)stats_saved(stats));
+#else
+    (void)stats;
+#endif
+
+    fprintf(out, "}\n");
+}
+
+void cpu_stats_print(const cpu_t *cpu, FILE *out, int format, double seconds)
+{
+    if (format == STATS_JSON) {
+        stats_print_json(cpu, out, seconds);
+    } else {
+        stats_print_text(cpu, out, seconds);
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef STATS_H_20251117_
+#define STATS_H_20251117_
+
+#include <stdio.h>
+
+#include "emulator.h"
+
+enum stats_format {
+    STATS_TEXT,
+    STATS_JSON,
+};
+
+void cpu_stats_reset(cpu_t *cpu);
+void cpu_stats_print(const cpu_t *cpu, FILE *out, int format, double seconds);
+
+#endif  // STATS_H_20251117_
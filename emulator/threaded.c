@@ -0,0 +1,338 @@
+#include <stdio.h>
+
+#include "opcodes.h"
+#include "emulator.h"
+#include "bus.h"
+#include "host.h"
+
+#ifdef HAVE_THREADED_DISPATCH
+
+/*
+ * Direct threaded engine.
+ * Every predecoded uop carries the address of its handler label, so each
+ * handler ends in its own indirect jump to the next one instead of going
+ * back through a single shared switch branch. With a trace or profile
+ * attached every uop is bound to op_hook instead, so the plain path carries
+ * no check.
+ * The step budget is only tested on taken control transfers and before the
+ * last uop of instruction memory (bound to op_wrap), since straight-line
+ * code cannot run further than that unchecked. Once less than mem_words
+ * steps are left the switch engine finishes the budget exactly. Taken
+ * transfers also hand a bounds-checked PC past the end to the switch engine,
+ * which faults on it; falling off the end reaches the guard uop. LOAD/STORE
+ * at or past data_limit take the device bus slow path. RETI and CSR writes
+ * end the run for cpu_run(). A breakpoint's UOP_BREAK binds to op_break.
+ */
+int cpu_exec_threaded(cpu_t *cpu, uint64_t max_steps)
+{
+    static const void *labels[UOP_COUNT] = {
+        [0 ... UOP_COUNT - 1] = &&op_unknown,
+        [NOP] = &&op_nop,       [HALT] = &&op_halt,
+        [LOAD] = &&op_load,     [STORE] = &&op_store,
+        [LDIH] = &&op_ldih,     [ADD] = &&op_add,
+        [ADDI] = &&op_addi,     [ADDC] = &&op_addc,
+        [SUB] = &&op_sub,       [SUBI] = &&op_subi,
+        [SUBC] = &&op_subc,     [CMP] = &&op_cmp,
+        [AND] = &&op_and,       [OR] = &&op_or,
+        [XOR] = &&op_xor,       [SLL] = &&op_sll,
+        [SRL] = &&op_srl,       [SLA] = &&op_sla,
+        [SRA] = &&op_sra,       [JUMP] = &&op_jump,
+        [JMPR] = &&op_jmpr,     [BZ] = &&op_bz,
+        [BNZ] = &&op_bnz,       [BN] = &&op_bn,
+        [BNN] = &&op_bnn,       [BC] = &&op_bc,
+        [BNC] = &&op_bnc,       [TRAP] = &&op_trap,
+        [RETI] = &&op_reti,     [CSR] = &&op_csr,
+        [CAS] = &&op_cas,
+        [UOP_CMP_BZ] = &&op_cmp_bz,             [UOP_CMP_BNZ] = &&op_cmp_bnz,
+        [UOP_LOAD_ADD] = &&op_load_add,
+        [UOP_ADDI_CMP_BNZ] = &&op_addi_cmp_bnz, [UOP_SUBI_CMP_BNZ] = &&op_subi_cmp_bnz,
+        [UOP_BREAK] = &&op_break,
+    };
+
+    enum { BIND_PLAIN = 1, BIND_HOOKED };
+    int bind = cpu_hooked(cpu) ? BIND_HOOKED : BIND_PLAIN;
+    uop_t *code;
+    uint16_t *regs = cpu->regs;
+    uint16_t mask = cpu->mem_mask;
+    uint32_t words = cpu->mem_words;
+    uint32_t data_limit = cpu->data_limit;
+    uint16_t pc = cpu->pc & mask;
+    uint16_t addr;
+    uint64_t steps = 0;
+    uint64_t limit;         // Last steps value with mem_words steps to spare
+    const uop_t *uop;
+
+    if (max_steps <= words || pc >= words) {
+        return cpu_exec_n(cpu, max_steps);
+    }
+    limit = max_steps - words;
+
+    if (!cpu->text->valid && cpu_predecode(cpu) != 0) {
+        return cpu_status(cpu);
+    }
+    if (cpu->text->bound != bind) {
+        // Binding writes code[]: forks sharing it must not see it change
+        if (cpu_own_text(cpu) != 0) {
+            return cpu_exec_n(cpu, max_steps);
+        }
+        code = cpu->code;
+        for (uint32_t i = 0; i < words; i++) {
+            code[i].handler = bind == BIND_HOOKED ? &&op_hook : labels[code[i].dispatch];
+        }
+        if (bind == BIND_PLAIN) {
+            code[words - 1].handler = &&op_wrap;
+        }
+        code[words].handler = &&op_unknown;     // Guard: stop without a hook
+        cpu->text->bound = bind;
+    }
+    code = cpu->code;
+
+#define DISPATCH() do {                 \
+        steps++;                        \
+        CPU_STATS(cpu->stats.opcodes[uop->opcode]++); \
+        uop = &code[pc];                \
+        goto *uop->handler;             \
+    } while (0)
+#define DISPATCH_TAKEN() do {           \
+        steps++;                        \
+        CPU_STATS(cpu->stats.opcodes[uop->opcode]++); \
+        if (__builtin_expect(steps > limit || pc >= words, 0)) { \
+            goto budget;                \
+        }                               \
+        uop = &code[pc];                \
+        goto *uop->handler;             \
+    } while (0)
+#define NEXT() do { pc = (pc + 1) & mask; DISPATCH(); } while (0)
+// Retire and stop, so cpu_run() can take an interrupt
+#define RETIRE_STOP() do {              \
+        steps++;                        \
+        CPU_STATS(cpu->stats.opcodes[uop->opcode]++); \
+        goto out;                       \
+    } while (0)
+// LOAD/STORE past data_limit go through the device bus; stop before a fault
+// or when there is no memory for a private copy of a shared page
+#define LOAD_DATA() do {                                                \
+        addr = (regs[uop->r2] + uop->imm) & mask;                       \
+        if (__builtin_expect(addr < data_limit, 1)) {                   \
+            regs[uop->r1] = cpu_data_word(cpu, addr);                   \
+        } else if (cpu_bus_load(cpu, addr, &regs[uop->r1]) != 0) {      \
+            goto out;                                                   \
+        }                                                               \
+    } while (0)
+#define STORE_DATA() do {                                               \
+        addr = (regs[uop->r2] + uop->imm) & mask;                       \
+        if (__builtin_expect(addr < data_limit, 1)) {                   \
+            if (__builtin_expect(cpu_page_shared(cpu, addr), 0)         \
+                && cpu_own_page(cpu, addr) != 0) {                      \
+                goto out;                                               \
+            }                                                           \
+            cpu_data_word(cpu, addr) = regs[uop->r1];                   \
+        } else if (cpu_bus_store(cpu, addr, regs[uop->r1]) != 0) {      \
+            goto out;                                                   \
+        }                                                               \
+    } while (0)
+// Retire one instruction of a superinstruction and move to the next
+#define FUSED_STEP() do {                               \
+        steps++;                                        \
+        CPU_STATS(cpu->stats.opcodes[uop->opcode]++);   \
+        uop++;                                          \
+        pc++;                                           \
+    } while (0)
+#define FUSED_CMP() do {                                \
+        uint16_t result = regs[uop->r2] - regs[uop->r3];\
+        cpu->zf = (result == 0) ? 1 : 0;                \
+        cpu->nf = (result & 0x8000) ? 1 : 0;            \
+        FUSED_STEP();                                   \
+    } while (0)
+#define BRANCH(cond) do {                                       \
+        if (cond) {                                             \
+            pc = (regs[uop->r1] + uop->imm) & mask;             \
+            CPU_STATS(cpu->stats.taken[uop->opcode]++);         \
+            DISPATCH_TAKEN();                                   \
+        }                                                       \
+        NEXT();                                                 \
+    } while (0)
+
+    uop = &code[pc];
+    goto *uop->handler;
+
+op_hook:
+    if (steps > limit) {
+        goto budget;
+    }
+    if (uop->dispatch == UOP_BREAK) {
+        goto out;
+    }
+    cpu->pc = pc;
+    cpu_hook_step(cpu);
+    goto *labels[uop->opcode];
+op_wrap:
+    if (__builtin_expect(steps > limit, 0)) {
+        goto budget;
+    }
+    goto *labels[uop->dispatch];    // Nothing is fused at the last word
+op_break:
+    goto out;       // Stop before it; cpu_status() reports CPU_BREAK
+op_nop:
+    NEXT();
+op_halt:
+    goto out;
+op_load:
+    LOAD_DATA();
+    NEXT();
+op_store:
+    STORE_DATA();
+    NEXT();
+op_ldih:
+    regs[uop->r1] = regs[uop->r1] + uop->imm;
+    NEXT();
+op_add:
+    regs[uop->r1] = regs[uop->r2] + regs[uop->r3];
+    NEXT();
+op_addi:
+    regs[uop->r1] = regs[uop->r1] + uop->imm;
+    NEXT();
+op_addc: {
+    uint32_t result = regs[uop->r2] + regs[uop->r3] + cpu->cf;
+    regs[uop->r1] = (uint16_t)result;
+    cpu->cf = (result > 0xFFFF) ? 1 : 0;
+    NEXT();
+}
+op_sub:
+    regs[uop->r1] = regs[uop->r2] - regs[uop->r3];
+    NEXT();
+op_subi:
+    regs[uop->r1] = regs[uop->r1] - uop->imm;
+    NEXT();
+op_subc: {
+    uint32_t result = regs[uop->r2] - regs[uop->r3] - cpu->cf;
+    regs[uop->r1] = (uint16_t)result;
+    cpu->cf = (result > 0xFFFF) ? 1 : 0;
+    NEXT();
+}
+op_cmp: {
+    uint16_t result = regs[uop->r2] - regs[uop->r3];
+    cpu->zf = (result == 0) ? 1 : 0;
+    cpu->nf = (result & 0x8000) ? 1 : 0;
+    NEXT();
+}
+op_and:
+    regs[uop->r1] = regs[uop->r2] & regs[uop->r3];
+    NEXT();
+op_or:
+    regs[uop->r1] = regs[uop->r2] | regs[uop->r3];
+    NEXT();
+op_xor:
+    regs[uop->r1] = regs[uop->r2] ^ regs[uop->r3];
+    NEXT();
+op_sll:
+op_sla:
+    regs[uop->r1] = regs[uop->r2] << uop->imm;
+    NEXT();
+op_srl:
+    regs[uop->r1] = regs[uop->r2] >> uop->imm;
+    NEXT();
+op_sra:
+    regs[uop->r1] = (regs[uop->r2] >> uop->imm) | (regs[uop->r2] & 0x8000 ? ((0xFFFF) << (16 - uop->imm)) : 0);
+    NEXT();
+op_jump:
+    pc = uop->imm & mask;
+    CPU_STATS(cpu->stats.taken[JUMP]++);
+    DISPATCH_TAKEN();
+op_jmpr:
+    pc = (regs[uop->r1] + uop->imm) & mask;
+    CPU_STATS(cpu->stats.taken[JMPR]++);
+    DISPATCH_TAKEN();
+op_bz:
+    BRANCH(cpu->zf);
+op_bnz:
+    BRANCH(!cpu->zf);
+op_bn:
+    BRANCH(cpu->nf);
+op_bnn:
+    BRANCH(!cpu->nf);
+op_bc:
+    BRANCH(cpu->cf);
+op_bnc:
+    BRANCH(!cpu->cf);
+op_trap:
+    if (cpu_trap(cpu, uop) != 0) {
+        goto out;   // TRAP_EXIT or a failed call
+    }
+    NEXT();
+op_reti:
+    pc = cpu_reti(cpu) & mask;
+    RETIRE_STOP();
+op_csr:
+    if (cpu_csr(cpu, uop, cpu->steps + steps + 1) != 0) {
+        pc = (pc + 1) & mask;
+        RETIRE_STOP();
+    }
+    NEXT();
+op_cas:
+    if (cpu_cas(cpu, uop) != 0) {
+        goto out;   // Fault or watchpoint
+    }
+    NEXT();
+op_unknown:
+    // Handle unknown opcode
+    goto out;
+
+    // Superinstructions: the last instruction dispatches as usual
+op_cmp_bz:
+    CPU_STATS(cpu->stats.fused[UOP_CMP_BZ - UOP_FUSED_FIRST]++);
+    FUSED_CMP();
+    BRANCH(cpu->zf);
+op_cmp_bnz:
+    CPU_STATS(cpu->stats.fused[UOP_CMP_BNZ - UOP_FUSED_FIRST]++);
+    FUSED_CMP();
+    BRANCH(!cpu->zf);
+op_load_add:
+    LOAD_DATA();
+    CPU_STATS(cpu->stats.fused[UOP_LOAD_ADD - UOP_FUSED_FIRST]++);
+    FUSED_STEP();
+    regs[uop->r1] = regs[uop->r2] + regs[uop->r3];
+    NEXT();
+op_addi_cmp_bnz:
+    CPU_STATS(cpu->stats.fused[UOP_ADDI_CMP_BNZ - UOP_FUSED_FIRST]++);
+    regs[uop->r1] = regs[uop->r1] + uop->imm;
+    FUSED_STEP();
+    FUSED_CMP();
+    BRANCH(!cpu->zf);
+op_subi_cmp_bnz:
+    CPU_STATS(cpu->stats.fused[UOP_SUBI_CMP_BNZ - UOP_FUSED_FIRST]++);
+    regs[uop->r1] = regs[uop->r1] - uop->imm;
+    FUSED_STEP();
+    FUSED_CMP();
+    BRANCH(!cpu->zf);
+
+out:
+    cpu->pc = pc;
+    cpu->steps += steps;
+    return cpu_status(cpu);
+
+budget:
+    cpu->pc = pc;
+    cpu->steps += steps;
+    return cpu_exec_n(cpu, max_steps - steps);
+
+#undef FUSED_CMP
+#undef FUSED_STEP
+#undef STORE_DATA
+#undef LOAD_DATA
+#undef BRANCH
+#undef RETIRE_STOP
+#undef NEXT
+#undef DISPATCH_TAKEN
+#undef DISPATCH
+}
+
+#else
+
+// Labels-as-values not available: fall back to the portable switch engine
+int cpu_exec_threaded(cpu_t *cpu, uint64_t max_steps)
+{
+    return cpu_exec_n(cpu, max_steps);
+}
+
+#endif
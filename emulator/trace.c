@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "opcodes.h"
+#include "bus.h"
+#include "trace.h"
+
+static const char* s_op_code_str[] = {
+    OPCODES(OPCODES_ARRAY_GEN)
+};
+
+static const char* s_level_str[] = {
+    [TRACE_OFF] = "off",
+    [TRACE_INST] = "inst",
+    [TRACE_REGS] = "regs",
+    [TRACE_MEM] = "mem",
+};
+
+int trace_level_parse(const char *name)
+{
+    for (int i = 0; i < ARRAY_SIZE(s_level_str); i++) {
+        if (strcmp(name, s_level_str[i]) == 0) {
+            return i;
+        }
+    }
+
+    char *end;
+    long level = strtol(name, &end, 10);
+    if (*name == '\0' || *end != '\0' || level < TRACE_OFF || level > TRACE_MEM) {
+        return -1;
+    }
+    return level;
+}
+
+static void trace_flush(struct trace_st *trace)
+{
+    if (trace->pos) {
+        fwrite(trace->buf, 1, trace->pos, trace->file);
+        trace->pos = 0;
+    }
+}
+
+static inline void trace_put16(struct trace_st *trace, uint16_t value)
+{
+    trace->buf[trace->pos++] = value & 0xFF;
+    trace->buf[trace->pos++] = value >> 8;
+}
+
+struct trace_st *trace_open(const char *filename, int level)
+{
+    if (level <= TRACE_OFF || level > TRACE_MEM) {
+        return NULL;
+    }
+
+    struct trace_st *trace = (struct trace_st *)malloc(sizeof(struct trace_st));
+    if (!trace) {
+        return NULL;
+    }
+
+    trace->file = fopen(filename, "wb");
+    if (!trace->file) {
+        free(trace);
+        return NULL;
+    }
+
+    trace->level = level;
+    trace->pos = 0;
+    memcpy(trace->buf, TRACE_MAGIC, 4);
+    trace->buf[4] = TRACE_VERSION;
+    trace->buf[5] = level;
+    trace->buf[6] = 0;
+    trace->buf[7] = 0;
+    trace->pos = 8;
+    return trace;
+}
+
+void trace_close(struct trace_st *trace)
+{
+    if (trace) {
+        trace_flush(trace);
+        fclose(trace->file);
+        free(trace);
+    }
+}
+
+void trace_step(struct trace_st *trace, const cpu_t *cpu)
+{
+    // Largest record: pc, instruction, 8 registers, flags, address, value
+    if (trace->pos + 13 * sizeof(uint16_t) > TRACE_BUFFER_SIZE) {
+        trace_flush(trace);
+    }
+
+    uint16_t pc = cpu->pc;
+    trace_put16(trace, pc);
+    trace_put16(trace, cpu->mem_inst[pc]);
+    if (trace->level < TRACE_REGS) {
+        return;
+    }
+
+    for (int i = 0; i < NUM_REGISTERS; i++) {
+        trace_put16(trace, cpu->regs[i]);
+    }
+    trace_put16(trace, cpu->nf << 2 | cpu->zf << 1 | cpu->cf);
+    if (trace->level < TRACE_MEM) {
+        return;
+    }
+
+    const uop_t *uop = &cpu->code[pc];
+    if (uop->opcode == LOAD || uop->opcode == STORE) {
+        uint16_t addr = (cpu->regs[uop->r2] + uop->imm) & cpu->mem_mask;
+        uint16_t value = uop->opcode == STORE ? cpu->regs[uop->r1]
+                       : addr < cpu->mem_words && !bus_find(cpu->bus, addr) ? cpu_data_word(cpu, addr)
+                       : 0;     // Device or faulting LOAD
+        trace_put16(trace, addr);
+        trace_put16(trace, value);
+    } else if (uop->opcode == CAS) {
+        // The word it compares; trace_print() derives the store from grX and grZ
+        uint16_t addr = cpu->regs[uop->r2] & cpu->mem_mask;
+        trace_put16(trace, addr);
+        trace_put16(trace, addr < cpu->mem_words && !bus_find(cpu->bus, addr) ? cpu_data_word(cpu, addr) : 0);
+    }
+}
+
+static int trace_get16(FILE *file, uint16_t *value)
+{
+    uint8_t b[2];
+    if (fread(b, 1, 2, file) != 2) {
+        return -1;
+    }
+    *value = b[0] | b[1] << 8;
+    return 0;
+}
+
+int trace_print(const char *filename, FILE *out)
+{
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        return -1;
+    }
+
+    uint8_t header[8];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header)
+        || memcmp(header, TRACE_MAGIC, 4) != 0 || header[4] != TRACE_VERSION) {
+        fclose(file);
+        return -1;
+    }
+
+    int level = header[5];
+    uint16_t pc, instruction;
+    int count = 0;
+    while (trace_get16(file, &pc) == 0 && trace_get16(file, &instruction) == 0) {
+        uint8_t opcode = (instruction >> 11) & 0x1F;
+        fprintf(out, "PC: 0x%04X -> 0x%04X | Opcode: %s, Op1: %d, Op2: %d, Op3: %d\n",
+                pc, instruction, s_op_code_str[opcode],
+                (instruction >> 8) & 0x07, (instruction >> 4) & 0x0F, instruction & 0x0F);
+
+        uint16_t regs[NUM_REGISTERS] = { 0 };
+        if (level >= TRACE_REGS) {
+            uint16_t flags = 0;
+            for (int i = 0; i < NUM_REGISTERS; i++) {
+                trace_get16(file, &regs[i]);
+            }
+            trace_get16(file, &flags);
+
+            fprintf(out, "    Regs(R0-7): ");
+            for (int i = 0; i < NUM_REGISTERS; i++) {
+                fprintf(out, "0x%04X ", regs[i]);
+            }
+            fprintf(out, "NF: %d, ZF: %d, CF: %d\n", (flags >> 2) & 1, (flags >> 1) & 1, flags & 1);
+        }
+
+        if (level >= TRACE_MEM && (opcode == LOAD || opcode == STORE)) {
+            uint16_t addr = 0, value = 0;
+            trace_get16(file, &addr);
+            trace_get16(file, &value);
+            fprintf(out, "    Data Memory: 0x%04X %s 0x%04X\n", addr, opcode == LOAD ? "->" : "<-", value);
+        } else if (level >= TRACE_MEM && opcode == CAS) {
+            uint16_t addr = 0, value = 0;
+            trace_get16(file, &addr);
+            trace_get16(file, &value);
+            fprintf(out, "    Data Memory: 0x%04X -> 0x%04X\n", addr, value);
+            if (value == regs[(instruction >> 8) & 0x07]) {
+                fprintf(out, "    Data Memory: 0x%04X <- 0x%04X\n", addr, regs[instruction & REGISTER_MASK]);
+            }
+        }
+        count++;
+    }
+
+    fclose(file);
+    return count;
+}
@@ -0,0 +1,43 @@
+#ifndef TRACE_H_20251117_
+#define TRACE_H_20251117_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "emulator.h"
+
+/*
+ * Binary execution trace.
+ * File layout: header {"STRC", version, level, 2 bytes reserved}, then one
+ * record per executed instruction, all fields little-endian uint16_t:
+ *   TRACE_INST:  pc, instruction
+ *   TRACE_REGS:  + regs[0..7], flags (NF << 2 | ZF << 1 | CF)
+ *   TRACE_MEM:   + address, value       (LOAD/STORE only)
+ *                + address, old word    (CAS; it stores grZ when the word equals grX)
+ * Records are taken before the instruction executes.
+ */
+#define TRACE_MAGIC "STRC"
+#define TRACE_VERSION 1
+#define TRACE_BUFFER_SIZE (64 * 1024)
+
+enum trace_level {
+    TRACE_OFF,
+    TRACE_INST,     // PC and instruction word
+    TRACE_REGS,     // + registers and flags
+    TRACE_MEM,      // + data memory accesses
+};
+
+struct trace_st {
+    FILE *file;
+    int level;
+    size_t pos;
+    uint8_t buf[TRACE_BUFFER_SIZE];
+};
+
+int trace_level_parse(const char *name);
+struct trace_st *trace_open(const char *filename, int level);
+void trace_close(struct trace_st *trace);
+void trace_step(struct trace_st *trace, const cpu_t *cpu);
+int trace_print(const char *filename, FILE *out);
+
+#endif  // TRACE_H_20251117_
@@ -0,0 +1,64 @@
+; Multi-word arithmetic: 128-bit Fibonacci numbers, 8 words each, added
+; with ADDC carry chains and differenced with a SUBC borrow chain,
+; 3 x 65536 rounds (mod 2^128).
+; A at data[0x10], B at data[0x18], D at data[0x20], least significant word first
+; Each round: A += B, B += A, D = B - A
+    ADDI gr1, 1, 8
+    ADDI gr3, 0, 1
+    STORE gr3, gr1, 0       ; B = 1
+    SUB gr6, gr6, gr6       ; gr6 = 0x0003 passes of 65536 rounds
+    ADDI gr6, 0, 3
+    SUB gr7, gr7, gr7       ; rounds, 0 counts 65536
+; 0x06 round:
+    ADDC gr4, gr0, gr0      ; clear the carry
+    SUB gr1, gr1, gr1
+    ADDI gr1, 1, 0          ; &A[0]
+    SUB gr2, gr2, gr2
+    ADDI gr2, 0, 8
+; 0x0B add_ab:
+    LOAD gr3, gr1, 0
+    LOAD gr4, gr1, 8
+    ADDC gr3, gr3, gr4      ; A[i] += B[i] + carry
+    STORE gr3, gr1, 0
+    ADDI gr1, 0, 1
+    SUBI gr2, 0, 1
+    CMP gr0, gr2, gr0
+    BNZ gr0, 0, 11
+    ADDC gr4, gr0, gr0
+    SUB gr1, gr1, gr1
+    ADDI gr1, 1, 0
+    SUB gr2, gr2, gr2
+    ADDI gr2, 0, 8
+; 0x18 add_ba:
+    LOAD gr3, gr1, 8
+    LOAD gr4, gr1, 0
+    ADDC gr3, gr3, gr4      ; B[i] += A[i] + carry
+    STORE gr3, gr1, 8
+    ADDI gr1, 0, 1
+    SUBI gr2, 0, 1
+    CMP gr0, gr2, gr0
+    BNZ gr0, 1, 8
+    ADDC gr4, gr0, gr0
+    SUB gr1, gr1, gr1
+    ADDI gr1, 1, 0
+    SUB gr5, gr5, gr5
+    ADDI gr5, 2, 0          ; &D[0]
+    SUB gr2, gr2, gr2
+    ADDI gr2, 0, 8
+; 0x27 sub_ba:
+    LOAD gr3, gr1, 8
+    LOAD gr4, gr1, 0
+    SUBC gr3, gr3, gr4      ; D[i] = B[i] - A[i] - borrow
+    STORE gr3, gr5, 0
+    ADDI gr1, 0, 1
+    ADDI gr5, 0, 1
+    SUBI gr2, 0, 1
+    CMP gr0, gr2, gr0
+    BNZ gr0, 2, 7
+    SUBI gr7, 0, 1
+    CMP gr0, gr7, gr0
+    BNZ gr0, 0, 6
+    SUBI gr6, 0, 1
+    CMP gr0, gr6, gr0
+    BNZ gr0, 0, 6
+    HALT
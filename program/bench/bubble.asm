@@ -0,0 +1,45 @@
+; Bubble sort: 32 words at data[0x40] refilled with x = 5x + 0x39 (as
+; 15-bit keys) and sorted ascending, 8192 times. Data-dependent
+; branches and swaps through LOAD/STORE.
+    SUB gr7, gr7, gr7       ; gr7 = 0x2000 sorts
+    LDIH gr7, 2, 0
+; 0x02 sort:
+    SUB gr1, gr1, gr1
+    ADDI gr1, 4, 0          ; &a[0]
+    SUB gr2, gr2, gr2
+    ADDI gr2, 2, 0          ; 32 words
+; 0x06 fill:
+    SLL gr3, gr6, 2
+    ADD gr6, gr6, gr3
+    ADDI gr6, 3, 9          ; x = 5x + 0x39
+    SRL gr3, gr6, 1         ; 15-bit key, so CMP orders any two
+    STORE gr3, gr1, 0
+    ADDI gr1, 0, 1
+    SUBI gr2, 0, 1
+    CMP gr0, gr2, gr0
+    BNZ gr0, 0, 6
+    SUB gr5, gr5, gr5
+    ADDI gr5, 1, 15         ; 31 compares in the first pass
+; 0x11 pass:
+    SUB gr1, gr1, gr1
+    ADDI gr1, 4, 0
+    ADD gr2, gr5, gr0
+; 0x14 compare:
+    LOAD gr3, gr1, 0
+    LOAD gr4, gr1, 1
+    CMP gr0, gr4, gr3       ; a[j + 1] - a[j]
+    BNN gr0, 1, 10
+    STORE gr4, gr1, 0       ; swap
+    STORE gr3, gr1, 1
+; 0x1A next:
+    ADDI gr1, 0, 1
+    SUBI gr2, 0, 1
+    CMP gr0, gr2, gr0
+    BNZ gr0, 1, 4
+    SUBI gr5, 0, 1
+    CMP gr0, gr5, gr0
+    BNZ gr0, 1, 1
+    SUBI gr7, 0, 1
+    CMP gr0, gr7, gr0
+    BNZ gr0, 0, 2
+    HALT
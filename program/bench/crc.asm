@@ -0,0 +1,53 @@
+; CRC-16/CCITT (polynomial 0x1021, initial 0xFFFF), MSB first, over 64
+; words at data[0x40], 7168 times. Each CRC replaces the first word,
+; so every round checks a different buffer. Bit loop of shifts, XOR
+; and a sign-bit branch.
+; Result: data[0x40] = last CRC
+    SUB gr1, gr1, gr1
+    ADDI gr1, 4, 0          ; &buf[0]
+    ADDI gr2, 4, 0          ; 64 words
+; 0x03 fill:
+    SLL gr3, gr6, 2
+    ADD gr6, gr6, gr3
+    ADDI gr6, 3, 9          ; x = 5x + 0x39
+    STORE gr6, gr1, 0
+    ADDI gr1, 0, 1
+    SUBI gr2, 0, 1
+    CMP gr0, gr2, gr0
+    BNZ gr0, 0, 3
+    SUB gr5, gr5, gr5       ; gr5 = 0x1021 polynomial
+    LDIH gr5, 1, 0
+    ADDI gr5, 2, 1
+    SUB gr7, gr7, gr7       ; gr7 = 0x1C00 rounds
+    LDIH gr7, 1, 12
+; 0x10 round:
+    SUB gr1, gr1, gr1
+    ADDI gr1, 4, 0
+    SUB gr2, gr2, gr2
+    ADDI gr2, 4, 0          ; 64 words
+    SUB gr3, gr3, gr3
+    SUBI gr3, 0, 1          ; crc = 0xFFFF
+; 0x16 word:
+    LOAD gr4, gr1, 0
+    XOR gr3, gr3, gr4
+    SUB gr6, gr6, gr6
+    ADDI gr6, 1, 0          ; 16 bits
+; 0x1A bit:
+    CMP gr0, gr3, gr0       ; NF = top bit
+    SLL gr3, gr3, 1
+    BNN gr0, 1, 14
+    XOR gr3, gr3, gr5
+; 0x1E skip:
+    SUBI gr6, 0, 1
+    CMP gr0, gr6, gr0
+    BNZ gr0, 1, 10
+    ADDI gr1, 0, 1
+    SUBI gr2, 0, 1
+    CMP gr0, gr2, gr0
+    BNZ gr0, 1, 6
+    SUBI gr1, 4, 0
+    STORE gr3, gr1, 0       ; buf[0] = crc
+    SUBI gr7, 0, 1
+    CMP gr0, gr7, gr0
+    BNZ gr0, 1, 0
+    HALT
@@ -0,0 +1,29 @@
+; Fibonacci: 24 steps of b = a + b from (0, 1), repeated 5 x 65536 times.
+; Register moves and a short counted loop (ADDI/SUBI+CMP+BNZ).
+; Result: data[0] = sum of every fib(25) mod 2^16, data[1] = fib(25) mod 2^16
+    SUB gr6, gr6, gr6       ; gr6 = 0x0005 passes of 65536 rounds
+    ADDI gr6, 0, 5
+    SUB gr7, gr7, gr7       ; rounds, 0 counts 65536
+; 0x03 round:
+    SUB gr1, gr1, gr1       ; a = 0
+    SUB gr2, gr2, gr2
+    ADDI gr2, 0, 1          ; b = 1
+    SUB gr4, gr4, gr4
+    ADDI gr4, 1, 8          ; 24 steps
+; 0x08 step:
+    ADD gr3, gr1, gr2       ; t = a + b
+    ADD gr1, gr2, gr0       ; a = b
+    ADD gr2, gr3, gr0       ; b = t
+    SUBI gr4, 0, 1
+    CMP gr0, gr4, gr0
+    BNZ gr0, 0, 8
+    ADD gr5, gr5, gr2
+    SUBI gr7, 0, 1
+    CMP gr0, gr7, gr0
+    BNZ gr0, 0, 3
+    SUBI gr6, 0, 1
+    CMP gr0, gr6, gr0
+    BNZ gr0, 0, 3
+    STORE gr5, gr0, 0
+    STORE gr2, gr0, 1
+    HALT
@@ -0,0 +1,46 @@
+; Memory copy: 64 words from data[0x40] to data[0x80], then on to
+; data[0xC0], unrolled by 4, 2 x 65536 rounds. The source is filled
+; first with x = 5x + 0x39.
+    SUB gr1, gr1, gr1
+    ADDI gr1, 4, 0          ; &src[0]
+    ADDI gr5, 4, 0          ; 64 words
+; 0x03 fill:
+    SLL gr3, gr6, 2
+    ADD gr6, gr6, gr3
+    ADDI gr6, 3, 9          ; x = 5x + 0x39
+    STORE gr6, gr1, 0
+    ADDI gr1, 0, 1
+    SUBI gr5, 0, 1
+    CMP gr0, gr5, gr0
+    BNZ gr0, 0, 3
+    SUB gr6, gr6, gr6       ; gr6 = 0x0002 passes of 65536 rounds
+    ADDI gr6, 0, 2
+    SUB gr7, gr7, gr7       ; rounds, 0 counts 65536
+; 0x0E round:
+    SUB gr1, gr1, gr1
+    ADDI gr1, 4, 0          ; from data[0x40]
+    SUB gr2, gr2, gr2
+    ADDI gr2, 8, 0          ; to data[0x80]
+    SUB gr5, gr5, gr5
+    ADDI gr5, 2, 0          ; 32 blocks of 4 words: both copies
+; 0x14 copy:
+    LOAD gr3, gr1, 0
+    STORE gr3, gr2, 0
+    LOAD gr4, gr1, 1
+    STORE gr4, gr2, 1
+    LOAD gr3, gr1, 2
+    STORE gr3, gr2, 2
+    LOAD gr4, gr1, 3
+    STORE gr4, gr2, 3
+    ADDI gr1, 0, 4
+    ADDI gr2, 0, 4
+    SUBI gr5, 0, 1
+    CMP gr0, gr5, gr0
+    BNZ gr0, 1, 4
+    SUBI gr7, 0, 1
+    CMP gr0, gr7, gr0
+    BNZ gr0, 0, 14
+    SUBI gr6, 0, 1
+    CMP gr0, gr6, gr0
+    BNZ gr0, 0, 14
+    HALT
@@ -0,0 +1,53 @@
+; Shift-and-add multiplication: 3 x 65536 products of 16-bit operands
+; stepped by 0x9E37 and 0x7F4B, each 32 bits wide, summed with ADDC.
+; gr1/gr2 = x low/high, gr3 = y, gr4/gr5 = product low/high, gr6 scratch
+; Result: data[0..1] = last operands, data[2..3] = sum of products (low, high)
+    SUB gr6, gr6, gr6       ; gr6 = 0x0003
+    ADDI gr6, 0, 3
+    STORE gr6, gr0, 4       ; data[4] = passes of 65536 products
+    SUB gr7, gr7, gr7       ; products, 0 counts 65536
+; 0x04 round:
+    LOAD gr1, gr0, 0
+    LDIH gr1, 9, 14
+    ADDI gr1, 3, 7          ; x += 0x9E37
+    STORE gr1, gr0, 0
+    LOAD gr3, gr0, 1
+    LDIH gr3, 7, 15
+    ADDI gr3, 4, 11         ; y += 0x7F4B
+    STORE gr3, gr0, 1
+    SUB gr2, gr2, gr2
+    SUB gr4, gr4, gr4
+    SUB gr5, gr5, gr5
+; 0x0F bit:
+    SUB gr6, gr6, gr6
+    ADDI gr6, 0, 1
+    AND gr6, gr3, gr6       ; y & 1
+    CMP gr0, gr6, gr0
+    BZ gr0, 1, 7
+    ADDC gr6, gr0, gr0      ; clear the carry
+    ADDC gr4, gr4, gr1      ; product += x
+    ADDC gr5, gr5, gr2
+; 0x17 shift:
+    SRL gr6, gr1, 15        ; x <<= 1
+    SLL gr2, gr2, 1
+    OR gr2, gr2, gr6
+    SLL gr1, gr1, 1
+    SRL gr3, gr3, 1         ; y >>= 1
+    CMP gr0, gr3, gr0
+    BNZ gr0, 0, 15
+    LOAD gr6, gr0, 2
+    ADDC gr1, gr0, gr0      ; clear the carry
+    ADDC gr6, gr6, gr4      ; sum += product
+    STORE gr6, gr0, 2
+    LOAD gr6, gr0, 3
+    ADDC gr6, gr6, gr5
+    STORE gr6, gr0, 3
+    SUBI gr7, 0, 1
+    CMP gr0, gr7, gr0
+    BNZ gr0, 0, 4
+    LOAD gr6, gr0, 4
+    SUBI gr6, 0, 1
+    STORE gr6, gr0, 4
+    CMP gr0, gr6, gr0
+    BNZ gr0, 0, 4
+    HALT
@@ -0,0 +1,66 @@
+; Parallel sum over 0x4800 rounds, split between the cores of a machine
+; (emulator --cores): core c runs rounds c, c + cores, ... Each round sums
+; the high bytes of 256 steps of x = 5x + 0x39 from x = round into a 32-bit
+; partial sum. Every core then adds its partial sum to the total under a
+; CAS spinlock and counts itself done with a CAS loop; core 0 waits for
+; all of them and loads the total. On a single CPU core 0 runs every round.
+; Data: [0x10] lock, [0x11] total low, [0x12] total high, [0x13] cores done
+; Result: core 0 gr6:gr5 = data[0x12]:data[0x11] = 0x23D5:0xC000
+    CSR gr1, 0, 8           ; round = CSR_CORE
+    CSR gr2, 0, 9           ; step = CSR_CORES
+    SUB gr5, gr5, gr5       ; gr6:gr5 partial sum
+    SUB gr6, gr6, gr6
+; 0x04 round:
+    SUB gr4, gr4, gr4
+    LDIH gr4, 4, 8          ; 0x4800 rounds
+    CMP gr0, gr1, gr4
+    BNN gr0, 1, 6           ; all rounds done
+    SUB gr4, gr4, gr4
+    LDIH gr4, 0, 1          ; 256 steps
+    ADD gr3, gr1, gr0       ; x = round
+; 0x0B step:
+    SLL gr7, gr3, 2
+    ADD gr3, gr3, gr7
+    ADDI gr3, 3, 9          ; x = 5x + 0x39
+    SRL gr7, gr3, 8
+    ADDC gr5, gr5, gr7
+    ADDC gr6, gr6, gr0
+    SUBI gr4, 0, 1
+    CMP gr0, gr4, gr0
+    BNZ gr0, 0, 11
+    ADD gr1, gr1, gr2
+    JMPR gr0, 0, 4
+; 0x16 done:
+    SUB gr2, gr2, gr2
+    ADDI gr2, 1, 0          ; &lock
+    SUB gr4, gr4, gr4
+    ADDI gr4, 0, 1
+; 0x1A acquire:
+    SUB gr3, gr3, gr3
+    CAS gr3, gr2, gr4       ; 0 -> 1
+    BNZ gr0, 1, 10          ; held by another core
+    LOAD gr3, gr2, 1
+    ADDC gr3, gr3, gr5
+    STORE gr3, gr2, 1
+    LOAD gr3, gr2, 2
+    ADDC gr3, gr3, gr6
+    STORE gr3, gr2, 2
+    CAS gr4, gr2, gr0       ; release: 1 -> 0
+    ADDI gr2, 0, 3          ; &done
+; 0x25 count:
+    LOAD gr3, gr2, 0
+    ADD gr7, gr3, gr4
+    CAS gr3, gr2, gr7       ; done + 1
+    BNZ gr0, 2, 5           ; another core counted first
+    CSR gr1, 0, 8
+    CMP gr0, gr1, gr0
+    BZ gr0, 2, 13
+    HALT                    ; not core 0
+; 0x2D wait:
+    CSR gr7, 0, 9
+    CAS gr7, gr2, gr7       ; ZF once done == cores
+    BNZ gr0, 2, 13
+    SUBI gr2, 0, 2          ; &total
+    LOAD gr5, gr2, 0
+    LOAD gr6, gr2, 1
+    HALT
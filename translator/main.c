@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+
+#include "emulator/emulator.h"
+#include "emulator/loader.h"
+#include "translator.h"
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [--memory=words] [--checked] [-o output_file] <program_file>\n"
+           "Translates a program image or object file into C for the emulator's aot\n"
+           "engine (standard output without -o). --memory and --checked give the memory\n"
+           "the program runs with, as for the emulator; an object file sets its own.\n"
+           "Build and run:\n"
+           "    %s -o prog.c prog.bin\n"
+           "    make -C ../emulator AOT=$PWD/prog.c\n"
+           "    ../emulator/emulator -e aot prog.bin\n"
+           "The result matches -e switch; other programs run on the switch engine.\n",
+           prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        { "memory", required_argument, NULL, 'M' },
+        { "checked", no_argument, NULL, 'C' },
+        { NULL, 0, NULL, 0 },
+    };
+    struct cpu_config_st config = CPU_CONFIG_DEFAULT;
+    const char *output_file = NULL;
+    cpu_t cpu;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "o:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'o':
+                output_file = optarg;
+                break;
+            case 'M':
+                config.mem_words = strtoul(optarg, NULL, 0);
+                break;
+            case 'C':
+                config.checked = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind + 1 != argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (cpu_init_config(&cpu, &config) != 0) {
+        fprintf(stderr, "Failed to initialize CPU with %u words of memory\n", config.mem_words);
+        return 1;
+    }
+    if (cpu_map_program(&cpu, argv[optind]) < 0) {
+        fprintf(stderr, "Failed to load program: %s\n", argv[optind]);
+        return 1;
+    }
+
+    FILE *out = output_file ? fopen(output_file, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Unable to write: %s\n", output_file);
+        return 1;
+    }
+    int ret = translate_program(out, &cpu, argv[optind]);
+    if (output_file) {
+        ret = fclose(out) != 0 ? -1 : ret;
+    }
+    cpu_release(&cpu);
+    if (ret != 0) {
+        fprintf(stderr, "Translation failed: %s\n", argv[optind]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,381 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emulator/opcodes.h"
+#include "emulator/emulator.h"
+#include "assembler/assembler.h"
+#include "translator.h"
+
+enum translate_use {
+    TRANSLATE_USE_MEM = 1,          // LOAD or STORE
+    TRANSLATE_USE_DIFF = 2,         // CMP
+    TRANSLATE_USE_RESULT = 4,       // ADDC or SUBC
+};
+
+enum translate_kind {
+    TRANSLATE_PLAIN,                // Runs on into the next instruction
+    TRANSLATE_BRANCH,               // JUMP, JMPR or Bxx: ends a block
+    TRANSLATE_SLOW,                 // Left to cpu_exec_n()
+};
+
+static const char *s_branch_cond[] = {
+    [BZ] = "zf",
+    [BNZ] = "!zf",
+    [BN] = "nf",
+    [BNN] = "!nf",
+    [BC] = "cf",
+    [BNC] = "!cf",
+};
+
+static int translate_kind(uint8_t opcode)
+{
+    switch (opcode) {
+        case NOP: case LOAD: case STORE: case LDIH:
+        case ADD: case ADDI: case ADDC: case SUB: case SUBI: case SUBC:
+        case CMP: case AND: case OR: case XOR:
+        case SLL: case SRL: case SLA: case SRA:
+            return TRANSLATE_PLAIN;
+        case JUMP: case JMPR:
+        case BZ: case BNZ: case BN: case BNN: case BC: case BNC:
+            return TRANSLATE_BRANCH;
+        default:
+            return TRANSLATE_SLOW;
+    }
+}
+
+// Instruction memory up to its last non-zero word; the NOPs after it run in cpu_exec_n()
+static uint32_t translate_words(const cpu_t *cpu)
+{
+    uint32_t words = cpu->mem_words;
+    while (words > 0 && cpu->mem_inst[words - 1] == 0) {
+        words--;
+    }
+    return words;
+}
+
+/*
+ * Go to the instruction at target, known at translation time: straight to
+ * its label if it was translated and the budget allows its block, through
+ * finish or slow otherwise.
+ */
+static void translate_goto(FILE *out, const uint32_t *run, uint32_t words, uint16_t target, const char *indent)
+{
+    fprintf(out, "%spc = 0x%04X;\n", indent, target);
+    if (target >= words) {
+        fprintf(out, "%sgoto slow;\n", indent);
+    } else if (run[target] == 0) {
+        fprintf(out, "%sgoto L%04X;\n", indent, target);
+    } else {
+        fprintf(out, "%sAOT_ENTER(%u, L%04X);\n", indent, run[target], target);
+    }
+}
+
+/*
+ * Go to the PC computed from register r1, through the dispatch switch.
+ * Targets relative to gr0 are usually its immediate, so that one is tried
+ * first with a direct goto.
+ */
+static void translate_goto_reg(FILE *out, const cpu_t *cpu, const uint32_t *run, uint32_t words,
+                               const uop_t *uop, const char *indent)
+{
+    uint16_t guess = uop->imm & cpu->mem_mask;
+
+    fprintf(out, "%spc = (r%u + 0x%04X) & AOT_MEM_MASK;\n", indent, uop->r1, uop->imm);
+    if (uop->r1 == 0 && guess < words && run[guess] > 0) {
+        fprintf(out, "%sif (pc == 0x%04X) {\n", indent, guess);
+        fprintf(out, "%s    AOT_ENTER(%u, L%04X);\n", indent, run[guess], guess);
+        fprintf(out, "%s}\n", indent);
+    }
+    fprintf(out, "%sgoto dispatch;\n", indent);
+}
+
+static void translate_inst(FILE *out, const cpu_t *cpu, const uint32_t *run, uint32_t words, uint16_t pc)
+{
+    uop_t uop;
+    char text[256];
+
+    cpu_decode(&uop, cpu->mem_inst[pc]);
+    disassemble(cpu->mem_inst[pc], text);
+    fprintf(out, "L%04X:   // %s\n", pc, text);
+
+    switch (uop.opcode) {
+        case NOP:
+            break;
+        case LOAD:
+        case STORE:
+            // At or above the data limit: a device, or a fault when bounds-checked.
+            // A STORE to a shared page leaves the copy to the interpreter.
+            fprintf(out, "    addr = (r%u + 0x%04X) & AOT_MEM_MASK;\n", uop.r2, uop.imm);
+            if (uop.opcode == LOAD) {
+                fprintf(out, "    if (addr >= data_limit) {\n");
+            } else {
+                fprintf(out, "    if (addr >= data_limit || cpu_page_shared(cpu, addr)) {\n");
+            }
+            fprintf(out, "        pc = 0x%04X;\n", pc);
+            fprintf(out, "        steps -= %u;\n", run[pc]);
+            fprintf(out, "        goto slow;\n");
+            fprintf(out, "    }\n");
+            if (uop.opcode == LOAD) {
+                fprintf(out, "    r%u = mem[addr >> CPU_PAGE_SHIFT][addr & CPU_PAGE_MASK];\n", uop.r1);
+            } else {
+                fprintf(out, "    mem[addr >> CPU_PAGE_SHIFT][addr & CPU_PAGE_MASK] = r%u;\n", uop.r1);
+            }
+            break;
+        case LDIH:
+        case ADDI:
+            fprintf(out, "    r%u += 0x%04X;\n", uop.r1, uop.imm);
+            break;
+        case SUBI:
+            fprintf(out, "    r%u -= 0x%04X;\n", uop.r1, uop.imm);
+            break;
+        case ADD:
+            fprintf(out, "    r%u = r%u + r%u;\n", uop.r1, uop.r2, uop.r3);
+            break;
+        case SUB:
+            fprintf(out, "    r%u = r%u - r%u;\n", uop.r1, uop.r2, uop.r3);
+            break;
+        case ADDC:
+        case SUBC:
+            fprintf(out, "    result = r%u %c r%u %c cf;\n", uop.r2, uop.opcode == ADDC ? '+' : '-',
+                    uop.r3, uop.opcode == ADDC ? '+' : '-');
+            fprintf(out, "    r%u = (uint16_t)result;\n", uop.r1);
+            fprintf(out, "    cf = result > 0xFFFF;\n");
+            break;
+        case CMP:
+            fprintf(out, "    diff = r%u - r%u;\n", uop.r2, uop.r3);
+            fprintf(out, "    zf = diff == 0;\n");
+            fprintf(out, "    nf = diff >> 15;\n");
+            break;
+        case AND:
+            fprintf(out, "    r%u = r%u & r%u;\n", uop.r1, uop.r2, uop.r3);
+            break;
+        case OR:
+            fprintf(out, "    r%u = r%u | r%u;\n", uop.r1, uop.r2, uop.r3);
+            break;
+        case XOR:
+            fprintf(out, "    r%u = r%u ^ r%u;\n", uop.r1, uop.r2, uop.r3);
+            break;
+        case SLL:
+        case SLA:
+            fprintf(out, "    r%u = r%u << %u;\n", uop.r1, uop.r2, uop.imm);
+            break;
+        case SRL:
+            fprintf(out, "    r%u = r%u >> %u;\n", uop.r1, uop.r2, uop.imm);
+            break;
+        case SRA:
+            // The sign bits the shift brings in, cut to 16 bits like the interpreter's
+            fprintf(out, "    r%u = (r%u >> %u) | (r%u & 0x8000 ? 0x%04X : 0);\n", uop.r1, uop.r2, uop.imm,
+                    uop.r2, (uint16_t)(0xFFFFu << (16 - uop.imm)));
+            break;
+        case JUMP:
+            translate_goto(out, run, words, uop.imm & cpu->mem_mask, "    ");
+            return;
+        case JMPR:
+            translate_goto_reg(out, cpu, run, words, &uop, "    ");
+            return;
+        case BZ: case BNZ: case BN: case BNN: case BC: case BNC:
+            fprintf(out, "    if (%s) {\n", s_branch_cond[uop.opcode]);
+            translate_goto_reg(out, cpu, run, words, &uop, "        ");
+            fprintf(out, "    }\n");
+            // Not taken: the next block
+            translate_goto(out, run, words, (pc + 1) & cpu->mem_mask, "    ");
+            return;
+        default:
+            fprintf(out, "    pc = 0x%04X;\n", pc);
+            fprintf(out, "    goto slow;\n");
+            return;
+    }
+
+    // Plain instructions run on; the last translated word goes on at the next PC
+    if (pc + 1 >= words) {
+        translate_goto(out, run, words, (pc + 1) & cpu->mem_mask, "    ");
+    }
+}
+
+static void translate_header(FILE *out, const cpu_t *cpu, uint32_t words, const char *source)
+{
+    struct cpu_config_st config;
+
+    cpu_get_config(cpu, &config);
+    fprintf(out,
+            "/*\n"
+            " * %s translated by translator; do not edit. %u of %u instruction words,\n"
+            " * %s addressing. Build the emulator with make AOT=<this file> and run\n"
+            " * the program with -e aot; see translator/translator.h.\n"
+            " */\n"
+            "#include <string.h>\n"
+            "\n"
+            "#include \"emulator/emulator.h\"\n"
+            "\n"
+            "#define AOT_MEM_WORDS %u\n"
+            "#define AOT_MEM_MASK 0x%04X\n"
+            "#define AOT_WORDS %u\n"
+            "\n",
+            source, words, cpu->mem_words, config.checked ? "bounds-checked" : "wrapping",
+            cpu->mem_words, cpu->mem_mask, words);
+
+    fprintf(out,
+            "// Enter a block that retires run instructions before its exit, if the budget allows\n"
+            "#define AOT_ENTER(run, label) do {                  \\\n"
+            "        if (max_steps - steps < (run)) {            \\\n"
+            "            goto finish;                            \\\n"
+            "        }                                           \\\n"
+            "        steps += (run);                             \\\n"
+            "        goto label;                                 \\\n"
+            "    } while (0)\n"
+            "\n"
+            "#define AOT_SAVE() do {                             \\\n"
+            "        cpu->regs[0] = r0, cpu->regs[1] = r1;       \\\n"
+            "        cpu->regs[2] = r2, cpu->regs[3] = r3;       \\\n"
+            "        cpu->regs[4] = r4, cpu->regs[5] = r5;       \\\n"
+            "        cpu->regs[6] = r6, cpu->regs[7] = r7;       \\\n"
+            "        cpu->zf = zf, cpu->nf = nf, cpu->cf = cf;   \\\n"
+            "        cpu->pc = pc;                               \\\n"
+            "        cpu->steps = start + steps;                 \\\n"
+            "    } while (0)\n"
+            "\n"
+            "#define AOT_LOAD() do {                             \\\n"
+            "        r0 = cpu->regs[0], r1 = cpu->regs[1];       \\\n"
+            "        r2 = cpu->regs[2], r3 = cpu->regs[3];       \\\n"
+            "        r4 = cpu->regs[4], r5 = cpu->regs[5];       \\\n"
+            "        r6 = cpu->regs[6], r7 = cpu->regs[7];       \\\n"
+            "        zf = cpu->zf, nf = cpu->nf, cf = cpu->cf;   \\\n"
+            "        pc = cpu->pc;                               \\\n"
+            "        steps = cpu->steps - start;                 \\\n"
+            "    } while (0)\n"
+            "\n");
+
+    fprintf(out, "static const uint16_t aot_image[AOT_WORDS] = {");
+    for (uint32_t pc = 0; pc < words; pc++) {
+        fprintf(out, "%s0x%04X,", pc % 8 ? " " : "\n    ", cpu->mem_inst[pc]);
+    }
+    fprintf(out, "\n};\n\n");
+}
+
+static void translate_body(FILE *out, const cpu_t *cpu, const uint32_t *run, uint32_t words, int uses)
+{
+    fprintf(out,
+            "int cpu_exec_aot(cpu_t *cpu, uint64_t max_steps)\n"
+            "{\n"
+            "    if (cpu_hooked(cpu) || cpu->debug) {\n"
+            "        return cpu_exec_n(cpu, max_steps);\n"
+            "    }\n"
+            "    if (!cpu->code_translated) {\n"
+            "        // Another program, or this one modified since\n"
+            "        if (cpu->mem_words != AOT_MEM_WORDS || cpu->mem_mask != AOT_MEM_MASK\n"
+            "            || memcmp(cpu->mem_inst, aot_image, sizeof(aot_image)) != 0) {\n"
+            "            return cpu_exec_n(cpu, max_steps);\n"
+            "        }\n"
+            "        cpu->code_translated = 1;\n"
+            "    }\n");
+    fprintf(out,
+            "\n"
+            "    uint64_t start = cpu->steps;\n"
+            "    uint64_t steps = 0;\n"
+            "    uint16_t pc = cpu->pc & AOT_MEM_MASK;\n"
+            "    uint16_t r0, r1, r2, r3, r4, r5, r6, r7;\n"
+            "    uint8_t zf, nf, cf;\n");
+    if (uses & TRANSLATE_USE_MEM) {
+        fprintf(out,
+                "    uint16_t **mem = cpu->mem_data;\n"
+                "    uint32_t data_limit = cpu->data_limit;\n"
+                "    uint16_t addr;\n");
+    }
+    if (uses & TRANSLATE_USE_DIFF) {
+        fprintf(out, "    uint16_t diff;\n");
+    }
+    if (uses & TRANSLATE_USE_RESULT) {
+        fprintf(out, "    uint32_t result;\n");
+    }
+    fprintf(out,
+            "\n"
+            "    AOT_LOAD();\n"
+            "    goto dispatch;\n"
+            "\n");
+
+    for (uint32_t pc = 0; pc < words; pc++) {
+        translate_inst(out, cpu, run, words, pc);
+    }
+
+    fprintf(out, "\ndispatch:\n    switch (pc) {\n");
+    for (uint32_t pc = 0; pc < words; pc++) {
+        if (run[pc] == 0) {
+            fprintf(out, "        case 0x%04X: goto L%04X;\n", pc, pc);
+        } else {
+            fprintf(out, "        case 0x%04X: AOT_ENTER(%u, L%04X);\n", pc, run[pc], pc);
+        }
+    }
+    fprintf(out,
+            "        default: goto slow;\n"
+            "    }\n"
+            "\n"
+            "slow:\n"
+            "    // HALT, TRAP, RETI, CSR, CAS, a reserved opcode, an access at or above the\n"
+            "    // data limit, a STORE to a shared page or a PC outside the translation:\n"
+            "    // one interpreted step\n"
+            "    if (steps == max_steps) {\n"
+            "        goto finish;\n"
+            "    }\n"
+            "    AOT_SAVE();\n"
+            "    cpu->irq.stop = 0;\n"
+            "    cpu_exec_n(cpu, 1);\n"
+            "    if (cpu->steps == start + steps || cpu->irq.stop) {\n"
+            "        return cpu_status(cpu);\n"
+            "    }\n"
+            "    AOT_LOAD();\n"
+            "    goto dispatch;\n"
+            "\n"
+            "finish:\n"
+            "    // Less than the next block of budget left\n"
+            "    AOT_SAVE();\n"
+            "    return cpu_exec_n(cpu, max_steps - steps);\n"
+            "}\n");
+}
+
+/*
+ * Write cpu's program as C. run[pc] counts the instructions from pc that
+ * run before leaving straight-line code: through the next branch, up to
+ * the next instruction left to the interpreter, or to the last word.
+ */
+int translate_program(FILE *out, const cpu_t *cpu, const char *source)
+{
+    uint32_t words = translate_words(cpu);
+    uint32_t *run;
+    int uses = 0;
+
+    if (words == 0) {
+        return -1;
+    }
+    run = (uint32_t *)calloc(words, sizeof(uint32_t));
+    if (!run) {
+        return -1;
+    }
+    for (uint32_t pc = words; pc-- > 0;) {
+        uop_t uop;
+        cpu_decode(&uop, cpu->mem_inst[pc]);
+        if (uop.opcode == LOAD || uop.opcode == STORE) {
+            uses |= TRANSLATE_USE_MEM;
+        } else if (uop.opcode == CMP) {
+            uses |= TRANSLATE_USE_DIFF;
+        } else if (uop.opcode == ADDC || uop.opcode == SUBC) {
+            uses |= TRANSLATE_USE_RESULT;
+        }
+        switch (translate_kind(uop.opcode)) {
+            case TRANSLATE_PLAIN:
+                run[pc] = 1 + (pc + 1 < words ? run[pc + 1] : 0);
+                break;
+            case TRANSLATE_BRANCH:
+                run[pc] = 1;
+                break;
+            default:
+                run[pc] = 0;
+                break;
+        }
+    }
+
+    translate_header(out, cpu, words, source);
+    translate_body(out, cpu, run, words, uses);
+    free(run);
+    return ferror(out) ? -1 : 0;
+}
@@ -0,0 +1,22 @@
+#ifndef TRANSLATOR_H_20251117_
+#define TRANSLATOR_H_20251117_
+
+#include <stdio.h>
+
+#include "emulator/emulator.h"
+
+/*
+ * Ahead-of-time translation of a loaded program into a C definition of
+ * cpu_exec_aot(), the emulator's aot engine (make AOT=file.c). Every
+ * instruction becomes a labelled statement on local registers and flags:
+ * falling through and static JUMP targets are gotos, register targets
+ * (JMPR and Bxx) go through a switch on the PC. The step budget is
+ * checked once per block entry, like the other engines. HALT, TRAP, RETI,
+ * CSR, CAS, reserved opcodes, LOAD/STORE at or above the data limit and PCs
+ * outside the translation run one at a time in cpu_exec_n(), and a CPU
+ * whose memory size or instruction memory differs from the translation,
+ * or with hooks or a debug set attached, runs in cpu_exec_n() entirely.
+ */
+int translate_program(FILE *out, const cpu_t *cpu, const char *source);
+
+#endif  // TRANSLATOR_H_20251117_